@@ -34,36 +34,72 @@
  * Some pieces of this code assume that the definitions and the "atom"
  * strings used in the interpreter share a single struct hashtable for
  * storage.
+ *
+ * The stored parse trees consist of permanent nodes (see make_permanent()
+ * in node.c), so abbreviation_lookup() can splice the stored tree into the
+ * input by reference.  perform_reduction() copies the part of it that a
+ * contraction would overwrite.  With "debug" or "trace" on, every use gets
+ * its own arena copy, since that output tells nodes apart by serial number.
+ *
+ * A stored tree can have atoms that didn't name a primitive when the
+ * tree got defined.  Once a "rule:" gives one of those names a rule,
+ * abbreviation_lookup() swaps in the primitive's atom, in every tree.
  */
 
 
 #include <stdio.h>
 #include <stdlib.h>  /* malloc(), free() */
+#include <setjmp.h>
 
 #include <node.h>
 #include <hashtable.h>
+#include <atom.h>
 #include <abbreviations.h>
+#include <image.h>
+#include <context.h>
 
-struct hashtable *abbr_table = NULL;
+/* One interpreter context's abbreviations, see context.h.
+ * The trees hang off the context's string table. */
+struct abbreviation_state {
+	/* Value of rule_generation when refresh_abbreviations() last ran */
+	int abbreviation_generation;
 
-void
-setup_abbreviation_table(struct hashtable *h)
+	/* A redefined abbreviation's old tree.  The input that redefines
+	 * it can refer to it, so it gets freed one definition later. */
+	struct node *retired_graph;
+};
+
+static void refresh_abbreviations(void);
+static struct node *refresh_rules(struct node *p);
+static void save_graph(FILE *out, struct node *p);
+static struct node *load_graph(struct image *im);
+
+struct abbreviation_state *
+new_abbreviation_state(void)
 {
-	abbr_table = h;
+	return calloc(1, sizeof(struct abbreviation_state));
 }
 
 struct node *
 abbreviation_lookup(const char *id)
 {
+	struct abbreviation_state *as = current_context->abbreviations;
 	struct node *r = NULL;
-	void *p = data_lookup(abbr_table, id);
-	/* make an arena-allocated copy of the abbreviation, so that
-	 * reduce_graph() can destructively reduce the resulting
-	 * parse tree. */
+	void *p;
+
+	if (as->abbreviation_generation != current_context->rule_generation)
+		refresh_abbreviations();
+
+	p = data_lookup(current_context->strings, id);
+
 	if (p)
 	{
-		preallocate_nodes(((struct node *)p)->tree_size);
-		r = arena_copy_graph((struct node *)p);
+		if (current_context->debug_reduction || current_context->trace_reduction)
+		{
+			preallocate_nodes(((struct node *)p)->tree_size);
+			r = arena_copy_graph((struct node *)p);
+		} else
+			r = (struct node *)p;
 	}
 	return r;
 }
@@ -71,6 +107,7 @@ abbreviation_lookup(const char *id)
 void
 abbreviation_add(const char *id, struct node *expr)
 {
+	struct abbreviation_state *as = current_context->abbreviations;
 	struct hashnode *n = NULL;
 	unsigned int hv;
 
@@ -81,11 +118,13 @@ abbreviation_add(const char *id, struct node *expr)
 	 * of "abbreviations". The lexer code guarantess
 	 * it by calling Atom_string() on all input strings.
 	 * Therefore, this code *always* finds string id
-	 * in the abbr_table.
+	 * in the string table.
 	 */
-	n = node_lookup(abbr_table, id, &hv);
+	n = node_lookup(current_context->strings, id, &hv);
 
-	free_graph((struct node *)n->data);
+	/* By now, the arena has been reset since retired_graph was current */
+	free_graph(as->retired_graph);
+	as->retired_graph = (struct node *)n->data;
 
 	/* Make a "permanent" copy of the parse tree, not arena.
 	 * allocated.  At the end of a read-eval-print loop, the
@@ -95,35 +134,162 @@ abbreviation_add(const char *id, struct node *expr)
 	n->data = (void *)copy_graph(expr);
 }
 
+static void
+refresh_abbreviations(void)
+{
+	struct abbreviation_state *as = current_context->abbreviations;
+	struct hashnode *n;
+	int id;
+
+	for (id = 1; (n = id_lookup(current_context->strings, id)); ++id)
+		if (n->data)
+			n->data = (void *)refresh_rules((struct node *)n->data);
+
+	as->abbreviation_generation = current_context->rule_generation;
+}
+
+/* Returns p, or the atom to use in its place. */
+static struct node *
+refresh_rules(struct node *p)
+{
+	if (ATOM == p->typ)
+	{
+		struct reduction_rule *rule = Atom_rule(Atom_id(p->name));
+		return (rule == p->rule)? p: flyweight_atom(p->name, rule);
+	}
+
+	p->left = refresh_rules(p->left);
+	p->right = refresh_rules(p->right);
+
+	return p;
+}
+
+/* Interpreter images: each abbreviation's name, then its tree in
+ * pre-order, 0 for an application, an atom ID for an atom. */
+void
+save_abbreviations(FILE *out)
+{
+	struct hashnode *n;
+	int id, count = 0;
+
+	for (id = 1; (n = id_lookup(current_context->strings, id)); ++id)
+		if (n->data)
+			++count;
+
+	image_put(out, count);
+	for (id = 1; (n = id_lookup(current_context->strings, id)); ++id)
+		if (n->data)
+		{
+			image_put_atom(out, n->string);
+			save_graph(out, (struct node *)n->data);
+		}
+}
+
+static void
+save_graph(FILE *out, struct node *p)
+{
+	if (ATOM == p->typ)
+		image_put_atom(out, p->name);
+	else {
+		image_put(out, 0);
+		save_graph(out, p->left);
+		save_graph(out, p->right);
+	}
+}
+
+/* Builds the permanent trees directly, instead of parsing
+ * into the arena and having copy_graph() copy them. */
+void
+load_abbreviations(struct image *im)
+{
+	struct abbreviation_state *as = current_context->abbreviations;
+	int i, count = image_get(im, 0, im->end - im->p);
+
+	for (i = 0; i < count && !im->bad; ++i)
+	{
+		const char *name = image_get_atom(im);
+		struct node *graph = load_graph(im);
+		unsigned int hv;
+		struct hashnode *n;
+
+		if (!name || !graph)
+			im->bad = 1;
+		if (im->bad || im->check_only)
+		{
+			free_graph(graph);
+			continue;
+		}
+
+		n = node_lookup(current_context->strings, name, &hv);
+		free_graph(as->retired_graph);
+		as->retired_graph = (struct node *)n->data;
+		n->data = (void *)graph;
+	}
+}
+
+static struct node *
+load_graph(struct image *im)
+{
+	const char *name = image_get_atom(im);
+	struct node *r;
+
+	if (im->bad)
+		return NULL;
+
+	if (name)
+		return flyweight_atom(name, Atom_rule(Atom_id(name)));
+
+	r = malloc(sizeof(*r));
+	r->typ = APPLICATION;
+	r->name = "@";
+	r->rule = NULL;
+	r->left = load_graph(im);
+	r->right = r->left? load_graph(im): NULL;
+	if (!r->left || !r->right)
+	{
+		free_graph(r->left);
+		free(r);
+		return NULL;
+	}
+	r->tree_size = r->left->tree_size + r->right->tree_size + 1;
+	make_permanent(r);
+
+	return r;
+}
+
+void
+cleanup_abbreviations(void)
+{
+	struct abbreviation_state *as = current_context->abbreviations;
+
+	free_graph(as->retired_graph);
+	as->retired_graph = NULL;
+}
+
 /*
  * malloc() based parse tree ("graph") copy.
  * If a "reduce" interpreter command causes the input graph
  * to have multiply-referenced structs node, this function
  * ignores that.  Sub-trees that are "shared" get un-shared.
+ * Atoms come out as flyweights, which the copy shares.
  */
 struct node *
 copy_graph(struct node *p)
 {
 	struct node *r = NULL;
 
+	if (ATOM == p->typ)
+		return flyweight_atom(p->name, p->rule);
+
 	r = malloc(sizeof(*r));
-	r->typ = p->typ;
+	r->typ = APPLICATION;
 	r->name = p->name;
-	r->sn = -666;
+	r->rule = NULL;
+	r->left = copy_graph(p->left);
+	r->right = copy_graph(p->right);
+	r->tree_size = r->left->tree_size + r->right->tree_size + 1;
+	make_permanent(r);
 
-	switch (p->typ)
-	{
-	case APPLICATION:
-		r->left = copy_graph(p->left);
-		r->right = copy_graph(p->right);
-		r->tree_size = r->left->tree_size + r->right->tree_size + 1;
-		break;
-	case ATOM:
-		r->rule = p->rule;
-		r->left = r->right = NULL;
-		r->tree_size = 1;
-		break;
-	}
 	return r;
 }
 
@@ -135,7 +301,7 @@ copy_graph(struct node *p)
 void
 free_graph(struct node *p)
 {
-	if (!p) return;
+	if (!p || ATOM == p->typ) return;  /* flyweights belong to node.c */
 
 	free_graph(p->left);
 	free_graph(p->right);
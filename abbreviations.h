@@ -20,10 +20,15 @@
 */
 /* $Id: abbreviations.h,v 1.4 2011/06/12 18:19:11 bediger Exp $ */
 
-void setup_abbreviation_table(struct hashtable *h);
+struct abbreviation_state;
+struct abbreviation_state *new_abbreviation_state(void);
 
 struct node *abbreviation_lookup(const char *id);
 void         abbreviation_add(const char *id, struct node *expr);
+void         cleanup_abbreviations(void);
+struct image;
+void         save_abbreviations(FILE *out);
+void         load_abbreviations(struct image *im);
 
 /* malloc/free based whole-graph copy and delete.  Only free_graph()
  * gets used outside abbreviations.c, by hashtable module */
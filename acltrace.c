@@ -0,0 +1,259 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * acltrace: print a "trace binary" file the way "trace on" would
+ * have printed the graphs in it, see trace.h.  With -s, it also
+ * prints a line for each contraction.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>   /* getopt() */
+
+#include <trace.h>
+
+extern int optind;
+
+static char **names = NULL;        /* names[n]: name number n */
+static unsigned long *depths = NULL;  /* required depth + 1, 0: no rule */
+static unsigned long name_count = 0;
+
+static int  read_name(FILE *in);
+static int  print_step(FILE *in);
+static int  print_graph(FILE *in);
+static long print_term(FILE *in, unsigned long tag, unsigned long stack_depth, int marks);
+static int  get_varint(FILE *in, unsigned long *v);
+void usage(char *progname);
+
+int
+main(int ac, char **av)
+{
+	char magic[sizeof(TRACE_MAGIC)];
+	int c, steps = 0, r = 0;
+	FILE *in;
+
+	while (-1 != (c = getopt(ac, av, "s")))
+	{
+		switch (c)
+		{
+		case 's':
+			steps = 1;
+			break;
+		default:
+			usage(av[0]);
+			exit(1);
+			break;
+		}
+	}
+
+	if (optind != ac - 1)
+	{
+		usage(av[0]);
+		exit(1);
+	}
+
+	if (!(in = fopen(av[optind], "rb")))
+	{
+		fprintf(stderr, "Could not open \"%s\" for read: %s\n",
+			av[optind], strerror(errno));
+		exit(1);
+	}
+
+	if (1 != fread(magic, strlen(TRACE_MAGIC), 1, in)
+		|| memcmp(magic, TRACE_MAGIC, strlen(TRACE_MAGIC))
+		|| TRACE_VERSION != getc(in))
+	{
+		fprintf(stderr, "\"%s\" isn't a trace file\n", av[optind]);
+		exit(1);
+	}
+
+	while (!r && EOF != (c = getc(in)))
+	{
+		switch (c)
+		{
+		case TRACE_NAME:
+			r = read_name(in);
+			break;
+		case TRACE_STEP:
+			if (steps)
+				r = print_step(in);
+			else {
+				unsigned long ignore;
+				int i;
+				for (i = 0; i < 5 && !r; ++i)
+					r = !get_varint(in, &ignore);
+			}
+			break;
+		case TRACE_GRAPH:
+			r = print_graph(in);
+			break;
+		default:
+			r = 1;
+			break;
+		}
+	}
+
+	/* A reduction might still be writing the file */
+	if (r)
+		fprintf(stderr, "\"%s\" ends early or has a bad record\n", av[optind]);
+
+	fclose(in);
+
+	return r;
+}
+
+static int
+read_name(FILE *in)
+{
+	unsigned long n, depth, length;
+
+	if (!get_varint(in, &n) || !get_varint(in, &depth) || !get_varint(in, &length))
+		return 1;
+
+	if (n >= name_count)
+	{
+		unsigned long new_count = 2*n + 64;
+
+		names = realloc(names, new_count*sizeof(names[0]));
+		depths = realloc(depths, new_count*sizeof(depths[0]));
+		memset(names + name_count, 0, (new_count - name_count)*sizeof(names[0]));
+		name_count = new_count;
+	}
+
+	free(names[n]);
+	names[n] = malloc(length + 1);
+	depths[n] = depth;
+	if (length != fread(names[n], 1, length, in))
+		return 1;
+	names[n][length] = '\0';
+
+	return 0;
+}
+
+static int
+print_step(FILE *in)
+{
+	unsigned long step, name, redex, depth, live;
+
+	if (!get_varint(in, &step) || !get_varint(in, &name) || !get_varint(in, &redex)
+		|| !get_varint(in, &depth) || !get_varint(in, &live)
+		|| name >= name_count || !names[name])
+		return 1;
+
+	printf("contraction %lu: %s, redex {%lu}, spine depth %lu, %lu live nodes\n",
+		step, names[name], redex, depth, live);
+
+	return 0;
+}
+
+/* One line, as graph.c prints it for "trace on", and with
+ * "detect on", with the redex count and asterisks. */
+static int
+print_graph(FILE *in)
+{
+	unsigned long step, count, tag;
+
+	if (!get_varint(in, &step) || !get_varint(in, &count) || !get_varint(in, &tag))
+		return 1;
+
+	if (count)
+		printf("[%lu] ", count - 1);
+	if (0 > print_term(in, tag, 0, 0 != count))
+		return 1;
+	putc('\n', stdout);
+
+	return 0;
+}
+
+#define REDEX(n, depth) (depths[n] && (depth) + 1 >= depths[n])
+
+/* Prints the term whose first varint, already read, is tag.
+ * Returns its name number for an atom, 0 for an application,
+ * -1 for a bad file. */
+static long
+print_term(FILE *in, unsigned long tag, unsigned long stack_depth, int marks)
+{
+	long left;
+
+	if (tag)
+	{
+		if (tag >= name_count || !names[tag])
+			return -1;
+		fputs(names[tag], stdout);
+		return tag;
+	}
+
+	if (!get_varint(in, &tag)
+		|| 0 > (left = print_term(in, tag, stack_depth + 1, marks)))
+		return -1;
+	if (left && marks && REDEX(left, stack_depth + 1))
+		putc('*', stdout);
+
+	putc(' ', stdout);
+
+	if (!get_varint(in, &tag))
+		return -1;
+	if (tag)
+	{
+		if (0 > print_term(in, tag, 0, marks))
+			return -1;
+		if (marks && REDEX(tag, 0))
+			putc('*', stdout);
+	} else {
+		putc('(', stdout);
+		if (0 > print_term(in, tag, 0, marks))
+			return -1;
+		putc(')', stdout);
+	}
+
+	return 0;
+}
+
+static int
+get_varint(FILE *in, unsigned long *v)
+{
+	unsigned long r = 0;
+	int shift = 0, c;
+
+	do {
+		if (EOF == (c = getc(in)) || shift > 63)
+			return 0;
+		r |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	*v = r;
+
+	return 1;
+}
+
+void
+usage(char *progname)
+{
+	fprintf(stderr, "%s: print a reduction trace from \"trace binary\"\n", progname);
+	fprintf(stderr, "Usage: %s [-s] filename\n", progname);
+	fprintf(stderr,
+		"-s             also print a line for each contraction\n"
+	);
+}
@@ -44,6 +44,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <setjmp.h>
 
 #include <node.h>
 #include <aho_corasick.h>
@@ -52,6 +53,8 @@
 #include <atom.h>
 #include <buffer.h>
 #include <graph.h>
+#include <image.h>
+#include <context.h>
 
 /* From "Pattern Matching in Trees". */
 struct stack_elem {
@@ -64,16 +67,28 @@ struct stack_elem {
 void set_output_length(struct gto *p, int state, int node_cnt);
 int tabulate(struct gto *g, struct stack_elem *stk, int top, int state, int pat_leaf_count, int *count);
 
-const char *abstr_meta_var;
+/* One interpreter context's Algorithm D working storage, see context.h */
+struct matcher_state {
+	int *count;
+	struct stack_elem *stack;
+	unsigned int stack_sz;
+	const char *abstr_meta_var;
+};
 
+struct matcher_state *
+new_matcher_state(void)
+{
+	return calloc(1, sizeof(struct matcher_state));
+}
 
 struct gto *
 init_goto()
 {
+	struct matcher_state *ms = current_context->matcher;
 	int i;
 	struct gto *g = NULL;
 
-	abstr_meta_var = Atom_string("_");
+	ms->abstr_meta_var = Atom_string("_");
 
 	g = malloc(sizeof(*g));
 
@@ -93,6 +108,7 @@ init_goto()
 	g->output->out = NULL;
 
 	g->max_node_count = 0;
+	g->mapped = 0;
 
 	return g;
 }
@@ -318,22 +334,134 @@ destroy_goto(struct gto *p)
 {
 	int i;
 
-	for (i = 0; i < p->ary_len; ++i)
-		free(p->ary[i]);
+	/* Tables from an image belong to its mapping. */
+	if (!p->mapped)
+		for (i = 0; i < p->ary_len; ++i)
+			free(p->ary[i]);
 
 	free(p->ary);
 
-	for (i = 0; i < p->output_len; ++i)
-		free(p->output[i].out);
+	if (!p->mapped)
+		for (i = 0; i < p->output_len; ++i)
+			free(p->output[i].out);
 
 	if (NULL != p->output) free(p->output);
-	if (NULL != p->failure) free(p->failure);
-	if (NULL != p->delta[0]) free(p->delta[0]);
+	if (NULL != p->failure && !p->mapped) free(p->failure);
+	if (NULL != p->delta[0] && !p->mapped) free(p->delta[0]);
 	if (NULL != p->delta) free(p->delta);
 
 	free(p);
 }
 
+/* Bytes of memory taken up by the goto, failure,
+ * delta and output tables of g. */
+size_t
+goto_table_size(struct gto *g)
+{
+	int i;
+	size_t sz = sizeof(*g);
+
+	sz += g->ary_len*(sizeof(int *) + 128*sizeof(int));
+	if (g->failure)
+		sz += g->ary_len*sizeof(int);
+	if (g->delta)
+		sz += g->ary_len*(sizeof(int *) + 128*sizeof(int));
+	sz += g->output_len*sizeof(struct output_extent);
+	for (i = 0; i < g->output_len; ++i)
+		sz += g->output[i].max*sizeof(int);
+
+	return sz;
+}
+
+/* Interpreter images: the goto, failure and delta tables go in
+ * as they are, so that load_goto() can use them in place. */
+void
+save_goto(FILE *out, struct gto *g)
+{
+	int i;
+
+	image_put(out, g->ary_len);
+	for (i = 0; i < g->ary_len; ++i)
+		image_put_array(out, g->ary[i], 128);
+	image_put_array(out, g->failure, g->ary_len);
+	image_put_array(out, g->delta[0], 128*g->ary_len);
+
+	image_put(out, g->max_node_count);
+	image_put(out, g->output_len);
+	for (i = 0; i < g->output_len; ++i)
+	{
+		image_put(out, g->output[i].len);
+		image_put_array(out, g->output[i].out, g->output[i].len);
+	}
+}
+
+/* A struct gto that points into an image.  Every state number
+ * gets checked, since algorithm_d() doesn't. */
+struct gto *
+load_goto(struct image *im)
+{
+	struct matcher_state *ms = current_context->matcher;
+	struct gto *g;
+	int *rows, *failure, *delta;
+	int i, len, output_len;
+
+	ms->abstr_meta_var = Atom_string("_");
+
+	len = image_get(im, 1, 0x100000);
+	rows = image_get_array(im, 128*len);
+	failure = image_get_array(im, len);
+	delta = image_get_array(im, 128*len);
+	if (im->bad)
+		return NULL;
+	for (i = 0; i < 128*len; ++i)
+		if (rows[i] < FAIL || rows[i] >= len || delta[i] < 0 || delta[i] >= len
+			|| (i < len && (failure[i] < 0 || failure[i] >= len)))
+		{
+			im->bad = 1;
+			return NULL;
+		}
+
+	g = malloc(sizeof(*g));
+	g->mapped = 1;
+	g->ary_len = len;
+	g->ary = malloc(len*sizeof(int *));
+	g->delta = malloc(len*sizeof(int *));
+	for (i = 0; i < len; ++i)
+	{
+		g->ary[i] = rows + 128*i;
+		g->delta[i] = delta + 128*i;
+	}
+	g->failure = failure;
+
+	g->max_node_count = image_get(im, 0, 0x100000);
+
+	/* tabulate() looks at the output of any state */
+	output_len = image_get(im, 1, len);
+	g->output_len = len;
+	g->output = malloc(len*sizeof(*g->output));
+	for (i = 0; i < len; ++i)
+	{
+		struct output_extent *oxt = &g->output[i];
+		int j;
+
+		oxt->len = oxt->max = (i < output_len)? image_get(im, 0, 0x100000): 0;
+		oxt->out = oxt->len? image_get_array(im, oxt->len): NULL;
+		for (j = 0; oxt->out && j < oxt->len; ++j)
+			if (oxt->out[j] < 1 || oxt->out[j] > g->max_node_count)
+				im->bad = 1;
+		if (im->bad)
+			oxt->len = 0;
+	}
+
+	if (im->bad)
+	{
+		destroy_goto(g);
+		g = NULL;
+	}
+
+	return g;
+}
+
 void
 construct_delta(struct gto *g)
 {
@@ -390,15 +518,10 @@ construct_delta(struct gto *g)
  * subject node, do the RHS, perform the replacement specified by the
  * RHS of the abstraction rule at that node.
  */
-
-static int *count = NULL;
-static struct stack_elem *stack = NULL;
-static unsigned int stack_sz = 0;
-
-
 int
 algorithm_d(struct gto *g, struct node *t, int subject_node_count, int pat_path_cnt, const char *abstr_var_name)
 {
+	struct matcher_state *ms = current_context->matcher;
 	int top = 1;
 	int matched = 0;
 	int breadth_counter = 0;
@@ -408,31 +531,31 @@ algorithm_d(struct gto *g, struct node *t, int subject_node_count, int pat_path_
 
 	++subject_node_count; /* 0-indexed arrays, first element at index 1 */
 
-	if (subject_node_count > stack_sz)
+	if (subject_node_count > ms->stack_sz)
 	{
 		if (subject_node_count < 100)
-			stack_sz = 100;
+			ms->stack_sz = 100;
 		else
-			stack_sz = subject_node_count;
-		if (count) free(count);
-		count = malloc(stack_sz * sizeof(int));
-		if (stack) free(stack);
-		stack = malloc(stack_sz * sizeof(struct stack_elem));
+			ms->stack_sz = subject_node_count;
+		if (ms->count) free(ms->count);
+		ms->count = malloc(ms->stack_sz * sizeof(int));
+		if (ms->stack) free(ms->stack);
+		ms->stack = malloc(ms->stack_sz * sizeof(struct stack_elem));
 	}
 
-	memset(count, 0, stack_sz * sizeof(int));
+	memset(ms->count, 0, ms->stack_sz * sizeof(int));
 
 	next_state = 0;
-	p = (t->name != abstr_var_name)? t->name: abstr_meta_var;
+	p = (t->name != abstr_var_name)? t->name: ms->abstr_meta_var;
 	while (*p)
 		next_state = g->delta[next_state][(int)*p++];
 
-	stack[top].n = t;
-	stack[top].state_at_n = next_state;
-	stack[top].visited = 0;
-	stack[top].node_number = breadth_counter++;
+	ms->stack[top].n = t;
+	ms->stack[top].state_at_n = next_state;
+	ms->stack[top].visited = 0;
+	ms->stack[top].node_number = breadth_counter++;
 
-	matched += tabulate(g, stack, top, next_state, pat_path_cnt, count);
+	matched += tabulate(g, ms->stack, top, next_state, pat_path_cnt, ms->count);
 
 	if (!matched)
 	{
@@ -442,49 +565,49 @@ algorithm_d(struct gto *g, struct node *t, int subject_node_count, int pat_path_
 				next_state = g->delta[0][(int)'+'];
 			else
 				next_state = g->delta[0][(int)'-'];
-			matched += tabulate(g, stack, top, next_state, pat_path_cnt, count);
+			matched += tabulate(g, ms->stack, top, next_state, pat_path_cnt, ms->count);
 		} else {
 			next_state = g->delta[0][(int)'!'];
-			matched += tabulate(g, stack, top, next_state, pat_path_cnt, count);
+			matched += tabulate(g, ms->stack, top, next_state, pat_path_cnt, ms->count);
 			if (!matched)
 			{
 				next_state = g->delta[0][(int)'-'];
-				matched += tabulate(g, stack, top, next_state, pat_path_cnt, count);
+				matched += tabulate(g, ms->stack, top, next_state, pat_path_cnt, ms->count);
 			}
 		}
 	}
 
 	while (!matched && top > 0)
 	{
-		struct node *next_node, *this_node = stack[top].n;
-		int intstate, nxt_st, this_state = stack[top].state_at_n;
-		int visited = stack[top].visited;
+		struct node *next_node, *this_node = ms->stack[top].n;
+		int intstate, nxt_st, this_state = ms->stack[top].state_at_n;
+		int visited = ms->stack[top].visited;
 
 		if (visited == 2 || this_node->typ == ATOM || top > g->max_node_count)
 			--top;
 		else {
 			++visited;
-			stack[top].visited = visited;
+			ms->stack[top].visited = visited;
 
 			intstate = g->delta[this_state][visited == 1?'1':'2'];
-			matched += tabulate(g, stack, top, intstate, pat_path_cnt, count);
+			matched += tabulate(g, ms->stack, top, intstate, pat_path_cnt, ms->count);
 
 			next_node = (visited == 1)? this_node->left: this_node->right;
 			nxt_st = intstate;
 
-			p = (next_node->name != abstr_var_name)? next_node->name: abstr_meta_var;
+			p = (next_node->name != abstr_var_name)? next_node->name: ms->abstr_meta_var;
 			while (*p)
 				nxt_st = g->delta[nxt_st][(int)*p++];
 
 			++top;
-			stack[top].n = next_node;
-			stack[top].state_at_n = nxt_st;
-			stack[top].visited = 0;
-			stack[top].node_number = breadth_counter++;
+			ms->stack[top].n = next_node;
+			ms->stack[top].state_at_n = nxt_st;
+			ms->stack[top].visited = 0;
+			ms->stack[top].node_number = breadth_counter++;
 
 			if (top <= g->max_node_count)
 			{
-				matched += tabulate(g, stack, top, nxt_st, pat_path_cnt, count);
+				matched += tabulate(g, ms->stack, top, nxt_st, pat_path_cnt, ms->count);
 
 				if (!matched)
 				{
@@ -494,12 +617,12 @@ algorithm_d(struct gto *g, struct node *t, int subject_node_count, int pat_path_
 						if (exact_match_node)
 						{
 							if (equivalent_graphs(exact_match_node, next_node))
-								matched += tabulate(g, stack, top, nxt_st, pat_path_cnt, count);
+								matched += tabulate(g, ms->stack, top, nxt_st, pat_path_cnt, ms->count);
 						} else {
 							/* XXX - what about a 3-way match?
 							 * should increment count[something] here, as we found it. */
 							exact_match_node = next_node;
-							matched += tabulate(g, stack, top, nxt_st, pat_path_cnt, count);
+							matched += tabulate(g, ms->stack, top, nxt_st, pat_path_cnt, ms->count);
 						}
 					}
 				}
@@ -518,7 +641,7 @@ algorithm_d(struct gto *g, struct node *t, int subject_node_count, int pat_path_
 							nxt_st = g->delta[intstate][(int)'-'];
 					}
 
-					matched += tabulate(g, stack, top, nxt_st, pat_path_cnt, count);
+					matched += tabulate(g, ms->stack, top, nxt_st, pat_path_cnt, ms->count);
 				}
 			}
 		}
@@ -563,14 +686,16 @@ tabulate(struct gto *g, struct stack_elem *stk, int top, int state, int pat_leaf
 void
 cleanup_abstraction(void)
 {
-	if ((stack || count) && stack_sz == 0)
+	struct matcher_state *ms = current_context->matcher;
+
+	if ((ms->stack || ms->count) && ms->stack_sz == 0)
 		fprintf(stderr, "Problem: bracket abstraction stack (%p) or count (%p) non-NULL but stack size wrong (%d)\n",
-			stack, count, stack_sz);
-	if ((stack == NULL || count == NULL) && stack_sz != 0)
+			ms->stack, ms->count, ms->stack_sz);
+	if ((ms->stack == NULL || ms->count == NULL) && ms->stack_sz != 0)
 		fprintf(stderr, "Problem: bracket abstraction stack (%p) or count (%p) NULL but stack size non-zero (%d)\n",
-			stack, count, stack_sz);
-	if (stack) free(stack);
-	stack = NULL;
-	if (count) free(count);
-	count = NULL;
+			ms->stack, ms->count, ms->stack_sz);
+	if (ms->stack) free(ms->stack);
+	ms->stack = NULL;
+	if (ms->count) free(ms->count);
+	ms->count = NULL;
 }
@@ -34,6 +34,7 @@ struct gto {
 	struct output_extent *output;  /* output for output states */
 	int   output_len;              /* max state for output states */
 	int max_node_count;
+	int mapped;                    /* tables are in an image, see load_goto() */
 };
 
 #define FAIL -1
@@ -45,6 +46,12 @@ void construct_failure(struct gto *g);
 void construct_delta(struct gto *g);
 struct gto *init_goto(void);
 void        destroy_goto(struct gto *);
+size_t      goto_table_size(struct gto *g);
+struct image;
+void        save_goto(FILE *out, struct gto *g);
+struct gto *load_goto(struct image *im);
 
 int algorithm_d(struct gto *g, struct node *subject, int subject_node_count, int pat_path_cnt, const char *abstr_var_name);
 void cleanup_abstraction(void);
+struct matcher_state;
+struct matcher_state *new_matcher_state(void);
@@ -20,14 +20,49 @@
 */
 /* $Id: arena.c,v 1.7 2011/07/10 20:10:59 bediger Exp $ */
 
+/*
+ * Bump allocation out of fixed size, mmap()'ed chunks.
+ *
+ * Requests of up to ARENA_SMALL_LIMIT bytes come out of the "current"
+ * chunk. When it fills up, allocation moves on to the next chunk in
+ * the list, mapping a new one at the end of the list if necessary.
+ * Chunks after the current one are always empty, so arena_alloc()
+ * never searches. Bigger requests (preallocate_nodes() for large
+ * abbreviations) get a mapping of their own.
+ *
+ * free_arena_contents() empties all chunks at the end of a read-eval-print
+ * loop. The first ARENA_KEEP_CHUNKS chunks stay as they are. The rest get
+ * madvise(MADV_DONTNEED), so the pages go back to the operating system
+ * but the address space stays mapped for the next big reduction. Chunks
+ * unused for ARENA_TRIM_IDLE resets get unmapped, so an idle session
+ * shrinks back to ARENA_KEEP_CHUNKS chunks.
+ *
+ * ARENA_CHUNK_SIZE chunks start on an ARENA_CHUNK_SIZE boundary, so
+ * that with MADV_HUGEPAGE the kernel can back each one with a single
+ * huge page.  map_chunk() over-allocates by a chunk, and unmaps the
+ * unaligned ends.
+ */
+
 #include <stdio.h>
 #include <unistd.h>  /* getpagesize() */
 #include <stdlib.h>  /* malloc(), free() */
+#include <sys/types.h>
+#include <sys/mman.h> /* mmap(), munmap(), madvise() */
+#include <pthread.h>
 
 #include <arena.h>
 
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
 #define roundup(x, y)   ((((x)+((y)-1))/(y))*(y))
 
+#define ARENA_CHUNK_SIZE  (2*1024*1024)  /* a huge page on x86 */
+#define ARENA_SMALL_LIMIT (ARENA_CHUNK_SIZE/16)
+#define ARENA_KEEP_CHUNKS 1
+#define ARENA_TRIM_IDLE   8
+
 union combo {
 	char c;
 	short s;
@@ -43,113 +78,261 @@ union combo {
 	double d;
 };
 
-struct memory_arena {
+struct arena_chunk {
 	char *first_allocation;
 	char *next_allocation;
-	int sz;                     /* max free size */
-	int remaining;              /* how many bytes remain in allocation */
-	struct memory_arena *next;
+	char *limit;
+	size_t size;                /* size of the whole mapping */
+	int idle;                   /* resets since last used */
+	int dirty;                  /* pages touched since last madvise() */
+	struct arena_chunk *next;
 };
 
-static int pagesize = 0;
-static int headersize = 0;
-static int combosize = 0;
+struct memory_arena {
+	struct arena_chunk *chunks;     /* ARENA_CHUNK_SIZE chunks, in use order */
+	struct arena_chunk *current;    /* bump allocating from this one */
+	struct arena_chunk *tail;
+	struct arena_chunk *large;      /* one mapping per big allocation */
+};
+
+#define COMBO_SIZE  sizeof(union combo)
+#define HEADER_SIZE roundup(sizeof(struct arena_chunk), COMBO_SIZE)
+
+/* Bytes mapped, over all arenas, in every interpreter
+ * context.  Contexts can map and unmap at the same time. */
+static size_t total_reserved = 0;
+static size_t peak_reserved = 0;
+static pthread_mutex_t reserved_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* Public way to get a new struct memory_arena
- * The first struct memory_arena in a chain constitutes a "dummy",
- * an empty head element of a FIFO (stack) of structs memory_arena.
- * The first allocation demanded from a memory arena will cause
- * the malloc() of one or more pages, and a 2nd element in the stack.
+static struct arena_chunk *map_chunk(size_t size);
+static void unmap_chunk(struct arena_chunk *c);
+static void release_pages(struct arena_chunk *c);
+
+/* Public way to get a new struct memory_arena.
+ * No chunks get mapped until the first allocation.
  */
 struct memory_arena *
 new_arena(void)
 {
 	struct memory_arena *ra = NULL;
 
-	/* This is not so costly that it can't happen
-	 * on every call to new_arena(). */
-	combosize = sizeof(union combo);
-	pagesize = 8 * getpagesize();
-	headersize = roundup(sizeof(struct memory_arena), combosize);
-
 	ra = malloc(sizeof(*ra));
 
-	ra->sz = 0;
-	ra->remaining = 0;
-	ra->first_allocation = ra->next_allocation = NULL;
-	ra->next = NULL;
+	ra->chunks = ra->current = ra->tail = NULL;
+	ra->large = NULL;
 
 	return ra;
 }
 
+static struct arena_chunk *
+map_chunk(size_t size)
+{
+	struct arena_chunk *c;
+	void *p;
+
+	size_t slop;
+	char *start;
+
+	size = roundup(size, getpagesize());
+	slop = (ARENA_CHUNK_SIZE == size)? ARENA_CHUNK_SIZE: 0;
+
+	p = mmap(NULL, size + slop, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == p)
+	{
+		perror("mmap");
+		exit(1);
+	}
+
+	if (slop)
+	{
+		start = (char *)roundup((unsigned long)p, ARENA_CHUNK_SIZE);
+		if (start > (char *)p)
+			munmap(p, start - (char *)p);
+		if (start + size < (char *)p + size + slop)
+			munmap(start + size, (char *)p + slop - start);
+		p = start;
+#ifdef MADV_HUGEPAGE
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	pthread_mutex_lock(&reserved_lock);
+	total_reserved += size;
+	if (total_reserved > peak_reserved)
+		peak_reserved = total_reserved;
+	pthread_mutex_unlock(&reserved_lock);
+
+	c = p;
+	c->first_allocation = ((char *)c) + HEADER_SIZE;
+	c->next_allocation = c->first_allocation;
+	c->limit = ((char *)c) + size;
+	c->size = size;
+	c->idle = 0;
+	c->dirty = 1;
+	c->next = NULL;
+
+	return c;
+}
+
+static void
+unmap_chunk(struct arena_chunk *c)
+{
+	pthread_mutex_lock(&reserved_lock);
+	total_reserved -= c->size;
+	pthread_mutex_unlock(&reserved_lock);
+	munmap((void *)c, c->size);
+}
+
+/* Give back all pages but the one holding the chunk header. */
+static void
+release_pages(struct arena_chunk *c)
+{
+#ifdef MADV_DONTNEED
+	int pagesize = getpagesize();
+	char *first_page = ((char *)c) + pagesize;
+
+	if (first_page < c->limit)
+		madvise(first_page, c->limit - first_page, MADV_DONTNEED);
+#endif
+	c->dirty = 0;
+}
+
 void
 deallocate_arena(struct memory_arena *ma)
 {
-	while (ma)
+	struct arena_chunk *c, *tmp;
+
+	for (c = ma->chunks; c; c = tmp)
+	{
+		tmp = c->next;
+		unmap_chunk(c);
+	}
+	for (c = ma->large; c; c = tmp)
 	{
-		struct memory_arena *tmp = ma->next;
-		ma->next = NULL;
-		free(ma);
-		ma = tmp;
+		tmp = c->next;
+		unmap_chunk(c);
 	}
+
+	free(ma);
 }
 
 void
 free_arena_contents(struct memory_arena *ma)
 {
-	ma = ma->next; /* dummy head node */
-	while (ma)
+	struct arena_chunk *c, *tmp, **pp;
+	int n = 0;
+
+	for (c = ma->large; c; c = tmp)
+	{
+		tmp = c->next;
+		unmap_chunk(c);
+	}
+	ma->large = NULL;
+
+	ma->tail = NULL;
+	for (pp = &ma->chunks; (c = *pp); )
 	{
-		ma->remaining = ma->sz;
-		ma->next_allocation = ma->first_allocation;
-		ma = ma->next;
+		if (c->next_allocation > c->first_allocation)
+		{
+			c->idle = 0;
+			c->dirty = 1;
+		} else
+			++c->idle;
+
+		c->next_allocation = c->first_allocation;
+
+		if (n >= ARENA_KEEP_CHUNKS)
+		{
+			if (c->idle >= ARENA_TRIM_IDLE)
+			{
+				*pp = c->next;
+				unmap_chunk(c);
+				continue;
+			}
+			if (c->dirty)
+				release_pages(c);
+		}
+
+		ma->tail = c;
+		pp = &c->next;
+		++n;
 	}
+
+	ma->current = ma->chunks;
 }
 
 void *
 arena_alloc(struct memory_arena *ma, size_t size)
 {
 	void *r = NULL;
-	struct memory_arena *tmp;
+	struct arena_chunk *c;
 	size_t nsize;
 
 	/* What you actually have to allocate to get to
 	 * a block "suitably aligned" for any use. */
-	nsize = roundup(size, combosize);
+	nsize = roundup(size, COMBO_SIZE);
 
-	tmp = ma->next;
+	if (nsize > ARENA_SMALL_LIMIT)
+	{
+		c = map_chunk(nsize + HEADER_SIZE);
+		c->next = ma->large;
+		ma->large = c;
+		c->next_allocation += nsize;
+		return c->first_allocation;
+	}
 
-	while (tmp && nsize > tmp->remaining)
-		tmp = tmp->next;
+	c = ma->current;
 
-	if (NULL == tmp)
+	if (NULL == c || nsize > (size_t)(c->limit - c->next_allocation))
 	{
+		/* Chunks past the current one are empty. */
+		c = c? c->next: ma->chunks;
+
+		if (NULL == c)
+		{
+			c = map_chunk(ARENA_CHUNK_SIZE);
+			if (ma->tail)
+				ma->tail->next = c;
+			else
+				ma->chunks = c;
+			ma->tail = c;
+		}
+
+		ma->current = c;
+	}
 
-		/* You could do something like moving all arenas with
-		 * less than combosize remaining into a 2nd list - one
-		 * that never gets checked, as combosize is the minimum
-		 * allocation possible. */
-
-		/* create a new struct memory_arena of at least 1 page */
-		size_t arena_size = roundup((nsize + headersize), pagesize);
+	r = c->next_allocation;
+	c->next_allocation += nsize; /* next_allocation stays aligned */
 
-		pagesize *= 2;  /* make next allocation twice as large */
+	return r;
+}
 
-		tmp = malloc(arena_size);
+/* Bytes mapped for, bytes not given back with madvise() by, and
+ * bytes handed out by, arena ma.  A chunk released since it was
+ * last used only holds on to its header's page.  *peak_reserved
+ * covers all arenas at once: the garbage collector has two arenas
+ * during a collection, and other interpreter contexts have arenas
+ * of their own. */
+void
+arena_statistics(struct memory_arena *ma, size_t *reserved, size_t *resident, size_t *used, size_t *peak)
+{
+	struct arena_chunk *c;
+	int pass;
 
-		tmp->first_allocation = ((char *)tmp) + headersize;
-		tmp->next_allocation = tmp->first_allocation;
-		tmp->sz = arena_size - headersize;
-		tmp->remaining = tmp->sz;
+	*reserved = *resident = *used = 0;
 
-		tmp->next = ma->next;
-		ma->next = tmp;
+	for (pass = 0; pass < 2; ++pass)
+	{
+		for (c = pass? ma->large: ma->chunks; c; c = c->next)
+		{
+			*reserved += c->size;
+			*resident += (c->dirty || c->next_allocation > c->first_allocation)?
+				c->size: (size_t)getpagesize();
+			*used += c->next_allocation - c->first_allocation;
+		}
 	}
 
-	r = tmp->next_allocation;
-	tmp->next_allocation += nsize; /* next_allocation stays aligned */
-	tmp->remaining -= nsize;
-
-	return r;
+	pthread_mutex_lock(&reserved_lock);
+	*peak = peak_reserved;
+	pthread_mutex_unlock(&reserved_lock);
 }
-
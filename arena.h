@@ -26,3 +26,5 @@ void deallocate_arena(struct memory_arena *ma);
 
 void *arena_alloc(struct memory_arena *ma, size_t size);
 
+void arena_statistics(struct memory_arena *ma, size_t *reserved, size_t *resident, size_t *used, size_t *peak_reserved);
+
@@ -31,21 +31,49 @@
  */
 
 #include <string.h>
+#include <setjmp.h>
 
 #include <hashtable.h>
 #include <atom.h>
+#include <context.h>
 
+/* Each interpreter context interns strings in a table of its own. */
 
-static struct hashtable *atom_table = NULL;
+const char *
+Atom_string(const char *str)
+{
+	return add_string(current_context->strings, str);
+}
 
-void
-setup_atom_table(struct hashtable *h)
+/* Returns 0 for strings that never got interned. */
+int
+Atom_id(const char *str)
 {
-	atom_table = h;
+	unsigned int hv;
+	struct hashnode *n = node_lookup(current_context->strings, str, &hv);
+	return n? n->id: 0;
 }
 
+/* The string with atom ID id, NULL past the last ID. */
 const char *
-Atom_string(const char *str)
+Atom_name(int id)
+{
+	struct hashnode *n = id_lookup(current_context->strings, id);
+	return n? n->string: NULL;
+}
+
+/* The primitive (rule:) bound to an atom ID, if any. */
+struct reduction_rule *
+Atom_rule(int id)
+{
+	struct hashnode *n = id_lookup(current_context->strings, id);
+	return n? n->rule: NULL;
+}
+
+void
+Atom_bind_rule(int id, struct reduction_rule *rule)
 {
-	return add_string(atom_table, str);
+	struct hashnode *n = id_lookup(current_context->strings, id);
+	if (n)
+		n->rule = rule;
 }
@@ -20,5 +20,8 @@
 */
 /* $Id: atom.h,v 1.3 2011/06/12 18:19:11 bediger Exp $ */
 
-void        setup_atom_table(struct hashtable *h);
 const char *Atom_string(const char *str);
+int         Atom_id(const char *str);
+const char *Atom_name(int id);
+struct reduction_rule *Atom_rule(int id);
+void        Atom_bind_rule(int id, struct reduction_rule *rule);
@@ -31,6 +31,7 @@
 #include <stdio.h>    /* NULL manifest constant */
 #include <stdlib.h>   /* malloc(), free(), realloc() */
 #include <string.h>   /* memcpy() */
+#include <setjmp.h>
 
 #include <node.h>
 #include <hashtable.h>
@@ -39,6 +40,8 @@
 #include <aho_corasick.h>
 #include <buffer.h>
 #include <graph.h>
+#include <image.h>
+#include <context.h>
 
 /*
  * Functions and variables to calculate all the root-to-leaves
@@ -47,18 +50,6 @@
 int set_pattern_paths(struct abs_node *pattern);
 const char **get_pat_paths(void);
 void calculate_strings(struct abs_node *node, struct buffer *buf);
-/* **paths holds an array of const char * (atom) strings, one
- * string for each path through a pattern from root-to-leaf. */
-static const char **paths = NULL;
-/* **paths has a size (value of path_cnt) and a numer of entries
- * currently filled in (value of paths_used).  Dynamically resizes
- * paths when the number of paths-through-patterns gets too big.
- * **paths and path_cnt reused every time set_abstraction_rule()
- * gets called. */
-static int path_cnt = 0;
-static int paths_used = 0;
-
-extern int trace_reduction;
 
 /* Internal representation of a bracket abstraction
  * rule, and the dynamically-resized array (**rules)
@@ -71,10 +62,24 @@ struct abstraction_rule {
 	int replaceable_leaves_cnt;
 };
 
-static struct abstraction_rule **rules;
-static int rule_cnt = 0;
-
-static const char *dummy_abstr_var = NULL;
+/* One interpreter context's abstraction rules, see context.h */
+struct abstraction_state {
+	/* **paths holds an array of const char * (atom) strings, one
+	 * string for each path through a pattern from root-to-leaf. */
+	const char **paths;
+	/* **paths has a size (value of path_cnt) and a numer of entries
+	 * currently filled in (value of paths_used).  Dynamically resizes
+	 * paths when the number of paths-through-patterns gets too big.
+	 * **paths and path_cnt reused every time set_abstraction_rule()
+	 * gets called. */
+	int path_cnt;
+	int paths_used;
+
+	struct abstraction_rule **rules;
+	int rule_cnt;
+
+	const char *dummy_abstr_var;
+};
 
 /* Support functions called by perform_bracket_abstraction() */
 int count_effective_leaves(struct abs_node *tree);
@@ -87,9 +92,18 @@ struct node *perform_replacement(
 );
 void massage_replacements(struct abs_node *replacement);
 
+static void save_abs_node(FILE *out, struct abs_node *tree);
+static struct abs_node *load_abs_node(struct image *im);
+
 /* Working function to print a single rule. */
 void print_rule(struct abstraction_rule *abs_rule, struct node *tree);
 
+struct abstraction_state *
+new_abstraction_state(void)
+{
+	return calloc(1, sizeof(struct abstraction_state));
+}
+
 /* Centralize output of pattern/replacement/subject.
  * Used in both the "abstractions" interpreter command's output,
  * and when "trace on" issued, and a bracket abstraction gets
@@ -117,21 +131,22 @@ print_rule(struct abstraction_rule *abs_rule, struct node *tree)
 struct node *
 perform_bracket_abstraction(const char *var, struct node *expr)
 {
+	struct abstraction_state *abs = current_context->abstractions;
 	struct node *r = NULL;
 	int idx, subject_node_count = 0;
 
 	subject_node_count = node_count(expr, 1);
 
-	for (idx = 0; idx < rule_cnt; ++idx)
+	for (idx = 0; idx < abs->rule_cnt; ++idx)
 	{
 		int repl_cnt = 0;
-		int matched = algorithm_d(rules[idx]->g, expr,
-			subject_node_count, rules[idx]->pat_path_cnt, var);
+		int matched = algorithm_d(abs->rules[idx]->g, expr,
+			subject_node_count, abs->rules[idx]->pat_path_cnt, var);
 
 		if (matched)
 		{
 			struct node **repl_ary = malloc(
-				rules[idx]->replaceable_leaves_cnt
+				abs->rules[idx]->replaceable_leaves_cnt
 				* (sizeof (struct node *))
 			);
 #ifdef DESPARATE
@@ -139,18 +154,18 @@ perform_bracket_abstraction(const char *var, struct node *expr)
 			 * and could mitigate leaking the memory on keyboard interrupt.
 			 */
 			struct node **repl_ary = alloca(
-				rules[idx]->replaceable_leaves_cnt
+				abs->rules[idx]->replaceable_leaves_cnt
 				* (sizeof (struct node *))
 			);
 			/* But so would this: struct node *repl_ary[20]; */
 #endif
 
-			if (trace_reduction) print_rule(rules[idx], expr);
+			if (current_context->trace_reduction) print_rule(abs->rules[idx], expr);
 
-			fill_in_replacements(rules[idx]->pattern, expr,
+			fill_in_replacements(abs->rules[idx]->pattern, expr,
 				repl_ary, &repl_cnt);
 
-			r = perform_replacement(rules[idx], var, repl_ary, rules[idx]->replacement);
+			r = perform_replacement(abs->rules[idx], var, repl_ary, abs->rules[idx]->replacement);
 
 #ifndef DESPARATE
 			free(repl_ary);
@@ -167,13 +182,14 @@ perform_bracket_abstraction(const char *var, struct node *expr)
 void
 delete_abstraction_rules(void)
 {
+	struct abstraction_state *abs = current_context->abstractions;
 	int idx;
 
-	for (idx = 0; idx < rule_cnt; ++idx)
+	for (idx = 0; idx < abs->rule_cnt; ++idx)
 	{
-		struct abstraction_rule *p = rules[idx];
+		struct abstraction_rule *p = abs->rules[idx];
 
-		rules[idx] = NULL;
+		abs->rules[idx] = NULL;
 
 		destroy_goto(p->g);
 		p->g = NULL;
@@ -188,70 +204,195 @@ delete_abstraction_rules(void)
 		p = NULL;
 	}
 
-	free(rules);
-	rules = NULL;
+	free(abs->rules);
+	abs->rules = NULL;
 
-	if (paths)
-		free(paths);
-	paths = NULL;
+	if (abs->paths)
+		free(abs->paths);
+	abs->paths = NULL;
 }
 
 void
 set_abstraction_rule(struct abs_node *pattern, struct abs_node *replacement)
 {
+	struct abstraction_state *abs = current_context->abstractions;
 	int n;
 	const char **path_ary;
 
-	if (!dummy_abstr_var)
-		dummy_abstr_var = Atom_string("_");
+	if (!abs->dummy_abstr_var)
+		abs->dummy_abstr_var = Atom_string("_");
 
 	n = set_pattern_paths(pattern);
 
 	path_ary = get_pat_paths();
 
-	rules = realloc(rules, sizeof(struct abstraction_rule) * (rule_cnt + 1));
+	abs->rules = realloc(abs->rules, sizeof(struct abstraction_rule) * (abs->rule_cnt + 1));
 
-	rules[rule_cnt] = malloc(sizeof(struct abstraction_rule));
+	abs->rules[abs->rule_cnt] = malloc(sizeof(struct abstraction_rule));
 
-	rules[rule_cnt]->g = init_goto();
+	abs->rules[abs->rule_cnt]->g = init_goto();
 
-	construct_goto(path_ary, n, rules[rule_cnt]->g);
+	construct_goto(path_ary, n, abs->rules[abs->rule_cnt]->g);
 	/* Does nothing with path_ary: the array itself sticks around
 	 * for the next call to set_abstraction_rule(), while the
 	 * array elements (strings) have type Atom, and get
 	 * deallocated when the Atom hashtable gets deallocated. */
 
-	construct_failure(rules[rule_cnt]->g);
-	construct_delta(rules[rule_cnt]->g);
-	rules[rule_cnt]->pat_path_cnt = n;
+	construct_failure(abs->rules[abs->rule_cnt]->g);
+	construct_delta(abs->rules[abs->rule_cnt]->g);
+	abs->rules[abs->rule_cnt]->pat_path_cnt = n;
+
+	abs->rules[abs->rule_cnt]->pattern = pattern;
+	abs->rules[abs->rule_cnt]->replacement = replacement;
+	massage_replacements(abs->rules[abs->rule_cnt]->replacement);
+
+	abs->rules[abs->rule_cnt]->replaceable_leaves_cnt
+		= count_effective_leaves(abs->rules[abs->rule_cnt]->pattern);
+
+	++abs->rule_cnt;
+}
+
+/* Interpreter images: for each rule, its path count, pattern,
+ * replacement and Aho-Corasick tables.  Loading one doesn't
+ * have to work out paths, or construct any tables. */
+void
+save_abstraction_rules(FILE *out)
+{
+	struct abstraction_state *abs = current_context->abstractions;
+	int i;
+
+	image_put(out, abs->rule_cnt);
+	for (i = 0; i < abs->rule_cnt; ++i)
+	{
+		image_put(out, abs->rules[i]->pat_path_cnt);
+		save_abs_node(out, abs->rules[i]->pattern);
+		save_abs_node(out, abs->rules[i]->replacement);
+		save_goto(out, abs->rules[i]->g);
+	}
+}
+
+void
+load_abstraction_rules(struct image *im)
+{
+	struct abstraction_state *abs = current_context->abstractions;
+	int i, count = image_get(im, 0, im->end - im->p);
+
+	if (!abs->dummy_abstr_var)
+		abs->dummy_abstr_var = Atom_string("_");
+
+	for (i = 0; i < count && !im->bad; ++i)
+	{
+		struct abstraction_rule *rule = malloc(sizeof(*rule));
+
+		rule->pat_path_cnt = image_get(im, 1, 0x100000);
+		rule->pattern = load_abs_node(im);
+		rule->replacement = load_abs_node(im);
+		rule->g = load_goto(im);
+
+		if (im->bad || im->check_only)
+		{
+			free_abs_node(rule->pattern);
+			free_abs_node(rule->replacement);
+			if (rule->g)
+				destroy_goto(rule->g);
+			free(rule);
+			continue;
+		}
+
+		massage_replacements(rule->replacement);
+		rule->replaceable_leaves_cnt = count_effective_leaves(rule->pattern);
+
+		abs->rules = realloc(abs->rules, sizeof(struct abstraction_rule) * (abs->rule_cnt + 1));
+		abs->rules[abs->rule_cnt++] = rule;
+	}
+}
+
+/* Pre-order: application or leaf, whether it gets abstracted,
+ * a leaf's label. */
+static void
+save_abs_node(FILE *out, struct abs_node *tree)
+{
+	image_put(out, tree->typ);
+	image_put(out, tree->abstracted);
+	if (abs_LEAF == tree->typ)
+		image_put_atom(out, tree->label);
+	else {
+		save_abs_node(out, tree->left);
+		save_abs_node(out, tree->right);
+	}
+}
+
+/* Leaves get the primitive their label names now, which
+ * could have gotten defined after the rule got parsed. */
+static struct abs_node *
+load_abs_node(struct image *im)
+{
+	struct abs_node *r = NULL;
+	int typ = image_get(im, abs_APPLICATION, abs_LEAF);
+	int abstracted = image_get(im, 0, 1);
+
+	if (im->bad)
+		return NULL;
+
+	if (abs_LEAF == typ)
+	{
+		const char *label = image_get_atom(im);
+		if (label)
+		{
+			r = new_abs_node(label);
+			r->rule = Atom_rule(Atom_id(label));
+		} else
+			im->bad = 1;
+	} else {
+		struct abs_node *left = load_abs_node(im);
+		struct abs_node *right = load_abs_node(im);
 
-	rules[rule_cnt]->pattern = pattern;
-	rules[rule_cnt]->replacement = replacement;
-	massage_replacements(rules[rule_cnt]->replacement);
+		if (left && right)
+			r = new_abs_application(left, right);
+		else {
+			free_abs_node(left);
+			free_abs_node(right);
+		}
+	}
 
-	rules[rule_cnt]->replaceable_leaves_cnt
-		= count_effective_leaves(rules[rule_cnt]->pattern);
+	if (r)
+		r->abstracted = abstracted;
 
-	++rule_cnt;
+	return r;
 }
 
 /* Called from the interpreter command "abstractions". */
 void
 print_abstractions(void)
 {
+	struct abstraction_state *abs = current_context->abstractions;
 	int i;
 
-	printf("# %d abstraction rules\n", rule_cnt);
+	printf("# %d abstraction rules\n", abs->rule_cnt);
 
-	for (i = 0; i < rule_cnt; ++i)
+	for (i = 0; i < abs->rule_cnt; ++i)
 	{
 		printf("abstraction: ");
-		print_rule(rules[i], NULL);
+		print_rule(abs->rules[i], NULL);
 		printf("# Path count: %d, Max depth: %d\n",
-			rules[i]->pat_path_cnt, rules[i]->g->max_node_count);
+			abs->rules[i]->pat_path_cnt, abs->rules[i]->g->max_node_count);
 	}
 }
 
+/* Called from "memstats": size of each rule's Aho-Corasick tables. */
+void
+print_abstraction_statistics(void)
+{
+	struct abstraction_state *abs = current_context->abstractions;
+	int i;
+
+	for (i = 0; i < abs->rule_cnt; ++i)
+		printf("abstraction rule %d: %d paths, %d states, %d output states, %lu bytes\n",
+			i + 1, abs->rules[i]->pat_path_cnt, abs->rules[i]->g->ary_len,
+			abs->rules[i]->g->output_len,
+			(unsigned long)goto_table_size(abs->rules[i]->g));
+}
+
 /*
  * A tree of structs abs_node has leaf nodes (typ == abs_LEAF)
  * which actually can represnt a subtree of the subject trees,
@@ -305,6 +446,7 @@ perform_replacement(
 	struct abs_node *template
 )
 {
+	struct abstraction_state *abs = current_context->abstractions;
 	struct node *r = NULL;
 
 	switch (template->typ)
@@ -312,10 +454,10 @@ perform_replacement(
 	case abs_LEAF:
 		if (template->number < 0)
 		{
-			r = (template->label == dummy_abstr_var)
-				? new_term(var)
-				: new_term(template->label);
-			r->rule = template->rule;
+			if (template->label == abs->dummy_abstr_var)
+				r = new_term(var, Atom_rule(Atom_id(var)));
+			else
+				r = new_term(template->label, template->rule);
 		} else
 			r = template->abstracted
 				? replacements[template->number]
@@ -382,21 +524,24 @@ massage_replacements(struct abs_node *replacement)
 const char **
 get_pat_paths(void)
 {
+	struct abstraction_state *abs = current_context->abstractions;
+
 	/* XXX - just reuses the paths array, not strings it contains.
 	 * The strings that **paths contains are "atoms", not-to-be-overwritten
 	 * ASCII-Nul-terminated strings held in a struct hashtable for use
 	 * and re-use.  Don't need to deallocate them here. */
-	paths_used = 0;
-	return paths;
+	abs->paths_used = 0;
+	return abs->paths;
 }
 
 int
 set_pattern_paths(struct abs_node *pattern)
 {
+	struct abstraction_state *abs = current_context->abstractions;
 	struct buffer *buf = new_buffer(512);
 	calculate_strings(pattern, buf);
 	delete_buffer(buf);
-	return paths_used;
+	return abs->paths_used;
 }
 
 /*
@@ -417,6 +562,7 @@ set_pattern_paths(struct abs_node *pattern)
 void
 calculate_strings(struct abs_node *node, struct buffer *b)
 {
+	struct abstraction_state *abs = current_context->abstractions;
 	int curr_offset, orig_offset = b->offset;
 	char *buf;
 	char *pattern_string;
@@ -445,7 +591,7 @@ calculate_strings(struct abs_node *node, struct buffer *b)
 	case abs_LEAF:
 		buf = b->buffer;
 		buf[b->offset] = '\0';
-		pattern_string = malloc(b->offset + 1 + 1);
+		pattern_string = malloc(b->offset + strlen(node->label) + 1);
 
 		if ('*' != node->label[0])
 			sprintf(pattern_string, "%s%s", buf, node->label);
@@ -469,22 +615,22 @@ calculate_strings(struct abs_node *node, struct buffer *b)
 			}
 		}
 
-		if (paths_used >= path_cnt)
+		if (abs->paths_used >= abs->path_cnt)
 		{
 			const char **tmp;
-			int alloc_bytes = (sizeof(char *))*(path_cnt + 4);
+			int alloc_bytes = (sizeof(char *))*(abs->path_cnt + 4);
 
-			if (paths)
-				tmp = realloc(paths, alloc_bytes);
+			if (abs->paths)
+				tmp = realloc(abs->paths, alloc_bytes);
 			else
 				tmp = malloc(alloc_bytes);
 
-			paths = tmp;
-			path_cnt += 4;
+			abs->paths = tmp;
+			abs->path_cnt += 4;
 		}
 
 		/* XXX - If a realloc() fails, this could overwrite paths[] */
-		paths[paths_used++] = Atom_string(pattern_string);
+		abs->paths[abs->paths_used++] = Atom_string(pattern_string);
 		free(pattern_string);
 
 		break;
@@ -23,4 +23,10 @@
 struct node *perform_bracket_abstraction(const char *var, struct node *expr);
 void set_abstraction_rule(struct abs_node *pattern, struct abs_node *replacement);
 void print_abstractions(void);
+void print_abstraction_statistics(void);
 void delete_abstraction_rules(void);
+struct abstraction_state;
+struct abstraction_state *new_abstraction_state(void);
+struct image;
+void save_abstraction_rules(FILE *out);
+void load_abstraction_rules(struct image *im);
@@ -0,0 +1,609 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Checkpoints of reductions that stopped short of normal form, for
+ * "checkpoint" and "restore", and every "checkpoint N" contractions.
+ *
+ * The file holds the graph under the dummy root, one record per
+ * distinct node, so shared subgraphs come back shared, with the same
+ * reference counts.  Nodes get numbered from 1 in post-order, children
+ * before parents, and an application refers to its children by how
+ * far back they got numbered.  Every number in the file is an unsigned
+ * varint: 7 bits per byte, low bits first, high bit set on every byte
+ * but the last.
+ *
+ *   "ACLCKPT", version byte
+ *   fingerprint of the rules, see rules_fingerprint()
+ *   contractions performed so far
+ *   number of atom names, then each: length, characters
+ *   number of nodes, then each:
+ *     atom         2*(name index) + 1
+ *     application  2*(distance to left child), distance to right child,
+ *                  where 0 means a NULL child
+ *   node number of the dummy root
+ *   number of spine stack elements (0: start over at the root),
+ *     then each: 2*(node number) + 1 if going right, depth
+ *   direction
+ *
+ * Automatic checkpoints get written by a fork()ed copy of the
+ * interpreter, so the reduction only stops for the fork().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <node.h>
+#include <hashtable.h>
+#include <atom.h>
+#include <spine_stack.h>
+#include <reduction_rule.h>
+#include <checkpoint.h>
+#include <context.h>
+
+static const char magic[] = "ACLCKPT";
+#define CHECKPOINT_VERSION 1
+
+/* One interpreter context's checkpoint writer, see context.h */
+struct checkpoint_state {
+	/* Writer of the latest automatic checkpoint, if it might still run. */
+	pid_t writer_pid;
+};
+
+/* Numbers pointers 1, 2, 3, ... in the order they first get added. */
+struct numbering {
+	const void **items;     /* items[i - 1] has number i */
+	int count;
+	int max;
+	const void **keys;      /* open addressing hash table */
+	int *numbers;
+	unsigned int size;
+};
+
+static struct numbering *new_numbering(void);
+static void free_numbering(struct numbering *m);
+static int number_of(struct numbering *m, const void *p);
+static int add_number(struct numbering *m, const void *p);
+static void number_graph(struct node *root, struct numbering *nodes, struct numbering *names);
+
+static void put_varint(FILE *out, unsigned long v);
+static int get_varint(FILE *in, unsigned long *v);
+
+struct checkpoint_state *
+new_checkpoint_state(void)
+{
+	return calloc(1, sizeof(struct checkpoint_state));
+}
+
+int
+write_checkpoint(
+	const char *filename,
+	struct node *root,
+	struct spine_stack *stack,
+	int dir,
+	unsigned long contractions
+)
+{
+	struct numbering *nodes = new_numbering();
+	struct numbering *names = new_numbering();
+	char *tmpname = malloc(strlen(filename) + 5);
+	FILE *out;
+	int i, r;
+
+	/* Write a new copy, then rename it, so that a crash or
+	 * full disk doesn't wreck the last good checkpoint. */
+	sprintf(tmpname, "%s.tmp", filename);
+
+	if (!(out = fopen(tmpname, "wb")))
+	{
+		fprintf(stderr, "Could not open \"%s\" for write: %s\n",
+			tmpname, strerror(errno));
+		free(tmpname);
+		return 0;
+	}
+
+	number_graph(root, nodes, names);
+
+	fwrite(magic, 1, sizeof(magic) - 1, out);
+	putc(CHECKPOINT_VERSION, out);
+	put_varint(out, rules_fingerprint());
+	put_varint(out, contractions);
+
+	put_varint(out, names->count);
+	for (i = 0; i < names->count; ++i)
+	{
+		const char *name = names->items[i];
+		put_varint(out, strlen(name));
+		fputs(name, out);
+	}
+
+	put_varint(out, nodes->count);
+	for (i = 1; i <= nodes->count; ++i)
+	{
+		const struct node *n = nodes->items[i - 1];
+
+		if (ATOM == n->typ)
+			put_varint(out, 2*(number_of(names, n->name) - 1) + 1);
+		else {
+			put_varint(out, n->left? 2*(i - number_of(nodes, n->left)): 0);
+			put_varint(out, n->right? i - number_of(nodes, n->right): 0);
+		}
+	}
+
+	put_varint(out, number_of(nodes, root));
+
+	put_varint(out, stack? stack->top: 0);
+	for (i = 0; stack && i < stack->top; ++i)
+	{
+		struct node *n = stack->stack[i].node;
+		int going_right = APPLICATION == n->typ
+			&& n->updateable == n->right_addr;
+
+		put_varint(out, 2*number_of(nodes, n) + going_right);
+		put_varint(out, stack->stack[i].depth);
+	}
+
+	put_varint(out, dir);
+
+	r = !ferror(out);
+	if (fclose(out))
+		r = 0;
+
+	if (!r)
+		fprintf(stderr, "Could not write \"%s\": %s\n",
+			tmpname, strerror(errno));
+	else if (rename(tmpname, filename))
+	{
+		fprintf(stderr, "Could not rename \"%s\" to \"%s\": %s\n",
+			tmpname, filename, strerror(errno));
+		r = 0;
+	}
+
+	free(tmpname);
+	free_numbering(nodes);
+	free_numbering(names);
+
+	return r;
+}
+
+/* Reads all of the file, and checks it over, before making any
+ * nodes, so that a bad file doesn't leave half a graph around.
+ * The graph comes back with the dummy root's reference count
+ * not yet incremented. */
+struct node *
+read_checkpoint(
+	const char *filename,
+	struct spine_stack **stackp,
+	int *dirp,
+	unsigned long *contractions
+)
+{
+	FILE *in;
+	char header[sizeof(magic)];
+	unsigned long fingerprint, name_count = 0, node_count = 0;
+	unsigned long root_number = 0, stack_count = 0, dir = 0, v, w;
+	const char **names = NULL;
+	long *left = NULL, *right = NULL;   /* name index - 1 in left for atoms */
+	long *stack_nodes = NULL;
+	int *depths = NULL;
+	struct node **built = NULL;
+	struct node *root = NULL;
+	const char *problem = "file truncated";
+	unsigned long i;
+
+	if (!(in = fopen(filename, "rb")))
+	{
+		fprintf(stderr, "Could not open \"%s\" for read: %s\n",
+			filename, strerror(errno));
+		return NULL;
+	}
+
+	if (fread(header, 1, sizeof(header), in) != sizeof(header)
+		|| memcmp(header, magic, sizeof(magic) - 1)
+		|| CHECKPOINT_VERSION != header[sizeof(magic) - 1])
+	{
+		problem = "not a checkpoint";
+		goto bad_file;
+	}
+
+	if (!get_varint(in, &fingerprint) || !get_varint(in, contractions))
+		goto bad_file;
+	if (fingerprint != rules_fingerprint())
+	{
+		problem = "written with different rules";
+		goto bad_file;
+	}
+
+	if (!get_varint(in, &name_count))
+		goto bad_file;
+	if (name_count > 0x1000000)
+	{
+		problem = "too many atom names";
+		goto bad_file;
+	}
+	names = calloc(name_count + 1, sizeof(*names));
+	for (i = 0; i < name_count; ++i)
+	{
+		char *buf;
+
+		if (!get_varint(in, &v) || v > 0x10000)
+			goto bad_file;
+		buf = malloc(v + 1);
+		if (fread(buf, 1, v, in) != v)
+		{
+			free(buf);
+			goto bad_file;
+		}
+		buf[v] = '\0';
+		names[i] = Atom_string(buf);
+		free(buf);
+	}
+
+	if (!get_varint(in, &node_count))
+		goto bad_file;
+	if (node_count > 0x40000000)
+	{
+		problem = "too many nodes";
+		goto bad_file;
+	}
+	left = malloc((node_count + 1)*sizeof(*left));
+	right = malloc((node_count + 1)*sizeof(*right));
+	for (i = 1; i <= node_count; ++i)
+	{
+		if (!get_varint(in, &v))
+			goto bad_file;
+		if (v & 1)
+		{
+			if ((v >> 1) >= name_count)
+			{
+				problem = "bad atom name";
+				goto bad_file;
+			}
+			left[i] = -(long)(v >> 1) - 1;
+			right[i] = 0;
+		} else {
+			if (!get_varint(in, &w))
+				goto bad_file;
+			v >>= 1;
+			if (v >= i || w >= i)
+			{
+				problem = "bad child node";
+				goto bad_file;
+			}
+			left[i] = v? i - v: 0;
+			right[i] = w? i - w: 0;
+		}
+	}
+
+	if (!get_varint(in, &root_number))
+		goto bad_file;
+	if (root_number < 1 || root_number > node_count || left[root_number] < 0)
+	{
+		problem = "bad root node";
+		goto bad_file;
+	}
+
+	if (!get_varint(in, &stack_count))
+		goto bad_file;
+	if (stack_count > node_count)
+	{
+		problem = "bad spine stack";
+		goto bad_file;
+	}
+	stack_nodes = malloc((stack_count + 1)*sizeof(*stack_nodes));
+	depths = malloc((stack_count + 1)*sizeof(*depths));
+	for (i = 0; i < stack_count; ++i)
+	{
+		if (!get_varint(in, &v) || !get_varint(in, &w))
+			goto bad_file;
+		stack_nodes[i] = v;
+		depths[i] = w;
+		v >>= 1;
+		/* Each element has to be the child of the one below
+		 * it that the element below says it went into. */
+		if (v < 1 || v > node_count || w > 0x7fffffff
+			|| (0 == i && v != root_number)
+			|| (i > 0 && (long)v != ((stack_nodes[i - 1] & 1)?
+				right[stack_nodes[i - 1] >> 1]: left[stack_nodes[i - 1] >> 1]))
+			|| ((stack_nodes[i] & 1) && left[v] < 0))
+		{
+			problem = "bad spine stack";
+			goto bad_file;
+		}
+	}
+	if (!get_varint(in, &dir) || dir > 2)
+		goto bad_file;
+
+	fclose(in);
+	in = NULL;
+
+	built = malloc((node_count + 1)*sizeof(*built));
+	built[0] = NULL;
+	for (i = 1; i <= node_count; ++i)
+	{
+		if (left[i] < 0)
+		{
+			const char *name = names[-left[i] - 1];
+			built[i] = new_term(name, get_reduction_rule(name));
+		} else
+			built[i] = new_application(built[left[i]], built[right[i]]);
+	}
+	root = built[root_number];
+
+	*stackp = NULL;
+	if (stack_count)
+	{
+		struct spine_stack *stack = private_spine_stack(stack_count + 64);
+
+		for (i = 0; i < stack_count; ++i)
+		{
+			struct node *n = built[stack_nodes[i] >> 1];
+
+			if (APPLICATION == n->typ)
+				n->updateable = (stack_nodes[i] & 1)? n->right_addr: n->left_addr;
+			stack->stack[i].node = n;
+			stack->stack[i].depth = depths[i];
+		}
+		stack->top = stack->maxdepth = stack_count;
+		*stackp = stack;
+	}
+	*dirp = dir;
+
+	bad_file:
+	if (in)
+	{
+		fprintf(stderr, "Could not restore from \"%s\": %s\n",
+			filename, problem);
+		fclose(in);
+	}
+	free(names);
+	free(left);
+	free(right);
+	free(stack_nodes);
+	free(depths);
+	free(built);
+
+	return root;
+}
+
+/* Called every "checkpoint N" contractions by the reduction loop.
+ * If the last checkpoint's writer hasn't finished, this one gets
+ * skipped, rather than have writers pile up. */
+void
+auto_checkpoint(
+	struct node *root,
+	struct spine_stack *stack,
+	int dir,
+	unsigned long contractions
+)
+{
+	struct checkpoint_state *cks = current_context->checkpoints;
+
+	if (cks->writer_pid > 0)
+	{
+		if (0 == waitpid(cks->writer_pid, NULL, WNOHANG))
+			return;
+		cks->writer_pid = 0;
+	}
+
+	switch (cks->writer_pid = fork())
+	{
+	case -1:
+		cks->writer_pid = 0;
+		write_checkpoint(current_context->checkpoint_file, root, stack, dir, contractions);
+		break;
+	case 0:
+		/* The reduction's copy of the graph can change underneath
+		 * the parent, not this one.  Control-C belongs to the parent. */
+		signal(SIGINT, SIG_IGN);
+		_exit(write_checkpoint(current_context->checkpoint_file, root, stack, dir,
+			contractions)? 0: 1);
+		break;
+	}
+}
+
+/* A reduction ends with its last checkpoint in the file. */
+void
+wait_for_checkpoint(void)
+{
+	struct checkpoint_state *cks = current_context->checkpoints;
+
+	if (cks->writer_pid > 0)
+		waitpid(cks->writer_pid, NULL, 0);
+	cks->writer_pid = 0;
+}
+
+/* Numbers all the nodes under root, children before parents,
+ * and the names of all the atoms.  Iterative, since graphs that
+ * take hours to reduce can have very long spines. */
+static void
+number_graph(struct node *root, struct numbering *nodes, struct numbering *names)
+{
+	struct work {
+		struct node *node;
+		int expanded;
+	} *work;
+	int top = 0, max = 256;
+
+	work = malloc(max*sizeof(*work));
+	work[top].node = root;
+	work[top++].expanded = 0;
+
+	while (top > 0)
+	{
+		struct node *n = work[top - 1].node;
+
+		if (number_of(nodes, n))
+		{
+			--top;
+			continue;
+		}
+
+		if (ATOM == n->typ)
+		{
+			if (!number_of(names, n->name))
+				add_number(names, n->name);
+			add_number(nodes, n);
+			--top;
+			continue;
+		}
+
+		if (work[top - 1].expanded)
+		{
+			add_number(nodes, n);
+			--top;
+			continue;
+		}
+
+		work[top - 1].expanded = 1;
+		if (top + 2 > max)
+		{
+			max *= 2;
+			work = realloc(work, max*sizeof(*work));
+		}
+		if (n->right && !number_of(nodes, n->right))
+		{
+			work[top].node = n->right;
+			work[top++].expanded = 0;
+		}
+		if (n->left && !number_of(nodes, n->left))
+		{
+			work[top].node = n->left;
+			work[top++].expanded = 0;
+		}
+	}
+
+	free(work);
+}
+
+static struct numbering *
+new_numbering(void)
+{
+	struct numbering *m = malloc(sizeof(*m));
+
+	m->count = 0;
+	m->max = 64;
+	m->items = malloc(m->max*sizeof(*m->items));
+	m->size = 128;
+	m->keys = calloc(m->size, sizeof(*m->keys));
+	m->numbers = malloc(m->size*sizeof(*m->numbers));
+
+	return m;
+}
+
+static void
+free_numbering(struct numbering *m)
+{
+	free(m->items);
+	free(m->keys);
+	free(m->numbers);
+	free(m);
+}
+
+#define SLOT(m, p) ((unsigned int)(((unsigned long)(p) >> 3) * 2654435761UL) & ((m)->size - 1))
+
+/* 0 if p hasn't been numbered */
+static int
+number_of(struct numbering *m, const void *p)
+{
+	unsigned int i;
+
+	for (i = SLOT(m, p); m->keys[i]; i = (i + 1) & (m->size - 1))
+		if (m->keys[i] == p)
+			return m->numbers[i];
+
+	return 0;
+}
+
+static int
+add_number(struct numbering *m, const void *p)
+{
+	unsigned int i;
+
+	if (m->count >= m->max)
+	{
+		m->max *= 2;
+		m->items = realloc(m->items, m->max*sizeof(*m->items));
+	}
+	m->items[m->count++] = p;
+
+	/* Keep the hash table under half full. */
+	if (2*m->count > m->size)
+	{
+		int j;
+
+		free(m->keys);
+		free(m->numbers);
+		m->size *= 2;
+		m->keys = calloc(m->size, sizeof(*m->keys));
+		m->numbers = malloc(m->size*sizeof(*m->numbers));
+		for (j = 0; j < m->count; ++j)
+		{
+			for (i = SLOT(m, m->items[j]); m->keys[i]; i = (i + 1) & (m->size - 1))
+				;
+			m->keys[i] = m->items[j];
+			m->numbers[i] = j + 1;
+		}
+	} else {
+		for (i = SLOT(m, p); m->keys[i]; i = (i + 1) & (m->size - 1))
+			;
+		m->keys[i] = p;
+		m->numbers[i] = m->count;
+	}
+
+	return m->count;
+}
+
+static void
+put_varint(FILE *out, unsigned long v)
+{
+	while (v >= 0x80)
+	{
+		putc((v & 0x7f) | 0x80, out);
+		v >>= 7;
+	}
+	putc(v, out);
+}
+
+static int
+get_varint(FILE *in, unsigned long *v)
+{
+	unsigned long r = 0;
+	int shift = 0, c;
+
+	do {
+		if (EOF == (c = getc(in)) || shift > 63)
+			return 0;
+		r |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	*v = r;
+
+	return 1;
+}
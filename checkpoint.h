@@ -0,0 +1,36 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Checkpoints: a reduction that stopped short of normal form,
+ * written to a file that "restore" reads back in, maybe in a later
+ * run of the interpreter, for "continue" to go on with.
+ */
+
+int  write_checkpoint(const char *filename, struct node *root,
+	struct spine_stack *stack, int dir, unsigned long contractions);
+struct node *read_checkpoint(const char *filename,
+	struct spine_stack **stack, int *dir, unsigned long *contractions);
+void auto_checkpoint(struct node *root, struct spine_stack *stack,
+	int dir, unsigned long contractions);
+void wait_for_checkpoint(void);
+struct checkpoint_state;
+struct checkpoint_state *new_checkpoint_state(void);
@@ -0,0 +1,139 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Interpreter contexts.  Everything a reduction reads or writes, other
+ * than the graph itself, hangs off a struct acl_context: the settings,
+ * the node arena and free list, the rules, abbreviations, abstraction
+ * rules, spine stacks, the "-j N" thread pool and so on.  Modules get
+ * at their own part of it through current_context, which belongs to
+ * the calling thread.  A program that wants independent interpreters
+ * makes a context for each, and has a thread call use_acl_context()
+ * before doing anything with one.  Contexts share nothing, not even
+ * atoms, so nodes, rules and strings from one mean nothing in another.
+ *
+ * The parser, grammar.y and lex.l, keeps the stopped reduction, the
+ * "-j N" batch and such in the context too, but yacc and lex parsers
+ * aren't reentrant: only one thread at a time can parse, whatever
+ * context it's parsing for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+
+#include <node.h>
+#include <hashtable.h>
+#include <buffer.h>
+#include <graph.h>
+#include <reduction_rule.h>
+#include <abbreviations.h>
+#include <brack.h>
+#include <aho_corasick.h>
+#include <spine_stack.h>
+#include <cycle_detector.h>
+#include <parallel.h>
+#include <checkpoint.h>
+#include <image.h>
+#include <heap.h>
+#include <trace.h>
+#include <parser.h>
+#include <context.h>
+
+THREAD_LOCAL struct acl_context *current_context = NULL;
+
+struct acl_context *
+new_acl_context(void)
+{
+	struct acl_context *ctx = calloc(1, sizeof(*ctx));
+
+	ctx->strings = init_hashtable(64, 10);
+	ctx->nodes = new_node_state();
+	ctx->graph = new_graph_state();
+	ctx->rules = new_rule_state();
+	ctx->abbreviations = new_abbreviation_state();
+	ctx->abstractions = new_abstraction_state();
+	ctx->matcher = new_matcher_state();
+	ctx->spines = new_spine_state();
+	ctx->cycles = new_cycle_state();
+	ctx->pool = new_pool_state();
+	ctx->checkpoints = new_checkpoint_state();
+	ctx->images = new_image_state();
+	ctx->heap = new_heap_state();
+	ctx->traces = new_trace_state();
+	ctx->interpreter = new_interpreter_state();
+
+	return ctx;
+}
+
+/* The calling thread works on ctx from now on.
+ * Returns the context it worked on before. */
+struct acl_context *
+use_acl_context(struct acl_context *ctx)
+{
+	struct acl_context *old = current_context;
+
+	current_context = ctx;
+
+	return old;
+}
+
+void
+free_acl_context(struct acl_context *ctx)
+{
+	struct acl_context *caller = use_acl_context(ctx);
+
+	forget_stopped_reduction();
+	stop_workers();
+	wait_for_checkpoint();
+
+	/* abbreviations refer to flyweight atoms */
+	cleanup_abbreviations();
+	free_hashtable(ctx->strings);
+	free_all_nodes();
+	free_all_spine_stacks();
+	free_node_heap();
+	free_rules();
+	delete_abstraction_rules();
+	cleanup_abstraction();
+	unmap_images();
+	free_detection();
+	close_trace_file();
+	free_interpreter_state();
+
+	use_acl_context(caller == ctx? NULL: caller);
+
+	free(ctx->nodes);
+	free(ctx->graph);
+	free(ctx->rules);
+	free(ctx->abbreviations);
+	free(ctx->abstractions);
+	free(ctx->matcher);
+	free(ctx->spines);
+	free(ctx->cycles);
+	free(ctx->pool);
+	free(ctx->checkpoints);
+	free(ctx->images);
+	free(ctx->heap);
+	free(ctx->traces);
+	free(ctx->interpreter);
+	free(ctx);
+}
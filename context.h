@@ -0,0 +1,112 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * An interpreter context: the settings, counters and per-module state
+ * of one interpreter.  Each module keeps its own state in a struct
+ * only that module knows the insides of.  A thread works on the
+ * context it last handed to use_acl_context(), and several threads
+ * can each work on a context of their own at the same time.
+ * Needs <setjmp.h> for sigjmp_buf.
+ */
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL  /* one context at a time per process */
+#endif
+
+struct node;
+
+struct acl_context {
+	/* Settings: "X on" and "X off" interpreter commands */
+	int debug_reduction;
+	int elaborate_output;
+	int trace_reduction;
+	int reduction_timer;
+	int single_step;
+	int cycle_detection;
+	int multiple_reduction_detection;
+	int maximal_sharing;    /* hash-cons application and atom nodes */
+	int lazy_reclamation;   /* free_node() defers work to new_node() */
+
+	/* Settings: limits and such, zero for none */
+	int reduction_timeout;  /* how long to let a graph reduction run, seconds */
+	int max_reduction_count;  /* how many reductions to perform */
+	int gc_threshold;       /* arena size (nodes) that triggers a collection */
+	int memory_limit;       /* how many live nodes a reduction can use */
+	int parallel_jobs;      /* threads reducing arguments of head normal forms */
+	int checkpoint_interval;  /* contractions between checkpoints */
+	const char *checkpoint_file;  /* where they go */
+	double reduction_deadline;  /* gettimeofday() seconds a reduction stops at */
+	int trace_every;        /* "trace every N": trace every Nth contraction */
+	int trace_size;         /* "trace size N": graphs of more live nodes */
+
+	/* Contractions performed by the latest reduce_graph() call.
+	 * Of those, shared_contraction_count contracted a redex with
+	 * more than one parent, which would otherwise have been
+	 * contracted again. */
+	unsigned long contraction_count;
+	unsigned long shared_contraction_count;
+
+	/* Goes up when a name gets a rule for the first time. */
+	int rule_generation;
+
+	/* Where signals and single-stepping get out of a reduction to */
+	sigjmp_buf in_reduce_graph;
+	int interpreter_interrupted;
+	int reduction_interrupted;  /* reference counts can't be trusted */
+
+	/* Terms a libacl.c caller hasn't released yet */
+	int held_terms;
+
+	/* With expression_hook set, top-level expressions go to it
+	 * instead of getting reduced and printed: libacl.c parses terms
+	 * this way.  Syntax errors since someone last zeroed the count. */
+	void (*expression_hook)(struct node *expr);
+	int syntax_error_count;
+
+	/* Interned atom and abbreviation strings, see atom.c */
+	struct hashtable *strings;
+
+	struct node_state *nodes;
+	struct graph_state *graph;
+	struct rule_state *rules;
+	struct abbreviation_state *abbreviations;
+	struct abstraction_state *abstractions;
+	struct matcher_state *matcher;
+	struct spine_state *spines;
+	struct cycle_state *cycles;
+	struct pool_state *pool;
+	struct checkpoint_state *checkpoints;
+	struct image_state *images;
+	struct heap_state *heap;
+	struct trace_state *traces;
+	struct interpreter_state *interpreter;
+};
+
+extern THREAD_LOCAL struct acl_context *current_context;
+
+struct acl_context *new_acl_context(void);
+struct acl_context *use_acl_context(struct acl_context *ctx);
+void free_acl_context(struct acl_context *ctx);
@@ -25,91 +25,369 @@
  * during evaluation of CL expressions like
  * C W (C W) (C W)
  *
- * It just converts a graph (struct node * binary tree)
- * to a string via canonicalize_graph(), and keeps the
- * strings around for comparison to any later graphs.
+ * Every node carries a digest, a hash of its whole subtree computed
+ * from the digests of its children, Merkle-style.  A contraction
+ * writes into one node on the spine, so only the nodes from there up
+ * to the root need new digests (update_digests()), along with the
+ * new nodes of the contraction's result, which start out with none.
+ * That holds as long as none of those spine nodes has another parent:
+ * when one does, some parent off the spine has a stale digest, and
+ * the next cycle_detector() call hashes the whole graph over again.
+ *
+ * The digests of earlier graphs go in a hash table, so comparing
+ * a new graph to all of them costs about the same as comparing it
+ * to one.  A repeat needs the same digest and the same node count.
+ * "cycles confirm" keeps each graph's canonical string
+ * (canonicalize_graph()) in the table too, and a repeat has to have
+ * a matching string as well.
+ *
+ * "cycles brent" keeps one earlier graph instead of all of them:
+ * Brent's algorithm.  The graph saved at a power of 2, 2^k, gets
+ * compared to each graph after it, up to 2^(k+1), which gets saved
+ * in its place.  The first match gives the exact cycle length, in
+ * constant memory, but possibly up to twice as many contractions
+ * later than keeping every graph would.  Only the saved graph's
+ * digest and size stay around, so the cycle's entry point can only
+ * be bracketed: it's no later than the saved graph.
  */
 
 #include <stdio.h>
 #include <setjmp.h>  /* sigjmp_buf, siglongjmp() */
 #include <stdlib.h>  /* realloc() */
 #include <string.h>  /* strcmp() */
+#include <limits.h>  /* INT_MAX */
 
 #include <node.h>
 #include <buffer.h>
 #include <graph.h>
+#include <spine_stack.h>
 #include <cycle_detector.h>
+#include <context.h>
+
+/* node->digest values: no digest yet, and marked by stale_digests() */
+#define NO_DIGEST    0UL
+#define STALE_DIGEST 1UL
 
-extern sigjmp_buf in_reduce_graph;
+/* One of the graphs seen so far: its digest, and which one it was */
+struct seen_graph {
+	unsigned long digest;
+	int size;           /* tree_size */
+	int number;         /* 1 for the first graph, 0 for an empty slot */
+	char *graph;        /* canonical string, "cycles confirm" only */
+};
 
-static char **cycle_stack = NULL;
-static int    cycle_stack_depth = 0;
-static int    cycle_stack_size = 0;
+/* One interpreter context's graphs seen so far, see context.h */
+struct cycle_state {
+	struct seen_graph *seen;  /* open addressing, power of 2 size */
+	int    seen_size;
+	int    seen_count;
+	int    rehash_all;        /* digests can't be trusted */
+
+	/* "cycles brent": the saved graph, and where the count is */
+	unsigned long saved_digest;
+	int    saved_size;
+	int    saved_number;      /* which graph it was, 0 for none yet */
+	int    power;             /* graphs to compare to it, in all */
+	int    compared;          /* graphs compared to it so far */
+	int    evaluated;
+};
 
 void canonicalize(struct node *node, struct buffer *b);
 
+static int  brent_detector(struct cycle_state *cs, struct node *root, int max_redex_count);
+static unsigned long node_digest(struct node *node);
+static int  graph_size(struct node *left, struct node *right);
+static void stale_digests(struct node *node);
+static int  find_seen(struct cycle_state *cs, unsigned long digest, int size, const char *graph);
+static void add_seen(struct cycle_state *cs, unsigned long digest, int size, char *graph);
+
+struct cycle_state *
+new_cycle_state(void)
+{
+	struct cycle_state *cs = calloc(1, sizeof(struct cycle_state));
+
+	cs->rehash_all = 1;
+
+	return cs;
+}
+
 void
 free_detection(void)
 {
+	struct cycle_state *cs = current_context->cycles;
+
 	reset_detection();
-	if (cycle_stack) free(cycle_stack);
-	cycle_stack = NULL;
+	if (cs->seen) free(cs->seen);
+	cs->seen = NULL;
+	cs->seen_size = 0;
 }
 
 void
 reset_detection(void)
 {
-	while (cycle_stack_depth)
-		free(cycle_stack[--cycle_stack_depth]);
+	struct cycle_state *cs = current_context->cycles;
+	int i;
+
+	for (i = 0; i < cs->seen_size; ++i)
+		if (cs->seen[i].graph)
+			free(cs->seen[i].graph);
+	if (cs->seen)
+		memset(cs->seen, 0, cs->seen_size*sizeof(cs->seen[0]));
+	cs->seen_count = 0;
+	cs->saved_number = 0;
+	cs->evaluated = 0;
+
+	/* The next graph might have been changed with detection off */
+	cs->rehash_all = 1;
+}
+
+/* A contraction just wrote into stack->stack[last].node: it and
+ * the spine nodes above it get new digests.  The dummy root,
+ * stack->stack[0].node, doesn't count. */
+void
+update_digests(struct spine_stack *stack, int last)
+{
+	struct cycle_state *cs = current_context->cycles;
+	int j;
+
+	for (j = last; j > 0 && !cs->rehash_all; --j)
+	{
+		struct node *n = stack->stack[j].node;
+
+		if (n->refcnt > 1)
+			cs->rehash_all = 1;  /* a parent off the spine changed too */
+		else {
+			n->digest = NO_DIGEST;
+			node_digest(n);
+		}
+	}
 }
 
 int
 cycle_detector(struct node *root, int max_redex_count)
 {
-	char *graph = NULL;
-	int i;
+	struct cycle_state *cs = current_context->cycles;
+	unsigned long digest;
+	int size, number;
 	int detected_cycle = 0;
+	char *graph = NULL;
 
-	graph = canonicalize_graph(root->left);
+	if (cs->rehash_all)
+	{
+		stale_digests(root->left);
+		cs->rehash_all = 0;
+	}
 
-	for (i = cycle_stack_depth; i > 0; --i)
+	if (BRENT_CYCLES == current_context->cycle_detection)
+		return brent_detector(cs, root, max_redex_count);
+
+	digest = node_digest(root->left);
+	size = root->left->tree_size;
+
+	if (CONFIRM_CYCLES == current_context->cycle_detection)
+		graph = canonicalize_graph(root->left);
+
+	number = find_seen(cs, digest, size, graph);
+
+	if (number)
 	{
-		if (!strcmp(graph, cycle_stack[i-1]))
-		{
-			/* Gotta say that this is a *very* low level routine in which
-			 * to perform output.  Unfortunately, unless I pass a whole
-			 * bunch of flags back up the call-chain, I can't communicate
-			 * all the information I'd like to.  So despite the ugliness,
-			 * the output stays here. */
-			printf("Found a %scycle of length %d, %d terms evaluated, ends with \"%s\"\n",
-				(max_redex_count == 1)? "pure ": "", 
-				(cycle_stack_depth - i + 1),
-				cycle_stack_depth,
-				graph
-			);
-			free(graph);
-			graph = NULL;
-			reset_detection();
-			detected_cycle = 1;
+		if (!graph)
+			graph = canonicalize_graph(root->left);
+		/* Gotta say that this is a *very* low level routine in which
+		 * to perform output.  Unfortunately, unless I pass a whole
+		 * bunch of flags back up the call-chain, I can't communicate
+		 * all the information I'd like to.  So despite the ugliness,
+		 * the output stays here. */
+		printf("Found a %scycle of length %d, %d terms evaluated, ends with \"%s\"\n",
+			(max_redex_count == 1)? "pure ": "", 
+			(cs->seen_count - number + 1),
+			cs->seen_count,
+			graph
+		);
+		free(graph);
+		graph = NULL;
+		reset_detection();
+		detected_cycle = 1;
+	} else
+		add_seen(cs, digest, size, graph);
+
+	return detected_cycle;
+}
+
+/* Brent's algorithm: a graph with the same digest and size as the
+ * saved one makes a cycle.  The saved graph is in the cycle, and
+ * unless the cycle is longer than the previous power of 2, the graph
+ * saved before it wasn't, which brackets the entry point. */
+static int
+brent_detector(struct cycle_state *cs, struct node *root, int max_redex_count)
+{
+	unsigned long digest = node_digest(root->left);
+	int size = root->left->tree_size;
+
+	++cs->evaluated;
+
+	if (cs->saved_number
+		&& digest == cs->saved_digest && size == cs->saved_size)
+	{
+		int length = cs->compared + 1;
+		char *graph = canonicalize_graph(root->left);
+
+		printf("Found a %scycle of length %d, %d terms evaluated, ends with \"%s\"\n",
+			(max_redex_count == 1)? "pure ": "",
+			length,
+			cs->evaluated - 1,
+			graph
+		);
+		if (2*length <= cs->power && cs->saved_number > 1)
+			printf("Cycle starts after term %d, by term %d\n",
+				cs->saved_number - cs->power/2, cs->saved_number);
+		else
+			printf("Cycle starts by term %d\n", cs->saved_number);
+		free(graph);
+		reset_detection();
+		return 1;
+	}
+
+	if (!cs->saved_number || ++cs->compared == cs->power)
+	{
+		cs->saved_digest = digest;
+		cs->saved_size = size;
+		cs->saved_number = cs->evaluated;
+		cs->power = cs->saved_number > 1? 2*cs->power: 1;
+		cs->compared = 0;
+	}
+
+	return 0;
+}
+
+/* The digest of node's subtree, computing any that aren't there
+ * yet.  Permanent nodes never change, so theirs stay put.  Along
+ * with the digest, node->tree_size gets the subtree's node count,
+ * up to INT_MAX. */
+static unsigned long
+node_digest(struct node *node)
+{
+	unsigned long h;
+
+	if (!node)
+		return 0x5bd1e995UL;   /* the dummy root's empty right child */
+
+	if (node->digest > STALE_DIGEST)
+		return node->digest;
+
+	if (ATOM == node->typ)
+	{
+		const unsigned char *p = (const unsigned char *)node->name;
+
+		/* FNV-1a over the name: atoms with the same name
+		 * can live in different nodes */
+		h = 2166136261UL;
+		while (*p)
+			h = (h ^ *p++)*16777619UL;
+		node->tree_size = 1;
+	} else {
+		h = node_digest(node->left)*0x9e3779b97f4a7c15UL
+			+ node_digest(node->right);
+		h ^= h >> 29;
+		h *= 0xbf58476d1ce4e5b9UL;
+		h ^= h >> 32;
+
+		/* Permanent nodes have theirs already, see copy_graph() */
+		if (!node->permanent)
+			node->tree_size = graph_size(node->left, node->right);
+	}
+
+	if (h <= STALE_DIGEST)
+		h += 2;
+
+	return node->digest = h;
+}
+
+static int
+graph_size(struct node *left, struct node *right)
+{
+	unsigned long size = 1;
+
+	if (left)
+		size += left->tree_size;
+	if (right)
+		size += right->tree_size;
+
+	return size > INT_MAX? INT_MAX: (int)size;
+}
+
+/* Marks every non-permanent digest reachable from node stale, so
+ * node_digest() computes it again.  Each node gets visited once,
+ * however many parents it has. */
+static void
+stale_digests(struct node *node)
+{
+	while (node && !node->permanent && STALE_DIGEST != node->digest)
+	{
+		node->digest = STALE_DIGEST;
+		if (ATOM == node->typ)
 			break;
-		}
+		stale_digests(node->right);
+		node = node->left;
 	}
+}
 
-	if (i == 0 && !detected_cycle )
+/* Which graph, counting from 1, had digest and size, or 0 for
+ * none.  With "cycles confirm", graph has to match its string too. */
+static int
+find_seen(struct cycle_state *cs, unsigned long digest, int size, const char *graph)
+{
+	int i;
+
+	if (!cs->seen)
+		return 0;
+
+	for (i = digest & (cs->seen_size - 1); cs->seen[i].number;
+		i = (i + 1) & (cs->seen_size - 1))
 	{
-		if (cycle_stack_depth == cycle_stack_size)
+		if (cs->seen[i].digest == digest && cs->seen[i].size == size
+			&& (!graph || !cs->seen[i].graph || !strcmp(graph, cs->seen[i].graph)))
+			return cs->seen[i].number;
+	}
+
+	return 0;
+}
+
+static void
+add_seen(struct cycle_state *cs, unsigned long digest, int size, char *graph)
+{
+	int i;
+
+	/* No more than half full */
+	if (2*(cs->seen_count + 1) > cs->seen_size)
+	{
+		struct seen_graph *old = cs->seen;
+		int old_size = cs->seen_size;
+
+		cs->seen_size = old_size? 2*old_size: 64;
+		cs->seen = calloc(cs->seen_size, sizeof(cs->seen[0]));
+
+		for (i = 0; i < old_size; ++i)
 		{
-			int new_size = cycle_stack_size + 10;
-			char **new_array = realloc(cycle_stack, new_size*sizeof(cycle_stack[0]));
+			int j;
 
-			cycle_stack = new_array;
-			cycle_stack_size = new_size;
+			if (!old[i].number)
+				continue;
+			for (j = old[i].digest & (cs->seen_size - 1); cs->seen[j].number;
+				j = (j + 1) & (cs->seen_size - 1))
+				;
+			cs->seen[j] = old[i];
 		}
-
-		cycle_stack[cycle_stack_depth++] = graph;
+		free(old);
 	}
 
-	return detected_cycle;
+	for (i = digest & (cs->seen_size - 1); cs->seen[i].number;
+		i = (i + 1) & (cs->seen_size - 1))
+		;
+	cs->seen[i].digest = digest;
+	cs->seen[i].size = size;
+	cs->seen[i].graph = graph;
+	cs->seen[i].number = ++cs->seen_count;
 }
 
 /* Convert a graph ("parse tree") into a canonical
@@ -20,7 +20,15 @@
 */
 /* $Id: cycle_detector.h,v 1.4 2011/06/12 18:19:11 bediger Exp $ */
 
+/* cycle_detection settings for "cycles brent" and -b, and for
+ * "cycles confirm".  "cycles on" is 1. */
+#define BRENT_CYCLES   2
+#define CONFIRM_CYCLES 3
+
 void reset_detection(void);
 void free_detection(void);
+struct cycle_state;
+struct cycle_state *new_cycle_state(void);
 int cycle_detector(struct node *root, int max_redex_count);
+void update_digests(struct spine_stack *stack, int last);
 char *canonicalize_graph(struct node *node);
@@ -27,13 +27,12 @@
 #include <errno.h>    /* errno */
 #include <string.h>   /* strerror() */
 #include <stdlib.h>   /* malloc(), free(), strtoul() */
-#include <unistd.h>   /* getopt() */
+#include <stddef.h>   /* offsetof() */
+#include <unistd.h>   /* isatty() */
 #include <signal.h>   /* signal(), etc */
 #include <setjmp.h>   /* setjmp(), longjmp(), jmp_buf */
 #include <sys/time.h> /* gettimeofday(), struct timeval */
 
-extern char *optarg;
-
 #include <node.h>
 #include <hashtable.h>
 #include <atom.h>
@@ -44,21 +43,25 @@ extern char *optarg;
 #include <cycle_detector.h>
 #include <parser.h>
 #include <reduction_rule.h>
+#include <parallel.h>
 #include <brack.h>
 #include <aho_corasick.h>
+#include <heap.h>
+#include <checkpoint.h>
+#include <image.h>
+#include <trace.h>
+#include <context.h>
 
 #ifdef YYBISON
 #define YYERROR_VERBOSE
 #endif
 
-/* flags, binary on/off for various outputs */
-int cycle_detection  = 0;
-int multiple_reduction_detection  = 0;
-int debug_reduction  = 0;
-int elaborate_output = 0;
-int trace_reduction  = 0;
-int reduction_timer  = 0;
-int single_step      = 0;
+/* Interpreter settings, on/off flags and limits, live in the
+ * interpreter's context, see context.h, and so does the state of
+ * the statements below (struct interpreter_state).  What's left here
+ * goes with the parse itself: yacc's and lex's own variables aren't
+ * per context either, so only one thread at a time can parse.
+ * libacl.c takes a lock around it. */
 int count_reductions = 0;    /* produce a count of reductions */
 
 int found_binary_command = 0;  /* lex and yacc coordinate on these */
@@ -66,38 +69,86 @@ int look_for_algorithm = 0;
 int looking_for_filename = 0;
 int found_abstraction = 0;
 
-int reduction_timeout = 0;   /* how long to let a graph reduction run, seconds */
-int max_reduction_count = 0; /* when non-zero, how many reductions to perform */
+int memory_info = 0;         /* print memory statistics on exit */
 
+/* Prompting follows the input: lex.l turns it off while
+ * it reads a "load"ed file, and back on afterwards. */
 #define DEFAULT_PROMPT "ACL> "
 const char *current_prompt = DEFAULT_PROMPT;
 int prompting = 1;
 
-/* Signal handling.  in_reduce_graph used to (a) handle
+/* Expressions in a "-j N" batch, see batch_expression() */
+#define BATCH_LIMIT 1024
+
+/* One interpreter context's top-level state, see context.h */
+struct interpreter_state {
+	/* Not a local variable: the garbage collector can move the dummy
+	 * root, and a local wouldn't survive the siglongjmp() back to
+	 * run_reduce_tree(). */
+	struct node *reduction_root;
+
+	/* Dummy root of the last expression, if its reduction stopped
+	 * short of normal form.  "continue" picks it up again. */
+	struct node *stopped_root;
+
+	/* Expressions on yacc's value stack, see parsed() */
+	struct node **parsed_expressions;
+	int parsed_count;
+	int parsed_size;
+
+	/* Expressions in the current batch, each under a dummy root,
+	 * along with their input, printed once they've been reduced. */
+	struct node *batch_roots[BATCH_LIMIT];
+	struct buffer *batch_input[BATCH_LIMIT];
+	enum graphReductionResult batch_results[BATCH_LIMIT];
+	int batch_count;
+
+	/* Parsing an evaluation server request, see allowed_in_request() */
+	int serving_request;
+};
+
+/* Signal handling.  The context's in_reduce_graph used to (a) handle
  * contrl-C interruptions (b) reduction-run-time timeouts,
  * (c) getting out of single-stepped graph reduction in reduce_graph()
  * (d) quitting when enough reductions have occurred.
  */
 void sigint_handler(int signo);
-sigjmp_buf in_reduce_graph;
-int interpreter_interrupted = 0;  /* communicates with spine_stack.c code */
-int reduction_interrupted = 0;    /* communicates with reset_node_allocation() */
 
 void top_level_cleanup(int syntax_error_processing);
 
 /* related to "output_command" non-terminal */
 void set_output_command(enum OutputModifierCommands cmd, const char *setting);
 void show_output_command(enum OutputModifierCommands cmd);
+void sample_output_command(enum OutputModifierCommands cmd, const char *how, int number);
+void binary_output_command(enum OutputModifierCommands cmd, const char *how, const char *filename);
+void index_heap_notice(const char *command);
+int allowed_in_request(const char *command);
 int *find_cmd_variable(enum OutputModifierCommands cmd);
 
 
 struct node *reduce_tree(struct node *root, enum graphReductionResult *r);
+void continue_reduction(int count);
+void print_reduction_result(struct node *root, enum graphReductionResult grr);
+void keep_stopped_tree(struct node *root, enum graphReductionResult grr);
+void forget_stopped_tree(void);
+void checkpoint_reduction(const char *filename, int interval);
+void restore_reduction(const char *filename);
+int  batching(void);
+void batch_expression(struct node *expr);
+void finish_batch(void);
+void interpret_request(char *line, size_t length);
+void prepare_for_fork(void);
 struct node *execute_bracket_abstraction(
 	const char *abstracted_var,
 	struct node *root
 );
 float elapsed_time(struct timeval before, struct timeval after);
-void usage(char *progname);
+void print_memory_statistics(void);
+
+/* Expression values on the parser's stack, see parsed() */
+static struct node *parsed(struct node *expr);
+static void consumed(int count);
+static void free_unparsed(void);
 
 /* Used to hold the abstracted-out-variable in
  * bracket abstraction expressions (the 'x' in [x], or
@@ -113,14 +164,11 @@ struct identifier_element {
 	struct identifier_element *next; 
 };
 
-struct filename_node {
-	const char *filename;
-	struct filename_node *next;
-};
-
 /* from lex.l */
+extern FILE *yyin;
 extern void set_yyin_stdin(void); 
 extern void set_yyin(const char *filename); 
+extern void set_yyin_stream(FILE *fin, const char *name);
 extern void reset_yyin(void);
 extern void  push_and_open(const char *filename);
 
@@ -155,13 +203,15 @@ extern int yyparse(void);
 %token <identifier> TK_ALGORITHM_NAME
 %token TK_DEF TK_LOAD TK_GRAPH
 %token <command> TK_COMMAND
-%token TK_MAX_COUNT TK_EQUALS TK_PRINT TK_CANONICALIZE
+%token TK_MAX_COUNT TK_EQUALS TK_PRINT TK_CANONICALIZE TK_GC TK_MEMORY TK_MEMSTATS
+%token TK_CONTINUE TK_CHECKPOINT TK_RESTORE TK_SAVE_IMAGE
 %token <string_constant> BINARY_MODIFIER
 %token TK_RULE TK_ARROW TK_RULES TK_ABS_MARKR TK_ABSTRACTED_VAR
 
 %type <node> expression stmnt application term interpreter_command
 %type <idlist> bracket_abstraction identifier_list
 %type <command> output_command
+%type <string_constant> checkpoint_file
 
 %type <abs_node> a_term a_appl a_expr a_abstr_any
 %type <abs_node> r_term r_appl r_expr
@@ -180,7 +230,7 @@ program
 	| abstraction_rule { top_level_cleanup(0); }
 	| program abstraction_rule { top_level_cleanup(0); }
 	| error  /* magic token - yacc unwinds to here on syntax error */
-		{ top_level_cleanup(1); }
+		{ ++current_context->syntax_error_count; free_unparsed(); finish_batch(); top_level_cleanup(1); }
 	;
 
 reduction_rule
@@ -199,6 +249,7 @@ reduction_rule
 
 combinator_rule: TK_RULE TK_IDENTIFIER number_list TK_ARROW
 	{
+		finish_batch();
 		if ($3->depth > 0)
 		{
 			struct reduction_rule *rule = calloc(1, sizeof *rule);
@@ -253,59 +304,34 @@ stmnt
 	: expression TK_EOL
 		{
 			enum graphReductionResult grr;
-			if ($1)
+			consumed(1);
+			if ($1 && current_context->expression_hook)
 			{
+				current_context->expression_hook($1);
+				$$ = NULL;
+			} else if ($1 && batching())
+			{
+				batch_expression($1);
+				$$ = NULL;
+			} else if ($1) {
 				print_graph($1, 0, 0); 
 				$$ = reduce_tree($1, &grr);
-				if (INTERRUPT != grr)
-				{
-					int ignore;
-					struct buffer *b = new_buffer(256);
-					int redex_count = reduction_count($$->left, 0, &ignore, b);
-
-					b->buffer[b->offset] = '\0';
-
-					if (REDUCTION_LIMIT == grr)
-						printf("Reduction limit\n");
-
-					if (multiple_reduction_detection)
-						printf("[%d] ", redex_count);
-					printf("%s\n", b->buffer);
-
-					delete_buffer(b);
-
-					if (CYCLE_DETECTED != grr && REDUCTION_LIMIT != grr)
-					{
-						/* more built-in testing: if a redex occurs in the
-				 		* term, it didn't get to normal form. */
-						if (redex_count > 0) printf("Problem: %d reductions remaining, normal form not reached.\n", redex_count);
-					}
-				}
-				free_node($$);
+				print_reduction_result($$, grr);
+				keep_stopped_tree($$, grr);
 			}
 		}
 	| TK_DEF TK_IDENTIFIER expression TK_EOL
 		{
+			consumed(1);
 			abbreviation_add($2, $3);
 			++$3->refcnt;
 			free_node($3);
 		}
-	| interpreter_command
-	| TK_EOL  { $$ = NULL; /* blank lines */ }
-	;
-
-interpreter_command
-	: output_command BINARY_MODIFIER TK_EOL { found_binary_command = 0; set_output_command($1, $2); }
-	| output_command TK_EOL { found_binary_command = 0; show_output_command($1); }
-	| TK_RULES TK_EOL { print_rules(); }
-	| TK_ABSTRACTIONS TK_EOL { print_abstractions(); }
-	| TK_LOAD {looking_for_filename = 1; } FILE_NAME TK_EOL { looking_for_filename = 0; push_and_open($3); }
-	| TK_TIMEOUT NUMERICAL_CONSTANT TK_EOL { reduction_timeout = $2; }
-	| TK_TIMEOUT TK_EOL { printf("reduction runs for %d seconds\n", reduction_timeout); }
-	| TK_MAX_COUNT NUMERICAL_CONSTANT TK_EOL { max_reduction_count = $2; }
-	| TK_MAX_COUNT TK_EOL { printf("perform %d reductions at maximum\n", max_reduction_count); }
+	| batch_break interpreter_command { $$ = $2; }
 	| expression TK_EQUALS expression TK_EOL
 		{
+			consumed(2);
+			finish_batch();
 			if (equivalent_graphs($1, $3))
 				printf("Equivalent\n");
 			else
@@ -317,9 +343,59 @@ interpreter_command
 			free_node($3);
 			$1 = $3 = NULL;
 		}
+	| TK_EOL  { $$ = NULL; /* blank lines */ }
+	;
+
+/* Expressions waiting in a "-j N" batch get reduced, and their
+ * results printed, before any interpreter command does anything. */
+batch_break
+	: /* empty */ { finish_batch(); }
+	;
+
+interpreter_command
+	: output_command BINARY_MODIFIER TK_EOL { found_binary_command = 0; set_output_command($1, $2); }
+	| output_command TK_EOL { found_binary_command = 0; show_output_command($1); }
+	| output_command TK_IDENTIFIER NUMERICAL_CONSTANT TK_EOL { found_binary_command = 0; sample_output_command($1, $2, $3); }
+	| output_command TK_SIZE NUMERICAL_CONSTANT TK_EOL { found_binary_command = 0; sample_output_command($1, "size", $3); }
+	| output_command TK_IDENTIFIER FILE_NAME TK_EOL { found_binary_command = 0; binary_output_command($1, $2, $3); }
+	| TK_RULES TK_EOL { print_rules(); }
+	| TK_ABSTRACTIONS TK_EOL { print_abstractions(); }
+	| TK_LOAD {looking_for_filename = 1; } FILE_NAME TK_EOL {
+			looking_for_filename = 0;
+			if (allowed_in_request("load")) push_and_open($3);
+		}
+	| TK_TIMEOUT NUMERICAL_CONSTANT TK_EOL { current_context->reduction_timeout = $2; }
+	| TK_TIMEOUT TK_EOL { printf("reduction runs for %d seconds\n", current_context->reduction_timeout); }
+	| TK_MAX_COUNT NUMERICAL_CONSTANT TK_EOL { current_context->max_reduction_count = $2; }
+	| TK_MAX_COUNT TK_EOL { printf("perform %d reductions at maximum\n", current_context->max_reduction_count); }
+	| TK_GC NUMERICAL_CONSTANT TK_EOL {
+			current_context->gc_threshold = $2;
+			if ($2 > 0) index_heap_notice("gc");
+		}
+	| TK_GC TK_EOL { print_gc_statistics(); }
+	| TK_MEMORY NUMERICAL_CONSTANT TK_EOL { current_context->memory_limit = $2; }
+	| TK_MEMORY TK_EOL { printf("reduce using %d live nodes at maximum\n", current_context->memory_limit); }
+	| TK_MEMSTATS TK_EOL { print_memory_statistics(); }
+	| TK_CONTINUE NUMERICAL_CONSTANT TK_EOL { continue_reduction($2); }
+	| TK_CONTINUE TK_EOL { continue_reduction(0); }
+	| checkpoint_file TK_EOL {
+			if (allowed_in_request("checkpoint")) checkpoint_reduction($1, -1);
+		}
+	| checkpoint_file NUMERICAL_CONSTANT TK_EOL {
+			if (allowed_in_request("checkpoint")) checkpoint_reduction($1, $2);
+		}
+	| TK_RESTORE {looking_for_filename = 1; } FILE_NAME TK_EOL {
+			looking_for_filename = 0;
+			if (allowed_in_request("restore")) restore_reduction($3);
+		}
+	| TK_SAVE_IMAGE {looking_for_filename = 1; } FILE_NAME TK_EOL {
+			looking_for_filename = 0;
+			if (allowed_in_request("save-image")) save_image($3);
+		}
 	| TK_PRINT expression TK_EOL {
+			consumed(1);
 			printf("Literal: ");
-			if (multiple_reduction_detection)
+			if (current_context->multiple_reduction_detection)
 			{
 				int ignore;
 				struct buffer *b = new_buffer(256);
@@ -334,6 +410,7 @@ interpreter_command
 		}
 	| TK_CANONICALIZE expression TK_EOL {
 			char *buf = NULL;
+			consumed(1);
 			printf("Canonically: ");
 			buf = canonicalize_graph($2); 
 			printf("%s\n", buf);
@@ -345,6 +422,7 @@ interpreter_command
 			int ignore;
 			struct buffer *b = new_buffer(256);
 			int cnt = reduction_count($2, 0, &ignore, b);
+			consumed(1);
 			printf("Found %d possible reductions\n", cnt);
 			++$2->refcnt;
 			free_node($2);
@@ -352,12 +430,14 @@ interpreter_command
 		}
 	| TK_LENGTH expression TK_EOL {
 			int cnt = node_count($2, 0);  /* only count atoms. */
+			consumed(1);
 			printf("%d atoms\n", cnt);
 			++$2->refcnt;
 			free_node($2);
 		}
 	| TK_SIZE expression TK_EOL {
 			int cnt = node_count($2, 1);  /* count interior nodes, too. */
+			consumed(1);
 			printf("%d nodes\n", cnt);
 			++$2->refcnt;
 			free_node($2);
@@ -371,16 +451,35 @@ output_command
 	: TK_COMMAND { found_binary_command = 1; $$ = $1; }
 	;
 
+/* "checkpoint" takes a file name, maybe followed by a number,
+ * which has to get read after looking_for_filename goes back to 0. */
+checkpoint_file
+	: TK_CHECKPOINT {looking_for_filename = 1; } FILE_NAME { looking_for_filename = 0; $$ = $3; }
+	;
+
 expression
 	: application          { $$ = $1; }
 	| term                 { $$ = $1; }
 	| TK_REDUCE expression
 		{
-			struct node *tmp;
+			struct node *tmp, *expr = $2;
 			enum graphReductionResult r;
-			tmp = reduce_tree($2, &r);  /* XXX - need to check r */
+			consumed(1);
+			finish_batch();
+			if (current_context->maximal_sharing)
+			{
+				/* Reduction overwrites nodes in place: give it a
+				 * private copy, since other parts of the input
+				 * can refer to the nodes in $2. */
+				current_context->maximal_sharing = 0;
+				expr = arena_copy_graph($2);
+				current_context->maximal_sharing = 1;
+				++$2->refcnt;
+				free_node($2);
+			}
+			tmp = reduce_tree(expr, &r);  /* XXX - need to check r */
 			--tmp->left->refcnt;
-			$$ = tmp->left;
+			$$ = parsed(tmp->left);
 			tmp->left = NULL;
 			free_node(tmp);
 		}
@@ -390,6 +489,7 @@ expression
 			struct identifier_element *curr, *head;
 
 			look_for_algorithm = 0;
+			consumed(1);
 
 			curr = $1->tail;
 			head = $1->head;
@@ -418,13 +518,13 @@ expression
 
 			free($1);
 
-			$$ = abstracted_expression;
+			$$ = parsed(abstracted_expression);
 		}
 	;
 
 application
-	: term term        { $$ = new_application($1, $2); }
-	| application term { $$ = new_application($1, $2); }
+	: term term        { consumed(2); $$ = parsed(new_application($1, $2)); }
+	| application term { consumed(2); $$ = parsed(new_application($1, $2)); }
 	;
 
 bracket_abstraction
@@ -461,10 +561,10 @@ term
 			$$ = abbreviation_lookup($1);
 			if (!$$)
 			{
-				$$ = new_term($1);
 				/* see if the identifier matches a reduction rule */
-				$$->rule = get_reduction_rule($1);
+				$$ = new_term($1, get_reduction_rule($1));
 			}
+			parsed($$);
 		}
 	| TK_LPAREN expression TK_RPAREN  { $$ = $2; }
 	;
@@ -474,6 +574,7 @@ abstraction_rule
 			struct abs_node *pattern = $4;
 			struct abs_node *replacement = $6;
 			found_abstraction = 0;
+			finish_batch();
 			set_abstraction_rule(pattern, replacement);
 		}
 	;
@@ -539,130 +640,74 @@ r_term
 
 %%
 
-int
-main(int ac, char **av)
+void top_level_cleanup(int syntax_error_occurred)
 {
-	int c, r;
-	struct filename_node *p, *load_files = NULL, *load_tail = NULL;
-	struct hashtable *h = init_hashtable(64, 10);
-
-	setup_abbreviation_table(h);
-	setup_atom_table(h);
+	reset_node_allocation();
+	current_context->reduction_interrupted = 0;
+	if (prompting && !syntax_error_occurred) printf(current_prompt);
+}
 
-	
+struct interpreter_state *
+new_interpreter_state(void)
+{
+	return calloc(1, sizeof(struct interpreter_state));
+}
 
-	while (-1 != (c = getopt(ac, av, "cDdeL:N:psT:tx")))
-	{
-		switch (c)
-		{
-		case 'c':
-			cycle_detection = 1;
-			break;
-		case 'd':
-			debug_reduction = 1;
-			break;
-		case 'D':
-			yydebug = 1;
-			break;
-		case 'e':
-			elaborate_output = 1;
-			break;
-		case 'L':
-			p = malloc(sizeof(*p));
-			p->filename = Atom_string(optarg);
-			p->next = NULL;
-			if (load_tail)
-				load_tail->next = p;
-			load_tail = p;
-			if (!load_files)
-				load_files = p;
-			break;
-		case 'N':
-			max_reduction_count = strtol(optarg, NULL, 10);
-			if (max_reduction_count < 0) max_reduction_count = 0;
-			break;
-		case 'p':
-			prompting = 0;
-			break;
-		case 's':
-			single_step = 1;
-			break;
-		case 'T':
-			reduction_timeout = strtol(optarg, NULL, 10);
-			break;
-		case 't':
-			trace_reduction = 1;
-			break;
-		case 'x':
-			usage(av[0]);
-			exit(0);
-			break;
-		}
-	}
+/* The nodes go with the rest of the context's */
+void
+free_interpreter_state(void)
+{
+	struct interpreter_state *is = current_context->interpreter;
+
+	while (is->batch_count > 0)
+		delete_buffer(is->batch_input[--is->batch_count]);
+	free(is->parsed_expressions);
+	is->parsed_expressions = NULL;
+	is->parsed_count = is->parsed_size = 0;
+	is->reduction_root = is->stopped_root = NULL;
+}
 
-	init_node_allocation();
+/* Expressions on yacc's value stack, in the same order: terms push
+ * themselves, and anything that uses a term pops it.  On a syntax
+ * error, yacc throws away its stack, values and all, and
+ * free_unparsed() frees whatever expressions were on it. */
+static struct node *
+parsed(struct node *expr)
+{
+	struct interpreter_state *is = current_context->interpreter;
 
-	if (load_files)
+	if (is->parsed_count >= is->parsed_size)
 	{
-		struct filename_node *t, *z;
-		int old_prompt = prompting;
-		prompting = 0;
-		for (z = load_files; z; z = t)
-		{
-			FILE *fin;
-
-			t = z->next;
-
-			printf("load file named \"%s\"\n",
-				z->filename);
-
-			if (!(fin = fopen(z->filename, "r")))
-			{
-				fprintf(stderr, "Problem reading \"%s\": %s\n",
-					z->filename, strerror(errno));
-				continue;
-			}
+		is->parsed_size = is->parsed_size? 2*is->parsed_size: 16;
+		is->parsed_expressions = realloc(is->parsed_expressions,
+			is->parsed_size*sizeof(is->parsed_expressions[0]));
+	}
+	is->parsed_expressions[is->parsed_count++] = expr;
 
-			set_yyin(z->filename);
+	return expr;
+}
 
-			r = yyparse();
+static void
+consumed(int count)
+{
+	current_context->interpreter->parsed_count -= count;
+}
 
-			reset_yyin();
+static void
+free_unparsed(void)
+{
+	struct interpreter_state *is = current_context->interpreter;
 
-			if (r)
-				printf("Problem with file \"%s\"\n", z->filename);
+	while (is->parsed_count > 0)
+	{
+		struct node *expr = is->parsed_expressions[--is->parsed_count];
 
-			free(z);
-			fin = NULL;
+		if (expr)
+		{
+			++expr->refcnt;
+			free_node(expr);
 		}
-		prompting = old_prompt;
 	}
-
-	set_yyin_stdin();
-
-	do {
-		if (prompting) printf(current_prompt);
-		r =  yyparse();
-	} while (r);
-	if (prompting) printf("\n");
-
-	free_all_nodes();
-	free_hashtable(h);
-	free_all_spine_stacks();
-	free_rules();
-	delete_abstraction_rules();
-	cleanup_abstraction();
-	if (cycle_detection) free_detection();
-	reset_yyin();
-
-	return r;
-}
-
-void top_level_cleanup(int syntax_error_occurred)
-{
-	reset_node_allocation();
-	reduction_interrupted = 0;
-	if (prompting && !syntax_error_occurred) printf(current_prompt);
 }
 
 int
@@ -678,9 +723,14 @@ void
 sigint_handler(int signo)
 {
 	/* the "return value" of 1 or 2 comes out in the
-	 * call to sigsetjmp() in reduce_tree().
+	 * call to sigsetjmp() in run_reduce_tree(), or from
+	 * reduction_stopped() if the reduction loop can quit
+	 * by itself, leaving a graph that "continue" can use.
 	 */
-	siglongjmp(in_reduce_graph, signo == SIGINT? 1: 2);
+	if (reduction_running())
+		stop_reduction(signo == SIGINT? 1: 2);
+	else
+		siglongjmp(current_context->in_reduce_graph, signo == SIGINT? 1: 2);
 }
 
 /*
@@ -688,67 +738,401 @@ sigint_handler(int signo)
  * at the topmost level.  It wraps with setting signal handlers,
  * taking before & after timestamps, setting jmp_buf structs, etc.
  */
+
+static struct node *run_reduce_tree(
+	struct node *real_root,
+	enum graphReductionResult (*reducer)(struct node **),
+	enum graphReductionResult *grr
+);
+
 struct node *
 reduce_tree(struct node *real_root, enum graphReductionResult *grr)
 {
+	/* Only the latest reduction can get continued. */
+	forget_stopped_tree();
+
+	return run_reduce_tree(real_root, reduce_graph, grr);
+}
+
+/* "continue" and "continue N" interpreter commands: go on
+ * reducing the last expression from where it stopped, for
+ * up to N contractions, or the "count" setting. */
+void
+continue_reduction(int count)
+{
+	struct interpreter_state *is = current_context->interpreter;
+	enum graphReductionResult grr;
+	int old_count = current_context->max_reduction_count;
+	struct node *root;
+
+	if (!is->stopped_root)
+	{
+		printf("No reduction to continue\n");
+		return;
+	}
+
+	is->reduction_root = is->stopped_root;
+	is->stopped_root = NULL;
+	keep_live_nodes(0);
+
+	if (count > 0)
+		current_context->max_reduction_count = count;
+	root = run_reduce_tree(NULL, resume_graph, &grr);
+	current_context->max_reduction_count = old_count;
+
+	print_reduction_result(root, grr);
+	keep_stopped_tree(root, grr);
+}
+
+/* Reduces real_root, or with real_root NULL, whatever
+ * the context's reduction_root already has in it. */
+static struct node *
+run_reduce_tree(
+	struct node *real_root,
+	enum graphReductionResult (*reducer)(struct node **),
+	enum graphReductionResult *grr
+)
+{
+	struct interpreter_state *is = current_context->interpreter;
 	void (*old_sigint_handler)(int);
 	void (*old_sigalm_handler)(int);
 	struct timeval before, after;
 	int cc;
-	struct node *new_root = new_application(real_root, new_application(NULL, NULL));
+	int old_sharing = current_context->maximal_sharing;
 
-	/* new_root - points to a "dummy" node, necessary for I and
-	 * K reductions, if the expression is something like "I x" or
-	 * K a b. It has a dummy right-child so as to avoid continually
-	 * testing for a missing right-hand-child node.
-	 */
-	++new_root->refcnt;
+	/* Nodes created by reductions stay out of the unique table. */
+	current_context->maximal_sharing = 0;
+
+	if (real_root)
+	{
+		is->reduction_root = new_application(real_root, new_application(NULL, NULL));
+
+		/* reduction_root - points to a "dummy" node, necessary for I and
+		 * K reductions, if the expression is something like "I x" or
+		 * K a b. It has a dummy right-child so as to avoid continually
+		 * testing for a missing right-hand-child node.
+		 */
+		++is->reduction_root->refcnt;
+	}
 
 	old_sigint_handler = signal(SIGINT, sigint_handler);
 	old_sigalm_handler = signal(SIGALRM, sigint_handler);
 
-	if (!(cc = sigsetjmp(in_reduce_graph, 1)))
+	if (!(cc = sigsetjmp(current_context->in_reduce_graph, 1)))
 	{
-		alarm(reduction_timeout);
+		alarm(current_context->reduction_timeout);
 		gettimeofday(&before, NULL);
-		*grr = reduce_graph(new_root);
+		*grr = reducer(&is->reduction_root);
 		alarm(0);
 		gettimeofday(&after, NULL);
+		/* Callers adjust reference counts by hand, so
+		 * those counts have to be exact. */
+		flush_pending_nodes();
+		/* The reduction loop quit on a signal, graph intact. */
+		if (INTERRUPT == *grr)
+			cc = reduction_stopped();
 	} else {
-		const char *phrase = "Unset";
 		alarm(0);
 		gettimeofday(&after, NULL);
 		*grr = INTERRUPT;
+		++current_context->interpreter_interrupted;
+		current_context->reduction_interrupted = 1;
+	}
+
+	if (cc)
+	{
+		const char *phrase = "Unset";
 		switch (cc)
 		{
 		case 1:
 			phrase = "Interrupt";
-			if (cycle_detection) reset_detection();
+			if (current_context->cycle_detection) reset_detection();
 			break;
 		case 2:
 			phrase = "Timeout";
-			if (cycle_detection) reset_detection();
+			if (current_context->cycle_detection) reset_detection();
 			break;
 		case 3:
 			phrase = "Terminated";
-			if (cycle_detection) reset_detection();
+			if (current_context->cycle_detection) reset_detection();
 			break;
 		default:
 			phrase = "Unknown";
 			break;
 		}
 		printf("%s\n", phrase);
-		++interpreter_interrupted;
-		reduction_interrupted = 1;
 	}
 
 	signal(SIGINT, old_sigint_handler);
 	signal(SIGALRM, old_sigalm_handler);
 
-	if (reduction_timer)
-		printf("elapsed time %.3f seconds\n", elapsed_time(before, after));
+	current_context->maximal_sharing = old_sharing;
+
+	wait_for_checkpoint();
 
-	return new_root;
+	if (current_context->reduction_timer)
+	{
+		float elapsed = elapsed_time(before, after);
+		printf("elapsed time %.3f seconds\n", elapsed);
+		print_reduction_layout();
+		if (!cc)
+		{
+			printf("%lu contractions", current_context->contraction_count);
+			if (elapsed > 0.0)
+				printf(", %.0f per second", current_context->contraction_count/elapsed);
+			printf("\n");
+			if (current_context->shared_contraction_count)
+				printf("%lu shared redexes contracted once\n",
+					current_context->shared_contraction_count);
+		}
+	}
+
+	return is->reduction_root;
+}
+
+void
+print_reduction_result(struct node *root, enum graphReductionResult grr)
+{
+	if (INTERRUPT != grr)
+	{
+		int ignore;
+		struct buffer *b = new_buffer(256);
+		int redex_count = reduction_count(root->left, 0, &ignore, b);
+
+		b->buffer[b->offset] = '\0';
+
+		if (REDUCTION_LIMIT == grr)
+			printf("Reduction limit\n");
+		else if (MEMORY_LIMIT == grr)
+			printf("Memory limit\n");
+
+		if (current_context->multiple_reduction_detection)
+			printf("[%d] ", redex_count);
+		printf("%s\n", b->buffer);
+
+		delete_buffer(b);
+
+		if (CYCLE_DETECTED != grr && REDUCTION_LIMIT != grr
+			&& MEMORY_LIMIT != grr)
+		{
+			/* more built-in testing: if a redex occurs in the
+			 * term, it didn't get to normal form. */
+			if (redex_count > 0) printf("Problem: %d reductions remaining, normal form not reached.\n", redex_count);
+		}
+	}
+}
+
+/* A top-level expression that stopped short of normal form stays
+ * around for "continue", unless a siglongjmp() got out of the
+ * middle of a contraction, and the graph can't be trusted. */
+void
+keep_stopped_tree(struct node *root, enum graphReductionResult grr)
+{
+	if ((REDUCTION_LIMIT == grr || MEMORY_LIMIT == grr || INTERRUPT == grr)
+		&& !current_context->reduction_interrupted)
+	{
+		current_context->interpreter->stopped_root = root;
+		keep_live_nodes(1);
+	} else
+		free_node(root);
+}
+
+void
+forget_stopped_tree(void)
+{
+	struct interpreter_state *is = current_context->interpreter;
+
+	if (is->stopped_root)
+	{
+		free_node(is->stopped_root);
+		is->stopped_root = NULL;
+		keep_live_nodes(0);
+	}
+	forget_stopped_reduction();
+}
+
+/* "checkpoint file" writes the stopped reduction to file.  With a
+ * number, "checkpoint file N", reductions write themselves to file
+ * every N contractions, and "checkpoint file 0" turns that off. */
+void
+checkpoint_reduction(const char *filename, int interval)
+{
+	struct node *stopped_root = current_context->interpreter->stopped_root;
+	struct spine_stack *stack;
+	unsigned long contractions;
+	int dir;
+
+	if (interval >= 0)
+	{
+		current_context->checkpoint_interval = interval;
+		current_context->checkpoint_file = interval? filename: NULL;
+		return;
+	}
+
+	if (!stopped_root)
+	{
+		printf("No reduction to checkpoint\n");
+		return;
+	}
+
+	stack = stopped_reduction(&dir, &contractions);
+	write_checkpoint(filename, stopped_root, stack, dir, contractions);
+}
+
+/* "restore file": the checkpointed reduction in file takes the
+ * place of any stopped reduction, for "continue" to go on with. */
+void
+restore_reduction(const char *filename)
+{
+	struct spine_stack *stack;
+	unsigned long contractions;
+	int dir;
+	struct node *root;
+	int old_sharing = current_context->maximal_sharing;
+
+	/* Same as nodes created by reductions, restored
+	 * nodes stay out of the unique table. */
+	current_context->maximal_sharing = 0;
+	root = read_checkpoint(filename, &stack, &dir, &contractions);
+	current_context->maximal_sharing = old_sharing;
+
+	if (root)
+	{
+		forget_stopped_tree();
+		++root->refcnt;
+		current_context->interpreter->stopped_root = root;
+		keep_live_nodes(1);
+		set_stopped_reduction(stack, dir, contractions);
+	}
+}
+
+/* With "-j N", top-level expressions read from a file, or from
+ * anything else that isn't a terminal, get reduced in batches.
+ * Anything that prints while reducing, or that limits a reduction,
+ * needs one expression at a time.  So does a prompt. */
+int
+batching(void)
+{
+	struct acl_context *ctx = current_context;
+
+	return ctx->parallel_jobs > 1 && !prompting
+		&& yyin && !isatty(fileno(yyin))
+		&& !(ctx->debug_reduction || ctx->trace_reduction || ctx->cycle_detection
+			|| ctx->single_step || ctx->memory_limit || ctx->gc_threshold
+			|| ctx->max_reduction_count || ctx->lazy_reclamation
+			|| ctx->checkpoint_interval || ctx->reduction_timeout
+			|| ctx->reduction_timer || ctx->elaborate_output || ctx->maximal_sharing);
+}
+
+/* Puts expr in the batch, as a copy that doesn't share any
+ * nodes with abbreviations or with other expressions, so that
+ * a thread can reduce it without looking at any other thread. */
+void
+batch_expression(struct node *expr)
+{
+	struct interpreter_state *is = current_context->interpreter;
+	struct buffer *b = new_buffer(256);
+	struct node *root;
+
+	/* Only the latest reduction can get continued. */
+	forget_stopped_tree();
+
+	graph_text(expr, b);
+	b->buffer[b->offset] = '\0';
+
+	root = new_application(private_copy_graph(expr), new_application(NULL, NULL));
+	++root->refcnt;
+	++expr->refcnt;
+	free_node(expr);
+
+	is->batch_roots[is->batch_count] = root;
+	is->batch_input[is->batch_count] = b;
+	is->batch_results[is->batch_count] = INTERRUPT;
+	++is->batch_count;
+
+	/* The batch lives in the arena from one statement to the next */
+	keep_live_nodes(1);
+
+	if (BATCH_LIMIT == is->batch_count)
+		finish_batch();
+}
+
+/* Reduces the batch, then prints each expression and its normal
+ * form, same as reducing them one at a time would have.  Control-C
+ * stops the whole batch: unfinished expressions get thrown away. */
+void
+finish_batch(void)
+{
+	struct interpreter_state *is = current_context->interpreter;
+	void (*old_sigint_handler)(int);
+	int i, n = is->batch_count;
+
+	if (!n)
+		return;
+	is->batch_count = 0;
+
+	old_sigint_handler = signal(SIGINT, sigint_handler);
+	if (!sigsetjmp(current_context->in_reduce_graph, 1))
+		reduce_graphs(is->batch_roots, is->batch_results, n);
+	signal(SIGINT, old_sigint_handler);
+
+	for (i = 0; i < n; ++i)
+	{
+		printf("%s\n", is->batch_input[i]->buffer);
+		if (INTERRUPT == is->batch_results[i])
+			printf("Interrupt\n");
+		else
+			print_reduction_result(is->batch_roots[i], is->batch_results[i]);
+		free_node(is->batch_roots[i]);
+		delete_buffer(is->batch_input[i]);
+	}
+
+	keep_live_nodes(NULL != is->stopped_root);
+}
+
+/* The evaluation server's workers interpret each request
+ * line, length bytes long, ending in a newline, with this. */
+void
+interpret_request(char *line, size_t length)
+{
+	FILE *fin = fmemopen(line, length, "r");
+
+	if (!fin)
+	{
+		printf("Problem reading request: %s\n", strerror(errno));
+		return;
+	}
+
+	current_context->interpreter->serving_request = 1;
+	set_yyin_stream(fin, "request");
+	yyparse();
+	reset_yyin();
+	current_context->interpreter->serving_request = 0;
+}
+
+/* Evaluation server requests can be expressions, definitions and
+ * settings, but nothing that reads or writes a file, or waits on
+ * the terminal: anyone who can connect to the socket can send them. */
+int
+allowed_in_request(const char *command)
+{
+	if (!current_context->interpreter->serving_request)
+		return 1;
+
+	printf("\"%s\" isn't available to server requests\n", command);
+	return 0;
+}
+
+/* Before the evaluation server forks its workers: nothing can be
+ * half done, and threads don't survive fork(), so the "-j N" pool
+ * has to stop.  Workers start it up again when they need it. */
+void
+prepare_for_fork(void)
+{
+	finish_batch();
+	stop_workers();
+	prompting = 0;
+	fflush(stdout);
 }
 
 /*
@@ -771,7 +1155,7 @@ execute_bracket_abstraction(
 	old_sigint_handler = signal(SIGINT, sigint_handler);
 	old_sigalm_handler = signal(SIGALRM, sigint_handler);
 
-	if (!(cc = sigsetjmp(in_reduce_graph, 1)))
+	if (!(cc = sigsetjmp(current_context->in_reduce_graph, 1)))
 	{
 		/* No timeout on bracket abstractions: they don't take that
 		 * long, and since I wrote recursive abstraction, a timeout
@@ -780,11 +1164,16 @@ execute_bracket_abstraction(
 		r = perform_bracket_abstraction(abstracted_var, root);
 		alarm(0);
 		gettimeofday(&after, NULL);
-		if (!r) printf("Bracket abstraction on \"%s\" failed.\n", abstracted_var);
+		if (!r)
+		{
+			finish_batch();
+			printf("Bracket abstraction on \"%s\" failed.\n", abstracted_var);
+		}
 	} else {
 		const char *phrase = "Unset";
 		alarm(0);
 		gettimeofday(&after, NULL);
+		finish_batch();
 		switch (cc)
 		{
 		case 1: phrase = "Interrupt"; break;
@@ -800,7 +1189,7 @@ execute_bracket_abstraction(
 	signal(SIGINT, old_sigint_handler);
 	signal(SIGALRM, old_sigalm_handler);
 
-	if (reduction_timer)
+	if (current_context->reduction_timer)
 		printf("elapsed time %.3f seconds\n", elapsed_time(before, after));
 
 	return r;
@@ -824,46 +1213,119 @@ elapsed_time(struct timeval before, struct timeval after)
 	return r;
 }
 
+/* Called for "memstats" and by the -m flag on exit. */
 void
-usage(char *progname)
+print_memory_statistics(void)
 {
-	fprintf(stderr, "%s: Combinatory Logic like language interpreter\n",
-		progname);
-	fprintf(stderr, "Flags:\n"
-		"-c             Enable reduction cycle detection\n"
-		"-d             Debug reductions\n"
-		"-e             Elaborate output\n"
-		"-L  filename   Load and interpret a file named filename\n"
-		"-m             on exit, print memory usage summary\n"
-		"-N number      Perform up to number reductions\n"
-		"-p             Don't print prompts\n"
-		"-s             Single-step reductions\n"
-		"-T number      Evaluate an expression for up to number seconds\n"
-		"-t             trace reductions\n"
-		""
-	);
-}
-
-static int *command_variables[] = {
-	&debug_reduction,
-	&elaborate_output,
-	&trace_reduction,
-	&reduction_timer,
-	&single_step,
-	&cycle_detection,
-	&multiple_reduction_detection
+	print_node_statistics();
+	print_reduction_layout_statistics();
+	print_spine_stack_statistics();
+	print_hashtable_statistics(current_context->strings);
+	print_abstraction_statistics();
+}
+
+/* Where each setting sits in a struct acl_context */
+static size_t command_variables[] = {
+	offsetof(struct acl_context, debug_reduction),
+	offsetof(struct acl_context, elaborate_output),
+	offsetof(struct acl_context, trace_reduction),
+	offsetof(struct acl_context, reduction_timer),
+	offsetof(struct acl_context, single_step),
+	offsetof(struct acl_context, cycle_detection),
+	offsetof(struct acl_context, multiple_reduction_detection),
+	offsetof(struct acl_context, maximal_sharing),
+	offsetof(struct acl_context, lazy_reclamation)
 };
 
 int *
 find_cmd_variable(enum OutputModifierCommands cmd)
 {
-	return command_variables[cmd];
+	return (int *)((char *)current_context + command_variables[cmd]);
 }
 
 void
 set_output_command(enum OutputModifierCommands cmd, const char *setting)
 {
+	if (!strcmp(setting, "brent") || !strcmp(setting, "confirm"))
+	{
+		/* "cycles brent": constant memory cycle detection,
+		 * "cycles confirm": compare strings, not just digests */
+		if (CYCLES_O == cmd)
+			current_context->cycle_detection =
+				strcmp(setting, "brent")? CONFIRM_CYCLES: BRENT_CYCLES;
+		else
+			printf("Only cycles can be %s\n", setting);
+		return;
+	}
+
+	/* Single-stepping waits on the terminal */
+	if (STEP_O == cmd && !strcmp(setting, "on") && !allowed_in_request("step"))
+		return;
+
 	*(find_cmd_variable(cmd)) = strcmp(setting, "on")? 0: 1;
+
+	if (TRACE_O == cmd && !current_context->trace_reduction)
+		close_trace_file();
+
+	if (LAZY_O == cmd && current_context->lazy_reclamation)
+		index_heap_notice("lazy");
+}
+
+/* The index-based heap (heap.c) neither collects garbage nor
+ * frees lazily, so run_reduction() reduces on structs node
+ * while "gc" or "lazy" is on.  Say so, rather than leave
+ * someone benchmarking the heap to wonder. */
+void
+index_heap_notice(const char *command)
+{
+#ifdef INDEX_HEAP
+	printf("%s on: reductions use struct nodes, not the index heap\n", command);
+#endif
+}
+
+/* "trace every N" and "trace size N" */
+void
+sample_output_command(enum OutputModifierCommands cmd, const char *how, int number)
+{
+	if (TRACE_O != cmd)
+	{
+		printf("Only trace can be sampled\n");
+		return;
+	}
+
+	if (!strcmp(how, "every"))
+		current_context->trace_every = number;
+	else if (!strcmp(how, "size"))
+		current_context->trace_size = number;
+	else {
+		printf("Trace every N or trace size N, not trace %s\n", how);
+		return;
+	}
+
+	current_context->trace_reduction = 1;
+}
+
+/* "trace binary filename" */
+void
+binary_output_command(enum OutputModifierCommands cmd, const char *how, const char *filename)
+{
+	if (TRACE_O != cmd)
+	{
+		printf("Only trace can write a binary file\n");
+		return;
+	}
+
+	if (strcmp(how, "binary"))
+	{
+		printf("Trace binary \"file\", not trace %s\n", how);
+		return;
+	}
+
+	if (!allowed_in_request("trace binary"))
+		return;
+
+	if (open_trace_file(filename))
+		current_context->trace_reduction = 1;
 }
 
 const static char *command_phrases[] = {
@@ -873,11 +1335,25 @@ const static char *command_phrases[] = {
 	"reduction timer",
 	"single-stepping",
 	"reduction cycle detection",
-	"non-head reduction detection"
+	"non-head reduction detection",
+	"maximal sharing",
+	"lazy node reclamation"
 };
 
 void
 show_output_command(enum OutputModifierCommands cmd)
 {
-	printf("%s %s\n", command_phrases[cmd], *(find_cmd_variable(cmd))? "on": "off");
+	int setting = *(find_cmd_variable(cmd));
+	const char *value = setting? "on": "off";
+
+	if (CYCLES_O == cmd && BRENT_CYCLES == setting)
+		value = "brent";
+	else if (CYCLES_O == cmd && CONFIRM_CYCLES == setting)
+		value = "confirm";
+
+	printf("%s %s\n", command_phrases[cmd], value);
+	if (SHARE_O == cmd)
+		printf("%d node allocations avoided\n", allocations_avoided());
+	if (TRACE_O == cmd && setting)
+		print_trace_settings();
 }
@@ -25,6 +25,8 @@
 #include <assert.h>
 #include <string.h>
 #include <setjmp.h>   /* longjmp(), jmp_buf */
+#include <signal.h>   /* sig_atomic_t */
+#include <sys/time.h> /* gettimeofday() */
 
 #include <node.h>
 #include <buffer.h>
@@ -32,27 +34,31 @@
 #include <spine_stack.h>
 #include <cycle_detector.h>
 #include <reduction_rule.h>
+#include <parallel.h>
+#include <checkpoint.h>
+#include <trace.h>
+#include <context.h>
+#ifdef INDEX_HEAP
+#include <heap.h>
+#endif
 
 int read_line(void);
-
-extern int multiple_reduction_detection;
-extern int cycle_detection;
-extern int trace_reduction;
-extern int debug_reduction;
-extern int elaborate_output;
-extern int single_step;
-
-extern int max_reduction_count;
-
-extern sigjmp_buf in_reduce_graph;
-
-#define C if(cycle_detection)
-#define D if(debug_reduction)
-#define T if(trace_reduction)
-#define NT if(debug_reduction && !trace_reduction)
+static int deadline_passed(double deadline);
+static void update_census(struct spine_stack *stack, int last);
+static int  redex_census(struct node *root);
+static int  census(struct node *node);
+static void stale_census(struct node *node);
+static void print_redexes(struct node *node, int stack_depth);
+
+/* Each needs a local ctx, the current context */
+#define C if(ctx->cycle_detection)
+#define D if(ctx->debug_reduction)
+#define T if(ctx->trace_reduction)
+#define NT if(ctx->debug_reduction && !ctx->trace_reduction)
+#define R if(ctx->multiple_reduction_detection && ctx->trace_reduction)
 
 /* can't do single_step && read_line() - compilers optimize it away */
-#define SS if (single_step) read_line()
+#define SS if (ctx->single_step) read_line()
 
 
 void
@@ -62,33 +68,382 @@ print_graph(struct node *node, int sn_to_reduce, int current_sn)
 	putc('\n', stdout);
 }
 
+/* What print_graph(node, 0, 0) prints, without the newline,
+ * appended to b.  Batches of expressions from "-j N" get their
+ * input printed after they've been reduced. */
+void
+graph_text(struct node *node, struct buffer *b)
+{
+	switch (node->typ)
+	{
+	case APPLICATION:
+		if (!node->left && !node->right) return;
+
+		graph_text(node->left, b);
+		buffer_append(b, " ", 1);
+
+		if (node->right)
+		{
+			if (APPLICATION == node->right->typ)
+			{
+				buffer_append(b, "(", 1);
+				graph_text(node->right, b);
+				buffer_append(b, ")", 1);
+			} else
+				graph_text(node->right, b);
+		}
+		break;
+	case ATOM:
+		buffer_append(b, node->name, strlen(node->name));
+		break;
+	}
+}
+
+/* Used to decide what to do next:
+ * at an application (interior node of graph)
+ * you can take the left branch into subtree,
+ * take the right branch, or pop the node and
+ * go "up" the tree. */
+enum Direction { DIR_LEFT, DIR_RIGHT, DIR_UP };
+
+/* One interpreter context's reduction, see context.h */
+struct graph_state {
+	/* Where the last reduction stopped short of normal form. */
+	struct spine_stack *stopped_stack;
+	enum Direction stopped_dir;
+	/* Contractions done on it before the latest call picked it up. */
+	unsigned long earlier_contractions;
+
+	int loop_running;
+	volatile sig_atomic_t stop_code;
+
+	int recount_all;  /* node->redexes can't be trusted */
+
+	/* Which node layout reductions ran on, for "timer" and "memstats" */
+	int on_index_heap;
+	unsigned long heap_reductions;
+	unsigned long node_reductions;
+};
+
+static enum graphReductionResult run_reduction(struct node **rootp);
+static enum graphReductionResult reduce_below(
+	struct node *parent,
+	enum Direction dir,
+	unsigned long *contractions,
+	unsigned long *shared_contractions
+);
+static enum graphReductionResult reduction_loop(
+	struct node **rootp,
+	struct spine_stack *stack,
+	enum Direction *dirp,
+	int parallel,
+	unsigned long *contractions,
+	unsigned long *shared_contractions
+);
+
 /* Graph reduction function. Destructively modifies the graph passed in.
+ * With "gc N" in effect, the graph can get copied to new locations,
+ * so *rootp gets updated to point to the dummy root's new copy.
  */
 enum graphReductionResult
-reduce_graph(struct node *root)
+reduce_graph(struct node **rootp)
+{
+	forget_stopped_reduction();
+
+	return run_reduction(rootp);
+}
+
+/* Pick up where the last reduce_graph() or resume_graph() call
+ * stopped, on hitting a count or memory limit, or a signal.
+ * *rootp has to be the same dummy root, and the graph can't
+ * have changed in between.  Without a stopped reduction to go back
+ * to, it starts over at the root: normal order finds the same redex. */
+enum graphReductionResult
+resume_graph(struct node **rootp)
+{
+	return run_reduction(rootp);
+}
+
+struct graph_state *
+new_graph_state(void)
+{
+	return calloc(1, sizeof(struct graph_state));
+}
+
+void
+forget_stopped_reduction(void)
+{
+	struct graph_state *gs = current_context->graph;
+
+	if (gs->stopped_stack)
+		free_spine_stack(gs->stopped_stack);
+	gs->stopped_stack = NULL;
+	gs->earlier_contractions = 0;
+}
+
+/* checkpoint.c writes out and reads back in the spine stack (NULL
+ * when the reduction starts over at the root), the direction the
+ * reduction goes on in, and the contractions done so far. */
+struct spine_stack *
+stopped_reduction(int *dir, unsigned long *contractions)
+{
+	struct graph_state *gs = current_context->graph;
+
+	*dir = gs->stopped_dir;
+	*contractions = gs->earlier_contractions;
+	return gs->stopped_stack;
+}
+
+void
+set_stopped_reduction(struct spine_stack *stack, int dir, unsigned long contractions)
+{
+	struct graph_state *gs = current_context->graph;
+
+	forget_stopped_reduction();
+	gs->stopped_stack = stack;
+	gs->stopped_dir = dir;
+	gs->earlier_contractions = contractions;
+}
+
+/* For the signal handler: while reduction_running() says so,
+ * stop_reduction() has reduction quit at the top of the loop, where
+ * the graph is all in one piece, instead of getting siglongjmp()ed out
+ * of.  reduction_stopped() says how it got stopped: 1 for SIGINT, 2 for
+ * a timeout. */
+int
+reduction_running(void)
+{
+	struct graph_state *gs = current_context->graph;
+
+	return gs->loop_running;
+}
+
+void
+stop_reduction(int code)
+{
+	struct graph_state *gs = current_context->graph;
+
+	gs->stop_code = code;
+}
+
+int
+reduction_stopped(void)
+{
+	struct graph_state *gs = current_context->graph;
+
+	return gs->stop_code;
+}
+
+static enum graphReductionResult
+run_reduction(struct node **rootp)
 {
+	struct acl_context *ctx = current_context;
+	struct graph_state *gs = ctx->graph;
 	enum graphReductionResult r = UNKNOWN;
+	struct node *root = *rootp;
+	struct spine_stack *stack = gs->stopped_stack;
+	enum Direction dir = gs->stopped_dir;
+	int resumed = NULL != stack;
+
+	/* With "-j N", arguments of a head normal form get reduced
+	 * on N threads, unless something needs a single thread. */
+	int parallel = ctx->parallel_jobs > 1
+		&& !(ctx->debug_reduction || ctx->trace_reduction || ctx->cycle_detection
+			|| ctx->single_step || ctx->memory_limit || ctx->gc_threshold
+			|| ctx->max_reduction_count || ctx->lazy_reclamation
+			|| ctx->checkpoint_interval || ctx->reduction_deadline > 0.0);
+
+	ctx->contraction_count = 0;
+	ctx->shared_contraction_count = 0;
+	gs->stop_code = 0;
+	gs->stopped_stack = NULL;
+
+	/* The graph might have been changed with "detect" off */
+	gs->recount_all = 1;
+	T trace_begin();
+
+	if (!stack)
+	{
+#ifdef INDEX_HEAP
+		/* The index-based heap doesn't do any of the intermediate
+		 * output, doesn't keep track of memory use, and doesn't
+		 * collect or defer freeing its own nodes. */
+		if (!(ctx->debug_reduction || ctx->trace_reduction || ctx->cycle_detection || ctx->single_step
+			|| ctx->memory_limit || ctx->gc_threshold || ctx->lazy_reclamation
+			|| parallel || ctx->checkpoint_interval
+			|| ctx->reduction_deadline > 0.0))
+		{
+			gs->on_index_heap = 1;
+			++gs->heap_reductions;
+			r = heap_reduce_graph(root);
+			if (REDUCTION_LIMIT == r || MEMORY_LIMIT == r || INTERRUPT == r)
+				gs->earlier_contractions += ctx->contraction_count;
+			else
+				gs->earlier_contractions = 0;
+			return r;
+		}
+#endif
 
-	struct spine_stack *stack = NULL;
+		stack = new_spine_stack(64);
+		dir = DIR_LEFT;
 
-	unsigned long reduction_counter = 0;
-	int max_redex_count = 0;
+		/* root constitutes the "dummy" root node */
+		root->updateable = root->left_addr;
+		pushnode(stack, root, 1);
+	}
 
-	/* Used to decide what to do next:
-	 * at an application (interior node of graph)
-	 * you can take the left branch into subtree,
-	 * take the right branch, or pop the node and
-	 * go "up" the tree. */
-	enum Direction { DIR_LEFT, DIR_RIGHT, DIR_UP };
-	enum Direction dir = DIR_LEFT;
+	gs->on_index_heap = 0;
+	++gs->node_reductions;
 
-	stack = new_spine_stack(64);
+	D print_graph(root, 0, TOPNODE(stack)->sn);
+
+	/* Single-stepping waits on the terminal, where
+	 * control-C has to get out right away. */
+	gs->loop_running = !ctx->single_step;
+
+	r = reduction_loop(rootp, stack, &dir, parallel,
+		&ctx->contraction_count, &ctx->shared_contraction_count);
+
+	gs->loop_running = 0;
+
+	if (REDUCTION_LIMIT == r || MEMORY_LIMIT == r || INTERRUPT == r
+		|| TIMEOUT == r)
+	{
+		/* resume_graph() goes on from here. new_spine_stack()
+		 * hands out the same stack every time, so keep a copy. */
+		gs->stopped_stack = resumed? stack: copy_spine_stack(stack);
+		gs->stopped_dir = dir;
+		gs->earlier_contractions += ctx->contraction_count;
+	} else
+		gs->earlier_contractions = 0;
+	if (!resumed)
+		delete_spine_stack(stack);
+	else if (stack != gs->stopped_stack)
+		free_spine_stack(stack);
 
-	/* root constitutes the "dummy" root node */
+	C reset_detection();
+	T trace_end();
+
+	return r;
+}
+
+/* Reduce parent->right to normal form, on whatever thread
+ * calls this.  parallel.c hands out arguments this way. */
+enum graphReductionResult
+reduce_argument(
+	struct node *parent,
+	unsigned long *contractions,
+	unsigned long *shared_contractions
+)
+{
+	return reduce_below(parent, DIR_RIGHT, contractions, shared_contractions);
+}
+
+/* Reduce root->left, a whole top-level expression under its dummy
+ * root, on whatever thread calls this.  parallel.c hands out
+ * the expressions of a reduce_graphs() batch this way. */
+enum graphReductionResult
+reduce_expression(
+	struct node *root,
+	unsigned long *contractions,
+	unsigned long *shared_contractions
+)
+{
 	root->updateable = root->left_addr;
-	pushnode(stack, root, 1);
 
-	D print_graph(root, 0, TOPNODE(stack)->sn);
+	return reduce_below(root, DIR_LEFT, contractions, shared_contractions);
+}
+
+static enum graphReductionResult
+reduce_below(
+	struct node *parent,
+	enum Direction dir,
+	unsigned long *contractions,
+	unsigned long *shared_contractions
+)
+{
+	enum graphReductionResult r;
+	struct spine_stack *stack = private_spine_stack(64);
+
+	/* parent acts like the dummy root node */
+	pushnode(stack, parent, 1);
+
+	r = reduction_loop(&parent, stack, &dir, 1,
+		contractions, shared_contractions);
+
+	free_spine_stack(stack);
+
+	return r;
+}
+
+/* Reduce the top-level expressions under dummy roots roots[0]
+ * through roots[n - 1] to normal form, all at once on the "-j N"
+ * threads.  The expressions can't have any nodes in common, other
+ * than flyweight atoms.  results[i] gets roots[i]'s outcome, unless
+ * a signal stopped the batch before roots[i] got started. */
+void
+reduce_graphs(struct node **roots, enum graphReductionResult *results, int n)
+{
+	struct graph_state *gs = current_context->graph;
+
+	forget_stopped_reduction();
+
+	current_context->contraction_count = 0;
+	current_context->shared_contraction_count = 0;
+	gs->stop_code = 0;
+
+	gs->on_index_heap = 0;
+	gs->node_reductions += n;
+
+	gs->loop_running = 1;
+	reduce_expressions(roots, results, n);
+	gs->loop_running = 0;
+}
+
+/* An INDEX_HEAP build reduces on the index heap only when nothing
+ * needs ordinary nodes, see run_reduction().  Say which one the last
+ * reduction used, so that timings from the two can't get mixed up. */
+void
+print_reduction_layout(void)
+{
+#ifdef INDEX_HEAP
+	struct graph_state *gs = current_context->graph;
+
+	printf("reduced on %s\n", gs->on_index_heap? "index heap": "struct nodes");
+#endif
+}
+
+void
+print_reduction_layout_statistics(void)
+{
+#ifdef INDEX_HEAP
+	struct graph_state *gs = current_context->graph;
+
+	printf("%lu reductions on index heap, %lu on struct nodes\n",
+		gs->heap_reductions, gs->node_reductions);
+#endif
+}
+
+/* Normal order reduction of the graph below the node at the
+ * bottom of the stack, *rootp, going in direction *dirp first.
+ * *dirp comes back with the direction to go on in. */
+static enum graphReductionResult
+reduction_loop(
+	struct node **rootp,
+	struct spine_stack *stack,
+	enum Direction *dirp,
+	int parallel,
+	unsigned long *contractions,
+	unsigned long *shared_contractions
+)
+{
+	struct acl_context *ctx = current_context;
+	struct graph_state *gs = ctx->graph;
+	enum graphReductionResult r = UNKNOWN;
+	struct node *root = *rootp;
+	unsigned long reduction_counter = 0;
+	int max_redex_count = 0;
+	enum Direction dir = *dirp;
 
 	while (STACK_NOT_EMPTY(stack))
 	{
@@ -97,9 +452,19 @@ reduce_graph(struct node *root)
 		struct node *topnode = TOPNODE(stack);
 		const char *atom_name = NULL;
 
+		if (gs->stop_code)
+		{
+			r = INTERRUPT;
+			goto exceptional_exit;
+		}
+
 		switch (topnode->typ)
 		{
 		case APPLICATION:
+			/* Contractions below here can give its nodes
+			 * more references: see exclusive_argument() */
+			if (DIR_UP != dir)
+				topnode->exclusive = 0;
 			switch (dir)
 			{
 			case DIR_LEFT:
@@ -138,16 +503,32 @@ reduce_graph(struct node *root)
 
 				pop_stack_cnt = topnode->rule->required_depth + 1;
 
-				perform_reduction(stack);
+				T trace_step(gs->earlier_contractions + *contractions + 1,
+					topnode, stack);
+
+				if (perform_reduction(stack))
+				{
+					++*shared_contractions;
+					/* it wrote over the redex */
+					C update_digests(stack, stack->top - pop_stack_cnt);
+					R update_census(stack, stack->top - pop_stack_cnt);
+				} else {
+					/* it wrote into the redex's parent */
+					C update_digests(stack, stack->top - pop_stack_cnt - 1);
+					R update_census(stack, stack->top - pop_stack_cnt - 1);
+				}
 
 				performed_reduction = 1;
 
-			} else D {
-				printf("%s atom, stack depth %d, required depth %d.\n",
+			} else {
+				D printf("%s atom, stack depth %d, required depth %d.\n",
 					topnode->name,
 				 	DEPTH(stack),
 					topnode->rule? topnode->rule->required_depth + 2: -1
 				);
+				/* head normal form: the arguments remain */
+				if (parallel)
+					reduce_arguments(stack);
 			}
 			if (performed_reduction) SS;
 			break;
@@ -198,40 +579,82 @@ reduce_graph(struct node *root)
 
 		if (performed_reduction)
 		{
+			int redex_count = -1;
+
 			++reduction_counter;
+			++*contractions;
+
+			if (ctx->gc_threshold > 0 && collect_garbage(rootp, stack))
+			{
+				root = *rootp;
+				topnode = TOPNODE(stack);
+			}
 
 			D {
 				printf("%s reduction, after: ", atom_name);
 				print_graph(root->left, 0, topnode->sn);
 			}
 
-			if (multiple_reduction_detection)
+			R {
+				redex_count = redex_census(root->left);  /* root: a dummy node */
+				if (redex_count > max_redex_count) max_redex_count = redex_count;
+			}
+
+			/* "trace every N" and "trace size N" skip some */
+			if (ctx->trace_reduction
+				&& trace_sampled(gs->earlier_contractions + *contractions))
 			{
-				if (trace_reduction)
+				if (tracing_binary())
+					trace_graph(gs->earlier_contractions + *contractions,
+						root->left, redex_count);
+				else if (ctx->multiple_reduction_detection)
 				{
-					struct buffer *b = new_buffer(256);
-					int ignore, redex_count = reduction_count(root->left, 0, &ignore, b);  /* root: a dummy node */
-					if (redex_count > max_redex_count) max_redex_count = redex_count;
-					b->buffer[b->offset] = '\0';
-					printf("[%d] %s\n", redex_count, b->buffer);
-					delete_buffer(b);
-				}
-			} else
-				T print_graph(root->left, 0, 0);
+					printf("[%d] ", redex_count);
+					print_redexes(root->left, 0);
+					putc('\n', stdout);
+				} else
+					print_graph(root->left, 0, 0);
+			}
 
-			if (cycle_detection && cycle_detector(root, max_redex_count))
+			if (ctx->cycle_detection && cycle_detector(root, max_redex_count))
 			{
 				r = CYCLE_DETECTED;
 				goto exceptional_exit;
 			}
 
-			if (max_reduction_count > 0
-				&& reduction_counter > max_reduction_count)
+			if (ctx->max_reduction_count > 0
+				&& reduction_counter > ctx->max_reduction_count)
 			{
 				C reset_detection();
 				r = REDUCTION_LIMIT;
 				goto exceptional_exit;
 			}
+
+			if (ctx->memory_limit > 0 && memory_limit_reached())
+			{
+				C reset_detection();
+				r = MEMORY_LIMIT;
+				goto exceptional_exit;
+			}
+
+			/* A time limit without alarm(): libacl.c sets the
+			 * deadline, and looking at the clock every so often
+			 * doesn't cost much. */
+			if (ctx->reduction_deadline > 0.0
+				&& 0 == (reduction_counter & 1023)
+				&& deadline_passed(ctx->reduction_deadline))
+			{
+				C reset_detection();
+				r = TIMEOUT;
+				goto exceptional_exit;
+			}
+
+			/* Only the top-level loop runs with checkpoints on,
+			 * see run_reduction() */
+			if (ctx->checkpoint_interval > 0
+				&& 0 == (gs->earlier_contractions + *contractions) % ctx->checkpoint_interval)
+				auto_checkpoint(root, stack, dir,
+					gs->earlier_contractions + *contractions);
 		}
 	}
 
@@ -240,9 +663,7 @@ reduce_graph(struct node *root)
 	/* reaching reduction limit or finding a cycle */
 	exceptional_exit:
 
-	delete_spine_stack(stack);
-
-	C reset_detection();
+	*dirp = dir;
 
 	return r;
 }
@@ -252,6 +673,7 @@ reduce_graph(struct node *root)
 int
 read_line(void)
 {
+	struct acl_context *ctx = current_context;
 	char buf[64];
 	*buf = 'A';
 	do {
@@ -265,10 +687,10 @@ read_line(void)
 			break;
 		case 'n': case 'q':
 			C reset_detection();
-			siglongjmp(in_reduce_graph, 3);
+			siglongjmp(ctx->in_reduce_graph, 3);
 			break;
 		case 'c':
-			single_step = 0;
+			ctx->single_step = 0;
 			break;
 		case '?':
 			fprintf(stderr,
@@ -281,7 +703,7 @@ read_line(void)
 			break;
 		}
 	} while ('?' == *buf);
-	return single_step;
+	return ctx->single_step;
 }
 
 int
@@ -331,6 +753,133 @@ reduction_count(struct node *node, int stack_depth, int *child_redex, struct buf
 	return reductions;
 }
 
+/* "detect on" with "trace on" prints the count of redexes after
+ * every contraction.  Counting them all every time would make a
+ * traced reduction take time quadratic in its length, so each
+ * application node keeps the count for its subtree, node->redexes,
+ * and how many more arguments its head needs to make a redex,
+ * node->args_wanted.  Both depend only on the subtree, so as with
+ * digests in cycle_detector.c, a contraction changes them only on
+ * the spine from the node it wrote into up to the root, and in the
+ * new nodes it built, which start out with none.  A spine node with
+ * another parent means the whole graph gets counted over.  Atoms
+ * have no count of their own: a rule can show up after the atom. */
+#define NO_CENSUS    -1
+#define STALE_CENSUS -2
+
+static void
+update_census(struct spine_stack *stack, int last)
+{
+	struct graph_state *gs = current_context->graph;
+	int j;
+
+	for (j = last; j > 0 && !gs->recount_all; --j)
+	{
+		struct node *n = stack->stack[j].node;
+
+		if (n->refcnt > 1)
+			gs->recount_all = 1;  /* a parent off the spine changed too */
+		else
+			n->redexes = NO_CENSUS;
+	}
+}
+
+/* Same number reduction_count(root, 0, ...) returns */
+static int
+redex_census(struct node *root)
+{
+	struct graph_state *gs = current_context->graph;
+
+	if (gs->recount_all)
+	{
+		stale_census(root);
+		gs->recount_all = 0;
+	}
+
+	return census(root);
+}
+
+static int
+census(struct node *node)
+{
+	int wanted = 0;
+
+	if (!node)
+		return 0;
+
+	if (ATOM == node->typ)
+		return node->rule && 0 == node->rule->required_depth;
+
+	if (node->redexes >= 0)
+		return node->redexes;
+
+	node->redexes = census(node->left) + census(node->right);
+
+	if (node->left)
+	{
+		if (ATOM == node->left->typ)
+			wanted = node->left->rule? node->left->rule->required_depth: 0;
+		else
+			wanted = node->left->args_wanted;
+	}
+
+	if (1 == wanted)
+		++node->redexes;  /* the last argument its head needed */
+	node->args_wanted = wanted > 1? wanted - 1: 0;
+
+	return node->redexes;
+}
+
+/* Marks every count reachable from node stale, permanent nodes
+ * included: rules can change between reductions.  Each node gets
+ * visited once, however many parents it has. */
+static void
+stale_census(struct node *node)
+{
+	while (node && APPLICATION == node->typ && STALE_CENSUS != node->redexes)
+	{
+		node->redexes = STALE_CENSUS;
+		stale_census(node->right);
+		node = node->left;
+	}
+}
+
+/* What reduction_count() puts in its buffer, straight to stdout */
+static void
+print_redexes(struct node *node, int stack_depth)
+{
+	struct node *right;
+
+	switch (node->typ)
+	{
+	case APPLICATION:
+		if (!node->left && !node->right) return;
+
+		print_redexes(node->left, stack_depth + 1);
+		if (ATOM == node->left->typ && node->left->rule
+			&& stack_depth + 1 >= node->left->rule->required_depth)
+			putc('*', stdout);
+
+		putc(' ', stdout);
+
+		right = node->right;
+		if (APPLICATION == right->typ)
+		{
+			putc('(', stdout);
+			print_redexes(right, 0);
+			putc(')', stdout);
+		} else {
+			print_redexes(right, 0);
+			if (right->rule && 0 >= right->rule->required_depth)
+				putc('*', stdout);
+		}
+		break;
+	case ATOM:
+		fputs(node->name, stdout);
+		break;
+	}
+}
+
 /* when total_count evaluates to true (non-zero),
  * this counts interior and leaf nodes.  Otherwise,
  * it just counts leaf nodes.
@@ -365,6 +914,9 @@ equivalent_graphs(struct node *g1, struct node *g2)
 {
 	int r = 0;
 
+	if (g1 == g2)  /* always true for identical expressions under "share on" */
+		return 1;
+
 	if (g1->typ == g2->typ)
 	{
 		switch (g1->typ)
@@ -383,3 +935,13 @@ equivalent_graphs(struct node *g1, struct node *g2)
 
 	return r;
 }
+
+static int
+deadline_passed(double deadline)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (double)now.tv_sec + 1.0E-6*(double)now.tv_usec >= deadline;
+}
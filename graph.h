@@ -20,12 +20,26 @@
 */
 /* $Id: graph.h,v 1.4 2011/06/12 18:19:11 bediger Exp $ */
 
-enum graphReductionResult { UNKNOWN, NORMAL_FORM, CYCLE_DETECTED, INTERRUPT, REDUCTION_LIMIT, TIMEOUT };
-
-enum graphReductionResult reduce_graph(struct node *graph_root);
+enum graphReductionResult { UNKNOWN, NORMAL_FORM, CYCLE_DETECTED, INTERRUPT, REDUCTION_LIMIT, TIMEOUT, MEMORY_LIMIT };
+
+enum graphReductionResult reduce_graph(struct node **graph_root);
+enum graphReductionResult resume_graph(struct node **graph_root);
+struct graph_state;
+struct graph_state *new_graph_state(void);
+void forget_stopped_reduction(void);
+struct spine_stack *stopped_reduction(int *dir, unsigned long *contractions);
+void set_stopped_reduction(struct spine_stack *stack, int dir, unsigned long contractions);
+int  reduction_running(void);
+void stop_reduction(int code);
+int  reduction_stopped(void);
 int  reduction_count(struct node *node, int stack_depth, int *child_reduces, struct buffer *b);
 int  node_count(struct node *node, int count_interior_nodes);
 
+void reduce_graphs(struct node **roots, enum graphReductionResult *results, int n);
+void print_reduction_layout(void);
+void print_reduction_layout_statistics(void);
+
 void print_graph(struct node *node, int node_sn_reducing, int current_node_sn);
+void graph_text(struct node *node, struct buffer *b);
 int  equivalent_graphs(struct node *graph1, struct node *graph2);
 
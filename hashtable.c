@@ -112,6 +112,10 @@ init_hashtable(int buckets, int maxload)
 	h->node_cnt = 0;
 	h->rehash_cnt = 0;
 
+	h->ids = NULL;
+	h->id_cnt = 0;
+	h->id_allocated = 0;
+
 	return h;
 }
 
@@ -232,8 +236,18 @@ add_string(struct hashtable *h, const char *string)
 	n->string_length = strlen(string);
 	n->string = malloc(n->string_length+1);
 	n->data = NULL;
+	n->rule = NULL;
 	memcpy(n->string, string, n->string_length+1);
 
+	/* atom ID 0 means "no such string" */
+	if (h->id_cnt + 1 >= h->id_allocated)
+	{
+		h->id_allocated = h->id_allocated? 2*h->id_allocated: 64;
+		h->ids = realloc(h->ids, h->id_allocated*sizeof(h->ids[0]));
+	}
+	n->id = ++h->id_cnt;
+	h->ids[n->id] = n;
+
 	/* add newly allocated node to appropriate chain */
 	head = h->buckets[bucket_index];
 
@@ -293,6 +307,8 @@ void free_hashtable(struct hashtable *h)
 	free(h->sentinels);
 	h->buckets = NULL;
 	h->sentinels = NULL;
+	free(h->ids);
+	h->ids = NULL;
 
 	free(h);
 	h = NULL;
@@ -346,6 +362,12 @@ node_lookup(struct hashtable *h, const char *string_to_lookup, unsigned int *rhv
 	return r;
 }
 
+struct hashnode *
+id_lookup(struct hashtable *h, int id)
+{
+	return (id > 0 && id <= h->id_cnt)? h->ids[id]: NULL;
+}
+
 unsigned int
 hash_djb2(const char *str)
 {
@@ -387,3 +409,24 @@ msbbit(long i)
 
 	return(sparsebit(i));
 }
+
+void
+print_hashtable_statistics(struct hashtable *h)
+{
+	int i, longest = 0, empty = 0;
+
+	for (i = 0; i < h->currentsize; ++i)
+	{
+		struct hashnode *n;
+		int len = 0;
+
+		for (n = h->buckets[i]->next; n != h->sentinels[i]; n = n->next)
+			++len;
+
+		if (len > longest) longest = len;
+		if (0 == len) ++empty;
+	}
+
+	printf("hash table: %d entries, %d chains, %d empty, longest %d, %d rehashes\n",
+		h->node_cnt, h->currentsize, empty, longest, h->rehash_cnt);
+}
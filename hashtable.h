@@ -27,6 +27,8 @@ struct hashnode {
 	char *string;
 	size_t string_length;
 	void *data;
+	int id;                        /* atom ID: 1, 2, 3... in order added */
+	struct reduction_rule *rule;   /* primitive named by the string */
 };
 
 /* array of hash chains consists of the "head" nodes in the chains.
@@ -48,6 +50,10 @@ struct hashtable {
 	
 	struct hashnode **buckets;    /* array of hash chains */
 	struct hashnode **sentinels;  /* array of hash chains */
+
+	struct hashnode **ids;        /* ids[n] has atom ID n */
+	int id_cnt;
+	int id_allocated;
 };
 
 /* number of buckets has to be a power of 2 for this to work */
@@ -59,6 +65,8 @@ void *data_lookup(struct hashtable *h, const char *key_string);
 struct hashnode *node_lookup(
 	struct hashtable *h, const char *string_to_lookup, unsigned int *hashval
 );
+struct hashnode *id_lookup(struct hashtable *h, int id);
 
 struct hashtable *init_hashtable(int initial_buckets, int maxload);
 void free_hashtable(struct hashtable *h);
+void print_hashtable_statistics(struct hashtable *h);
@@ -0,0 +1,785 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Alternate graph reduction on an index-based node heap.
+ *
+ * A struct node costs about 80 bytes on a 64-bit machine, most of
+ * it pointers that graph reduction only needs for convenience.  This
+ * module keeps nodes as 32-bit indexes into parallel arrays (tag, left,
+ * right, reference count), so that an application node costs 13 bytes,
+ * and the arrays that reduction walks stay densely packed.  ATOM nodes
+ * keep an "atom ID" in their left-child slot.  The atom ID indexes
+ * arrays holding the atom's name and its reduction rule.
+ *
+ * Compiling with -DINDEX_HEAP makes reduce_graph() in graph.c convert
+ * its input to this representation, reduce it here, and convert the
+ * normal form back to structs node.  Without that compile-time switch,
+ * this code doesn't get used, so the two layouts can get benchmarked
+ * against each other by building acl both ways.
+ *
+ * Only reduction happens on the heap.  Parsing, abbreviations, rules,
+ * abstraction and printing all work on structs node, so an expression
+ * comes in by import_graph() and its normal form goes back out by
+ * export_graph().  Everything that looks at a graph in the middle of
+ * a reduction does it in terms of structs node, so run_reduction()
+ * reduces on structs node instead whenever debug, trace, cycles,
+ * step, memory, gc, lazy, checkpoints, -j or a libacl deadline are
+ * on.  grammar.y tells the user when gc or lazy turns the heap off.
+ *
+ * Since the heap doesn't have an "updateable" field per node, the
+ * heap's spine stack elements remember which child of a node got
+ * pushed on the stack.
+ *
+ * Freeing, importing and exporting graphs use explicit stacks rather
+ * than recursion: a long spine would overflow the C stack.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>  /* malloc(), realloc(), calloc(), free() */
+#include <string.h>  /* memset() */
+#include <setjmp.h>
+
+#include <node.h>
+#include <buffer.h>
+#include <graph.h>
+#include <spine_stack.h>
+#include <reduction_rule.h>
+#include <heap.h>
+#include <context.h>
+
+/* Spine stack for heap_reduce_graph().  The slot element tells
+ * which child of the node reduction descended into. */
+enum heapSlot { SLOT_NONE, SLOT_LEFT, SLOT_RIGHT };
+
+struct heap_stack_elem {
+	hnode node;
+	int   depth;
+	enum heapSlot slot;
+};
+
+struct import_frame {
+	struct node *node;
+	hnode left;
+	int state;
+};
+
+struct export_frame {
+	hnode node;
+	struct node *left;
+	int state;
+};
+
+/* One interpreter context's index heap, see context.h */
+struct heap_state {
+	struct node_heap *heap;
+
+	/* Atom IDs: one per (name, rule) pair, index 0 unused. */
+	const char **atom_names;
+	struct reduction_rule **atom_rules;
+	unsigned int atom_count;
+	unsigned int atom_size;
+
+	/* Open-addressed hash of atom IDs, keyed on (name, rule) pointers */
+	unsigned int *atom_hash;
+	unsigned int atom_hash_size;
+
+	struct heap_stack_elem *hstack;
+	int hstack_top;
+	int hstack_size;
+
+	/* Register file for compiled reduction rules */
+	hnode *hregisters;
+	int hregister_count;
+
+	/* Explicit stacks for heap_free_node(), import_graph()
+	 * and export_graph().  The state element says which child
+	 * gets converted next: 0 left, 1 right, 2 neither. */
+	hnode *hfree_stack;
+	int hfree_stack_size;
+	struct import_frame *import_stack;
+	int import_stack_size;
+	struct export_frame *export_stack;
+	int export_stack_size;
+
+	/* Multiply-referenced structs node already imported, open addressing. */
+	struct node **import_keys;
+	hnode *import_vals;
+	unsigned int import_map_size;
+	unsigned int import_map_count;
+};
+
+#define HTOP      (hs->hstack[hs->hstack_top - 1])
+#define HPARENT(N) (hs->hstack[hs->hstack_top - 1 - (N)])
+
+static void  grow_heap(struct node_heap *h);
+static hnode new_heap_node(struct node_heap *h);
+static void  heap_push(hnode n, int mark);
+static unsigned int atom_hash_value(const char *name, struct reduction_rule *rule);
+static hnode heap_reduce_rule(struct node_heap *h, struct reduction_rule *rule);
+static void  heap_perform_reduction(struct node_heap *h);
+static hnode *import_slot(struct node *n, int *found);
+static hnode import_graph(struct node_heap *h, struct node *n);
+static struct node *export_graph(struct node_heap *h, hnode n, struct node **map);
+
+struct heap_state *
+new_heap_state(void)
+{
+	return calloc(1, sizeof(struct heap_state));
+}
+
+struct node_heap *
+get_node_heap(void)
+{
+	struct heap_state *hs = current_context->heap;
+
+	if (!hs->heap)
+	{
+		hs->heap = malloc(sizeof(*hs->heap));
+		hs->heap->tag = NULL;
+		hs->heap->left = hs->heap->right = NULL;
+		hs->heap->refcnt = NULL;
+		hs->heap->size = 0;
+		hs->heap->used = 0;
+		hs->heap->free_list = 0;
+		grow_heap(hs->heap);
+	}
+
+	return hs->heap;
+}
+
+/* Everything in the heap becomes unallocated, but
+ * the arrays stay around for the next reduction. */
+void
+reset_node_heap(struct node_heap *h)
+{
+	h->used = 1;   /* index 0 means "no node" */
+	h->free_list = 0;
+}
+
+void
+free_node_heap(void)
+{
+	struct heap_state *hs = current_context->heap;
+
+	if (hs->heap)
+	{
+		free(hs->heap->tag);
+		free(hs->heap->left);
+		free(hs->heap->right);
+		free(hs->heap->refcnt);
+		free(hs->heap);
+		hs->heap = NULL;
+	}
+	free(hs->hstack);
+	hs->hstack = NULL;
+	hs->hstack_size = hs->hstack_top = 0;
+	free(hs->hregisters);
+	hs->hregisters = NULL;
+	hs->hregister_count = 0;
+	free(hs->hfree_stack);
+	hs->hfree_stack = NULL;
+	hs->hfree_stack_size = 0;
+	free(hs->import_stack);
+	hs->import_stack = NULL;
+	hs->import_stack_size = 0;
+	free(hs->export_stack);
+	hs->export_stack = NULL;
+	hs->export_stack_size = 0;
+	free(hs->atom_names);
+	free(hs->atom_rules);
+	free(hs->atom_hash);
+	hs->atom_names = NULL;
+	hs->atom_rules = NULL;
+	hs->atom_hash = NULL;
+	hs->atom_count = hs->atom_size = hs->atom_hash_size = 0;
+}
+
+static void
+grow_heap(struct node_heap *h)
+{
+	unsigned int new_size = h->size? 2*h->size: 1024;
+
+	h->tag = realloc(h->tag, new_size*sizeof(h->tag[0]));
+	h->left = realloc(h->left, new_size*sizeof(h->left[0]));
+	h->right = realloc(h->right, new_size*sizeof(h->right[0]));
+	h->refcnt = realloc(h->refcnt, new_size*sizeof(h->refcnt[0]));
+
+	if (0 == h->size)
+	{
+		h->used = 1;
+		h->tag[0] = HEAP_FREE;
+		h->left[0] = h->right[0] = 0;
+		h->refcnt[0] = 0;
+	}
+
+	h->size = new_size;
+}
+
+static hnode
+new_heap_node(struct node_heap *h)
+{
+	hnode r;
+
+	if (h->free_list)
+	{
+		r = h->free_list;
+		h->free_list = h->right[r];
+	} else {
+		if (h->used >= h->size)
+			grow_heap(h);
+		r = h->used++;
+	}
+
+	h->left[r] = h->right[r] = 0;
+	h->refcnt[r] = 0;
+
+	return r;
+}
+
+hnode
+heap_new_application(struct node_heap *h, hnode left, hnode right)
+{
+	hnode r = new_heap_node(h);
+
+	h->tag[r] = HEAP_APPLICATION;
+	h->left[r] = left;
+	h->right[r] = right;
+
+	if (left)
+		++h->refcnt[left];
+	if (right)
+		++h->refcnt[right];
+
+	return r;
+}
+
+hnode
+heap_new_term(struct node_heap *h, unsigned int atom_id)
+{
+	hnode r = new_heap_node(h);
+
+	h->tag[r] = HEAP_ATOM;
+	h->left[r] = atom_id;
+
+	return r;
+}
+
+void
+heap_free_node(struct node_heap *h, hnode n)
+{
+	struct heap_state *hs = current_context->heap;
+	int top = 0;
+
+	if (0 == n) return;
+
+	if (0 == hs->hfree_stack_size)
+	{
+		hs->hfree_stack_size = 64;
+		hs->hfree_stack = malloc(hs->hfree_stack_size*sizeof(hs->hfree_stack[0]));
+	}
+
+	hs->hfree_stack[top++] = n;
+
+	while (top > 0)
+	{
+		n = hs->hfree_stack[--top];
+
+		if (0 == n || 0 != --h->refcnt[n])
+			continue;
+
+		if (HEAP_APPLICATION == h->tag[n])
+		{
+			if (top + 2 > hs->hfree_stack_size)
+			{
+				hs->hfree_stack_size *= 2;
+				hs->hfree_stack = realloc(hs->hfree_stack, hs->hfree_stack_size*sizeof(hs->hfree_stack[0]));
+			}
+			/* left child comes off the stack first */
+			hs->hfree_stack[top++] = h->right[n];
+			hs->hfree_stack[top++] = h->left[n];
+		}
+		h->tag[n] = HEAP_FREE;
+		h->right[n] = h->free_list;
+		h->free_list = n;
+	}
+}
+
+static unsigned int
+atom_hash_value(const char *name, struct reduction_rule *rule)
+{
+	unsigned long v = (unsigned long)name ^ ((unsigned long)rule >> 3);
+
+	v ^= v >> 17;
+	v *= 0x9E3779B1UL;
+
+	return (unsigned int)(v ^ (v >> 15));
+}
+
+/* Atom IDs live as long as the interpreter does, so
+ * any heap built during any reduction can use them. */
+unsigned int
+heap_atom_id(const char *name, struct reduction_rule *rule)
+{
+	struct heap_state *hs = current_context->heap;
+	unsigned int idx;
+
+	if (2*(hs->atom_count + 1) >= hs->atom_hash_size)
+	{
+		unsigned int i, new_size = hs->atom_hash_size? 2*hs->atom_hash_size: 256;
+
+		free(hs->atom_hash);
+		hs->atom_hash = calloc(new_size, sizeof(hs->atom_hash[0]));
+		hs->atom_hash_size = new_size;
+
+		for (i = 1; i <= hs->atom_count; ++i)
+		{
+			idx = atom_hash_value(hs->atom_names[i], hs->atom_rules[i]) & (hs->atom_hash_size - 1);
+			while (hs->atom_hash[idx])
+				idx = (idx + 1) & (hs->atom_hash_size - 1);
+			hs->atom_hash[idx] = i;
+		}
+	}
+
+	idx = atom_hash_value(name, rule) & (hs->atom_hash_size - 1);
+
+	while (hs->atom_hash[idx])
+	{
+		unsigned int id = hs->atom_hash[idx];
+		if (hs->atom_names[id] == name && hs->atom_rules[id] == rule)
+			return id;
+		idx = (idx + 1) & (hs->atom_hash_size - 1);
+	}
+
+	if (hs->atom_count + 1 >= hs->atom_size)
+	{
+		hs->atom_size = hs->atom_size? 2*hs->atom_size: 64;
+		hs->atom_names = realloc(hs->atom_names, hs->atom_size*sizeof(hs->atom_names[0]));
+		hs->atom_rules = realloc(hs->atom_rules, hs->atom_size*sizeof(hs->atom_rules[0]));
+	}
+
+	++hs->atom_count;
+	hs->atom_names[hs->atom_count] = name;
+	hs->atom_rules[hs->atom_count] = rule;
+	hs->atom_hash[idx] = hs->atom_count;
+
+	return hs->atom_count;
+}
+
+static void
+heap_push(hnode n, int mark)
+{
+	struct heap_state *hs = current_context->heap;
+
+	if (hs->hstack_top >= hs->hstack_size)
+	{
+		hs->hstack_size = hs->hstack_size? 2*hs->hstack_size: 64;
+		hs->hstack = realloc(hs->hstack, hs->hstack_size*sizeof(hs->hstack[0]));
+	}
+
+	hs->hstack[hs->hstack_top].node = n;
+	hs->hstack[hs->hstack_top].depth = mark? mark: hs->hstack[hs->hstack_top - 1].depth + 1;
+	hs->hstack[hs->hstack_top].slot = SLOT_NONE;
+	++hs->hstack_top;
+}
+
+/* Runs the rule's compiled code, same as perform_reduction()
+ * in reduction_rule.c, except on the heap. */
+static hnode
+heap_reduce_rule(struct node_heap *h, struct reduction_rule *rule)
+{
+	struct heap_state *hs = current_context->heap;
+	int i;
+
+	if (hs->hregister_count < rule_register_count())
+	{
+		hs->hregister_count = rule_register_count();
+		hs->hregisters = realloc(hs->hregisters, hs->hregister_count*sizeof(hs->hregisters[0]));
+	}
+
+	for (i = 1; i <= rule->required_depth; ++i)
+		hs->hregisters[i] = h->right[HPARENT(i).node];
+	for (i = 0; i < rule->code_length; ++i)
+		hs->hregisters[rule->required_depth + 1 + i] = heap_new_application(h,
+			hs->hregisters[rule->code[i].func], hs->hregisters[rule->code[i].arg]);
+
+	return hs->hregisters[rule->result_register];
+}
+
+/* Assumes that the top-of-stack node is the atomic primitive
+ * to be reduced, just like perform_reduction(). */
+static void
+heap_perform_reduction(struct node_heap *h)
+{
+	struct heap_state *hs = current_context->heap;
+	struct reduction_rule *rule = hs->atom_rules[h->left[HTOP.node]];
+	hnode redex = HPARENT(rule->required_depth).node;
+	hnode parent = HPARENT(rule->required_depth + 1).node;
+	hnode n = heap_reduce_rule(h, rule);
+
+	/* A shared redex becomes a copy of its result's root,
+	 * as in perform_reduction(). */
+	if (h->refcnt[redex] > 1)
+	{
+		hnode old_left = h->left[redex], old_right = h->right[redex];
+
+		h->tag[redex] = h->tag[n];
+		h->left[redex] = h->left[n];
+		h->right[redex] = h->right[n];
+		if (HEAP_APPLICATION == h->tag[n])
+		{
+			++h->refcnt[h->left[n]];
+			++h->refcnt[h->right[n]];
+		}
+		++h->refcnt[n];
+		heap_free_node(h, n);
+		heap_free_node(h, old_left);
+		heap_free_node(h, old_right);
+		++current_context->shared_contraction_count;
+		return;
+	}
+
+	if (SLOT_LEFT == HPARENT(rule->required_depth + 1).slot)
+		h->left[parent] = n;
+	else
+		h->right[parent] = n;
+	++h->refcnt[n];
+	heap_free_node(h, redex);
+}
+
+/* Find the slot in the import map for struct node n.
+ * *found says whether n got imported already. */
+static hnode *
+import_slot(struct node *n, int *found)
+{
+	struct heap_state *hs = current_context->heap;
+	unsigned int idx;
+
+	if (2*(hs->import_map_count + 1) > hs->import_map_size)
+	{
+		struct node **old_keys = hs->import_keys;
+		hnode *old_vals = hs->import_vals;
+		unsigned int i, old_size = hs->import_map_size;
+
+		hs->import_map_size = old_size? 2*old_size: 64;
+		hs->import_keys = calloc(hs->import_map_size, sizeof(hs->import_keys[0]));
+		hs->import_vals = malloc(hs->import_map_size*sizeof(hs->import_vals[0]));
+		hs->import_map_count = 0;
+
+		for (i = 0; i < old_size; ++i)
+		{
+			if (old_keys[i])
+			{
+				int ignore;
+				*import_slot(old_keys[i], &ignore) = old_vals[i];
+			}
+		}
+
+		free(old_keys);
+		free(old_vals);
+	}
+
+	idx = ((unsigned long)n >> 4) & (hs->import_map_size - 1);
+	while (hs->import_keys[idx])
+	{
+		if (hs->import_keys[idx] == n)
+		{
+			*found = 1;
+			return &hs->import_vals[idx];
+		}
+		idx = (idx + 1) & (hs->import_map_size - 1);
+	}
+
+	*found = 0;
+	hs->import_keys[idx] = n;
+	++hs->import_map_count;
+
+	return &hs->import_vals[idx];
+}
+
+static hnode
+import_graph(struct node_heap *h, struct node *n)
+{
+	struct heap_state *hs = current_context->heap;
+	int top = 0;
+	hnode r = 0;
+
+	hs->import_map_size = hs->import_map_count = 0;
+	hs->import_keys = NULL;
+	hs->import_vals = NULL;
+
+	if (0 == hs->import_stack_size)
+	{
+		hs->import_stack_size = 64;
+		hs->import_stack = malloc(hs->import_stack_size*sizeof(hs->import_stack[0]));
+	}
+
+	hs->import_stack[top].node = n;
+	hs->import_stack[top].state = 0;
+	++top;
+
+	/* r holds the most recently imported node, on its
+	 * way to the frame for its parent. */
+	while (top > 0)
+	{
+		struct import_frame *f = &hs->import_stack[top - 1];
+		struct node *child = NULL;
+		int found = 0;
+		hnode *slot = NULL;
+
+		n = f->node;
+
+		switch (f->state)
+		{
+		case 0:
+			/* Only multiply-referenced nodes need remembering
+			 * to keep the imported graph's sharing intact. */
+			if (n->refcnt > 1)
+			{
+				slot = import_slot(n, &found);
+				if (found)
+				{
+					r = *slot;
+					--top;
+					continue;
+				}
+			}
+			if (APPLICATION == n->typ)
+			{
+				/* slot gets filled in at state 2 */
+				slot = NULL;
+				f->state = 1;
+				child = n->left;
+			} else {
+				r = heap_new_term(h, heap_atom_id(n->name, n->rule));
+				--top;
+			}
+			break;
+		case 1:
+			f->left = r;
+			f->state = 2;
+			child = n->right;
+			break;
+		case 2:
+			r = heap_new_application(h, f->left, r);
+			--top;
+			if (n->refcnt > 1)
+				slot = import_slot(n, &found);
+			break;
+		}
+
+		/* A new atom, or a finished application. */
+		if (slot)
+			*slot = r;
+
+		if (child)
+		{
+			if (top >= hs->import_stack_size)
+			{
+				hs->import_stack_size *= 2;
+				hs->import_stack = realloc(hs->import_stack, hs->import_stack_size*sizeof(hs->import_stack[0]));
+			}
+			hs->import_stack[top].node = child;
+			hs->import_stack[top].state = 0;
+			++top;
+		}
+	}
+
+	free(hs->import_keys);
+	free(hs->import_vals);
+	hs->import_keys = NULL;
+	hs->import_vals = NULL;
+
+	return r;
+}
+
+static struct node *
+export_graph(struct node_heap *h, hnode n, struct node **map)
+{
+	struct heap_state *hs = current_context->heap;
+	int top = 0;
+	struct node *r = NULL;
+
+	if (0 == hs->export_stack_size)
+	{
+		hs->export_stack_size = 64;
+		hs->export_stack = malloc(hs->export_stack_size*sizeof(hs->export_stack[0]));
+	}
+
+	hs->export_stack[top].node = n;
+	hs->export_stack[top].state = 0;
+	++top;
+
+	while (top > 0)
+	{
+		struct export_frame *f = &hs->export_stack[top - 1];
+		hnode child = 0;
+
+		n = f->node;
+
+		switch (f->state)
+		{
+		case 0:
+			if (map[n])
+			{
+				r = map[n];
+				--top;
+				continue;
+			}
+			if (HEAP_APPLICATION == h->tag[n])
+			{
+				f->state = 1;
+				child = h->left[n];
+			} else {
+				r = new_term(hs->atom_names[h->left[n]], hs->atom_rules[h->left[n]]);
+				--top;
+				if (h->refcnt[n] > 1)
+					map[n] = r;
+			}
+			break;
+		case 1:
+			f->left = r;
+			f->state = 2;
+			child = h->right[n];
+			break;
+		case 2:
+			r = new_application(f->left, r);
+			--top;
+			if (h->refcnt[n] > 1)
+				map[n] = r;
+			break;
+		}
+
+		if (child)
+		{
+			if (top >= hs->export_stack_size)
+			{
+				hs->export_stack_size *= 2;
+				hs->export_stack = realloc(hs->export_stack, hs->export_stack_size*sizeof(hs->export_stack[0]));
+			}
+			hs->export_stack[top].node = child;
+			hs->export_stack[top].state = 0;
+			++top;
+		}
+	}
+
+	return r;
+}
+
+/* Graph reduction on the heap.  Converts the graph hanging off
+ * the dummy root node's left child into heap nodes, reduces that
+ * with exactly the same traversal as reduce_graph() in graph.c,
+ * then replaces the dummy root's left child with the result.
+ * Doesn't do tracing, debugging output or cycle detection:
+ * reduce_graph() only calls this when those are turned off.
+ */
+enum graphReductionResult
+heap_reduce_graph(struct node *root)
+{
+	struct heap_state *hs = current_context->heap;
+	enum graphReductionResult r = UNKNOWN;
+	struct node_heap *h = get_node_heap();
+	unsigned long reduction_counter = 0;
+	enum Direction { DIR_LEFT, DIR_RIGHT, DIR_UP };
+	enum Direction dir = DIR_LEFT;
+	struct node **map;
+	struct node *result;
+	hnode hroot;
+
+	reset_node_heap(h);
+
+	hroot = heap_new_application(h, import_graph(h, root->left), 0);
+	++h->refcnt[hroot];
+
+	hs->hstack_top = 0;
+	heap_push(hroot, 1);
+
+	while (hs->hstack_top > 0)
+	{
+		int pop_stack_cnt = 1;
+		int performed_reduction = 0;
+		hnode topnode = HTOP.node;
+
+		if (HEAP_APPLICATION == h->tag[topnode])
+		{
+			switch (dir)
+			{
+			case DIR_LEFT:
+				HTOP.slot = SLOT_LEFT;
+				heap_push(h->left[topnode], 0);
+				pop_stack_cnt = 0;
+				break;
+			case DIR_RIGHT:
+				HTOP.slot = SLOT_RIGHT;
+				heap_push(h->right[topnode], 2);
+				pop_stack_cnt = 0;
+				break;
+			case DIR_UP:
+				break;
+			}
+		} else {
+			struct reduction_rule *rule = hs->atom_rules[h->left[topnode]];
+
+			if (rule && HTOP.depth >= (rule->required_depth + 2))
+			{
+				pop_stack_cnt = rule->required_depth + 1;
+				heap_perform_reduction(h);
+				performed_reduction = 1;
+			}
+		}
+
+		hs->hstack_top -= pop_stack_cnt;
+
+		if (performed_reduction)
+		{
+			dir = (SLOT_LEFT == HTOP.slot)? DIR_LEFT: DIR_RIGHT;
+
+			++reduction_counter;
+			++current_context->contraction_count;
+			if (current_context->max_reduction_count > 0
+				&& reduction_counter > current_context->max_reduction_count)
+			{
+				r = REDUCTION_LIMIT;
+				break;
+			}
+		} else if (pop_stack_cnt) {
+			dir = DIR_UP;
+			if (HTOP.node == hroot)
+				hs->hstack_top = 0;
+			else if (SLOT_LEFT == HTOP.slot)
+				dir = DIR_RIGHT;
+		} else
+			dir = DIR_LEFT;
+	}
+
+	if (UNKNOWN == r)
+		r = NORMAL_FORM;
+
+	map = calloc(h->used, sizeof(map[0]));
+	result = export_graph(h, h->left[hroot], map);
+	free(map);
+
+	free_node(root->left);
+	root->left = result;
+	++result->refcnt;
+
+	return r;
+}
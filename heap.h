@@ -0,0 +1,61 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Index-based, "struct of arrays" node heap.  A node is a 32-bit
+ * index into parallel arrays of tags, left children, right children
+ * and reference counts.  ATOM nodes keep an atom ID in the left array,
+ * and the atom ID indexes arrays of names and reduction rules.
+ * Index 0 means "no node".
+ */
+
+typedef unsigned int hnode;
+
+enum heapTag { HEAP_FREE, HEAP_APPLICATION, HEAP_ATOM };
+
+struct node_heap {
+	unsigned char *tag;
+	hnode         *left;    /* atom ID for HEAP_ATOM nodes */
+	hnode         *right;
+	unsigned int  *refcnt;
+	unsigned int   size;    /* elements allocated in each array */
+	unsigned int   used;    /* high water mark, index 0 unused */
+	hnode          free_list;  /* chained through the right array */
+};
+
+#define HEAP_TAG(h, n)    ((h)->tag[n])
+#define HEAP_LEFT(h, n)   ((h)->left[n])
+#define HEAP_RIGHT(h, n)  ((h)->right[n])
+#define HEAP_REFCNT(h, n) ((h)->refcnt[n])
+
+hnode heap_new_application(struct node_heap *h, hnode left, hnode right);
+hnode heap_new_term(struct node_heap *h, unsigned int atom_id);
+void  heap_free_node(struct node_heap *h, hnode n);
+
+unsigned int heap_atom_id(const char *name, struct reduction_rule *rule);
+
+struct node_heap *get_node_heap(void);
+void reset_node_heap(struct node_heap *h);
+void free_node_heap(void);
+struct heap_state;
+struct heap_state *new_heap_state(void);
+
+enum graphReductionResult heap_reduce_graph(struct node *graph_root);
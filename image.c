@@ -0,0 +1,328 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Interpreter images, for "save-image" and "acl -I".
+ *
+ * Loading a few basis files means lexing and parsing them, building
+ * the Aho-Corasick tables for every abstraction rule, and copying
+ * every abbreviation.  An image holds all of that already done:
+ *
+ *   "ACLIMAGE", version, 0x01020304 (byte order check), size in ints
+ *   atom count, then each atom in ID order: length, characters
+ *     padded out to a whole int
+ *   primitives, see save_rules()
+ *   abstraction rules, see save_abstraction_rules()
+ *   abbreviations, see save_abbreviations()
+ *
+ * load_image() mmap()s the file, and reads it in place.  The
+ * Aho-Corasick tables get used right out of the mapping, so the
+ * mapping stays around until the interpreter exits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <setjmp.h>
+
+#include <node.h>
+#include <hashtable.h>
+#include <atom.h>
+#include <abbreviations.h>
+#include <reduction_rule.h>
+#include <brack.h>
+#include <image.h>
+#include <context.h>
+
+static const char magic[8] = "ACLIMAGE";
+#define IMAGE_VERSION 1
+#define BYTE_ORDER_CHECK 0x01020304
+
+struct mapping {
+	void *addr;
+	size_t length;
+	struct mapping *next;
+};
+
+/* One interpreter context's mapped images, see context.h */
+struct image_state {
+	struct mapping *mappings;
+};
+
+static void load_definitions(struct image *im);
+
+struct image_state *
+new_image_state(void)
+{
+	return calloc(1, sizeof(struct image_state));
+}
+
+int
+save_image(const char *filename)
+{
+	char *tmpname = malloc(strlen(filename) + 5);
+	const char *name;
+	FILE *out;
+	long size;
+	int id, r;
+
+	/* Same as checkpoints, a new copy gets renamed into place. */
+	sprintf(tmpname, "%s.tmp", filename);
+
+	if (!(out = fopen(tmpname, "w+b")))
+	{
+		fprintf(stderr, "Could not open \"%s\" for write: %s\n",
+			tmpname, strerror(errno));
+		free(tmpname);
+		return 0;
+	}
+
+	fwrite(magic, 1, sizeof(magic), out);
+	image_put(out, IMAGE_VERSION);
+	image_put(out, BYTE_ORDER_CHECK);
+	image_put(out, 0);   /* size, filled in below */
+
+	for (id = 1; Atom_name(id); ++id)
+		;
+	image_put(out, id - 1);
+	for (id = 1; (name = Atom_name(id)); ++id)
+	{
+		int len = strlen(name);
+		char pad[sizeof(int)] = {0};
+
+		image_put(out, len);
+		fwrite(name, 1, len, out);
+		fwrite(pad, 1, sizeof(int) - len % sizeof(int), out);
+	}
+
+	save_rules(out);
+	save_abstraction_rules(out);
+	save_abbreviations(out);
+
+	size = ftell(out)/sizeof(int);
+	fseek(out, sizeof(magic) + 2*sizeof(int), SEEK_SET);
+	image_put(out, size);
+
+	r = !ferror(out);
+	if (fclose(out))
+		r = 0;
+
+	if (!r)
+		fprintf(stderr, "Could not write \"%s\": %s\n",
+			tmpname, strerror(errno));
+	else if (rename(tmpname, filename))
+	{
+		fprintf(stderr, "Could not rename \"%s\" to \"%s\": %s\n",
+			tmpname, filename, strerror(errno));
+		r = 0;
+	}
+
+	free(tmpname);
+
+	return r;
+}
+
+int
+load_image(const char *filename)
+{
+	struct image_state *ims = current_context->images;
+	struct image im;
+	struct mapping *m;
+	struct stat st;
+	void *addr;
+	int *definitions;
+	int fd, i;
+
+	if (0 > (fd = open(filename, O_RDONLY)))
+	{
+		fprintf(stderr, "Could not open \"%s\" for read: %s\n",
+			filename, strerror(errno));
+		return 0;
+	}
+
+	if (fstat(fd, &st) || st.st_size < sizeof(magic) + 3*sizeof(int)
+		|| MAP_FAILED == (addr = mmap(NULL, st.st_size, PROT_READ,
+			MAP_PRIVATE, fd, 0)))
+	{
+		fprintf(stderr, "Could not map \"%s\": %s\n", filename,
+			st.st_size < sizeof(magic) + 3*sizeof(int)?
+				"file too short": strerror(errno));
+		close(fd);
+		return 0;
+	}
+	close(fd);
+
+	im.p = (int *)((char *)addr + sizeof(magic));
+	im.end = im.p + (st.st_size - sizeof(magic))/sizeof(int);
+	im.bad = 0;
+	im.check_only = 0;
+	im.atoms = NULL;
+	im.atom_count = 0;
+
+	if (memcmp(addr, magic, sizeof(magic))
+		|| IMAGE_VERSION != im.p[0] || BYTE_ORDER_CHECK != im.p[1]
+		|| st.st_size != im.p[2]*sizeof(int))
+	{
+		fprintf(stderr, "\"%s\" isn't an image this interpreter can use\n",
+			filename);
+		munmap(addr, st.st_size);
+		return 0;
+	}
+	im.p += 3;
+
+	im.atom_count = image_get(&im, 0, im.end - im.p);
+	im.atoms = malloc((im.atom_count + 1)*sizeof(*im.atoms));
+	im.atoms[0] = NULL;
+	for (i = 1; i <= im.atom_count && !im.bad; ++i)
+	{
+		int len = image_get(&im, 0, (im.end - im.p)*sizeof(int) - 1);
+		int *chars = NULL;
+
+		if (!im.bad && len >= 0)
+			chars = image_get_array(&im, len/(int)sizeof(int) + 1);
+
+		/* save_image() pads the characters with at least one '\0',
+		 * but a damaged file can have anything there. */
+		if (!chars || memchr(chars, '\0', len) || '\0' != ((char *)chars)[len])
+			im.bad = 1;
+		else
+			im.atoms[i] = Atom_string((char *)chars);
+	}
+
+	/* The first pass reads the whole image and defines nothing,
+	 * so that a damaged image leaves the interpreter as it was.
+	 * The second pass can't fail: it reads the same ints. */
+	definitions = im.p;
+	im.check_only = 1;
+	load_definitions(&im);
+	if (!im.bad && im.p == im.end)
+	{
+		im.p = definitions;
+		im.check_only = 0;
+		load_definitions(&im);
+	}
+
+	free(im.atoms);
+
+	if (im.bad || im.p != im.end)
+	{
+		fprintf(stderr, "Image \"%s\" is damaged\n", filename);
+		munmap(addr, st.st_size);
+		return 0;
+	}
+
+	/* Aho-Corasick tables point into the mapping */
+	m = malloc(sizeof(*m));
+	m->addr = addr;
+	m->length = st.st_size;
+	m->next = ims->mappings;
+	ims->mappings = m;
+
+	return 1;
+}
+
+/* Primitives first: atoms in the abstraction rules and
+ * abbreviations pick up the rules that go with their names. */
+static void
+load_definitions(struct image *im)
+{
+	if (!im->bad) load_rules(im);
+	if (!im->bad) load_abstraction_rules(im);
+	if (!im->bad) load_abbreviations(im);
+}
+
+/* After the abstraction rules that use them get deleted. */
+void
+unmap_images(void)
+{
+	struct image_state *ims = current_context->images;
+
+	while (ims->mappings)
+	{
+		struct mapping *next = ims->mappings->next;
+		munmap(ims->mappings->addr, ims->mappings->length);
+		free(ims->mappings);
+		ims->mappings = next;
+	}
+}
+
+void
+image_put(FILE *out, int v)
+{
+	fwrite(&v, sizeof(v), 1, out);
+}
+
+void
+image_put_array(FILE *out, const int *a, int n)
+{
+	if (n > 0)
+		fwrite(a, sizeof(*a), n, out);
+}
+
+/* The next int, which has to be between min and max. */
+int
+image_get(struct image *im, int min, int max)
+{
+	int v;
+
+	if (im->bad || im->p >= im->end || (v = *im->p) < min || v > max)
+	{
+		im->bad = 1;
+		return min;
+	}
+	++im->p;
+
+	return v;
+}
+
+/* The next n ints, in place. */
+int *
+image_get_array(struct image *im, int n)
+{
+	int *r = im->p;
+
+	if (im->bad || n < 0 || n > im->end - im->p)
+	{
+		im->bad = 1;
+		return NULL;
+	}
+	im->p += n;
+
+	return r;
+}
+
+void
+image_put_atom(FILE *out, const char *name)
+{
+	image_put(out, name? Atom_id(name): 0);
+}
+
+const char *
+image_get_atom(struct image *im)
+{
+	return im->atoms[image_get(im, 0, im->atom_count)];
+}
@@ -0,0 +1,50 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Interpreter images: "save-image" writes out the atoms, primitives,
+ * abstraction rules and abbreviations, and "acl -I" maps the file back
+ * in.  An image is an array of native ints, so it only works on the
+ * kind of machine that wrote it.  Atoms get referred to by their
+ * atom ID in the image, 0 for none.
+ */
+
+struct image {
+	int *p;              /* next int to read */
+	int *end;
+	int bad;             /* ran off the end, or found nonsense */
+	int check_only;      /* read everything, define nothing */
+	const char **atoms;  /* atoms[id] has image atom ID id */
+	int atom_count;
+};
+
+int  save_image(const char *filename);
+int  load_image(const char *filename);
+void unmap_images(void);
+struct image_state;
+struct image_state *new_image_state(void);
+
+void image_put(FILE *out, int v);
+int  image_get(struct image *im, int min, int max);
+void image_put_array(FILE *out, const int *a, int n);
+int *image_get_array(struct image *im, int n);
+void image_put_atom(FILE *out, const char *name);
+const char *image_get_atom(struct image *im);
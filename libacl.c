@@ -0,0 +1,326 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * libacl: see libacl.h.  Each call works on the caller's context by
+ * making it the thread's current one, and puts back whatever the
+ * thread had before.  Parsing goes through the same grammar.y and
+ * lex.l as the interpreter, reading text with fmemopen(), with
+ * expression_hook set so that top-level expressions come back here
+ * instead of getting reduced.  Terms a caller holds live in the node
+ * arena, so the arena stays put (keep_live_nodes()) until the last
+ * of them gets released.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <sys/time.h> /* gettimeofday() */
+#include <pthread.h>
+
+#include <node.h>
+#include <buffer.h>
+#include <graph.h>
+#include <checkpoint.h>
+#include <context.h>
+#include <parser.h>
+#include <libacl.h>
+
+/* from grammar.y */
+extern int yyparse(void);
+extern int prompting;
+
+/* from lex.l */
+extern void set_yyin_stream(FILE *fin, const char *name);
+extern void reset_yyin(void);
+
+/* yacc and lex keep their state in globals, whatever context they
+ * parse for.  Everything else the parser touches is in the context,
+ * so reductions don't need this. */
+static pthread_mutex_t parser_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Last top-level expression parsed, under parser_lock */
+static struct node *parsed_expression = NULL;
+
+static void keep_expression(struct node *expr);
+static int  parse_stream(FILE *fin, const char *name, struct node **expr);
+static int  parse_text(const char *text, struct node **expr);
+
+struct acl_context *
+acl_open(void)
+{
+	return new_acl_context();
+}
+
+void
+acl_close(struct acl_context *ctx)
+{
+	free_acl_context(ctx);
+}
+
+/* Rules, abstractions, definitions and interpreter commands in text,
+ * lines of it, same as the interpreter reads them.  Expressions in
+ * it get parsed, and thrown away.  Returns 0, or -1 on syntax errors. */
+int
+acl_define(struct acl_context *ctx, const char *text)
+{
+	struct acl_context *caller = use_acl_context(ctx);
+	struct node *expr = NULL;
+	int r = parse_text(text, &expr);
+
+	if (expr)
+		acl_release(ctx, expr);
+
+	use_acl_context(caller);
+
+	return r;
+}
+
+/* Same as acl_define(), reading the file named filename. */
+int
+acl_load(struct acl_context *ctx, const char *filename)
+{
+	struct acl_context *caller;
+	struct node *expr = NULL;
+	FILE *fin;
+	int r;
+
+	if (!(fin = fopen(filename, "r")))
+		return -1;
+
+	caller = use_acl_context(ctx);
+	r = parse_stream(fin, filename, &expr);
+	if (expr)
+		acl_release(ctx, expr);
+	use_acl_context(caller);
+
+	return r;
+}
+
+/* The last top-level expression in text, with abbreviations and
+ * bracket abstractions taken care of, or NULL for none or for a
+ * syntax error.  A trailing newline is optional. */
+struct node *
+acl_parse(struct acl_context *ctx, const char *text)
+{
+	struct acl_context *caller = use_acl_context(ctx);
+	struct node *expr = NULL;
+
+	if (parse_text(text, &expr) && expr)
+	{
+		acl_release(ctx, expr);
+		expr = NULL;
+	}
+
+	use_acl_context(caller);
+
+	return expr;
+}
+
+/* Reduces *term, which it replaces with the result: the normal form,
+ * or as far as reduction got inside of the budget.  A NULL budget,
+ * or zero fields in it, means no limit.  Doesn't touch signals,
+ * unlike the interpreter's "timeout" setting, which uses alarm(). */
+enum acl_result
+acl_reduce(struct acl_context *ctx, struct node **term,
+	const struct acl_budget *budget)
+{
+	struct acl_context *caller = use_acl_context(ctx);
+	int old_count = ctx->max_reduction_count;
+	int old_memory = ctx->memory_limit;
+	int old_sharing = ctx->maximal_sharing;
+	enum graphReductionResult grr = INTERRUPT;
+	enum acl_result r;
+	struct node *root, *result;
+
+	if (budget)
+	{
+		ctx->max_reduction_count = budget->contractions;
+		ctx->memory_limit = budget->live_nodes;
+		if (budget->seconds > 0.0)
+		{
+			struct timeval now;
+			gettimeofday(&now, NULL);
+			ctx->reduction_deadline = (double)now.tv_sec
+				+ 1.0E-6*(double)now.tv_usec + budget->seconds;
+		}
+	}
+
+	/* Nodes created by reductions stay out of the unique table. */
+	ctx->maximal_sharing = 0;
+	/* The caller's terms already keep the arena in place: this
+	 * measures them against the budget's memory limit. */
+	keep_live_nodes(1);
+
+	/* A dummy root, as in reduce_tree() in grammar.y */
+	root = new_application(*term, new_application(NULL, NULL));
+	++root->refcnt;
+
+	/* Only single-stepping gets out this way */
+	if (!sigsetjmp(ctx->in_reduce_graph, 0))
+		grr = reduce_graph(&root);
+	else
+		ctx->reduction_interrupted = 1;
+
+	flush_pending_nodes();
+	wait_for_checkpoint();
+	forget_stopped_reduction();
+
+	ctx->max_reduction_count = old_count;
+	ctx->memory_limit = old_memory;
+	ctx->maximal_sharing = old_sharing;
+	ctx->reduction_deadline = 0.0;
+
+	result = root->left;
+	++result->refcnt;
+	free_node(root);
+	free_node(*term);
+	*term = result;
+
+	switch (grr)
+	{
+	case CYCLE_DETECTED:  r = ACL_CYCLE; break;
+	case REDUCTION_LIMIT: r = ACL_STEP_LIMIT; break;
+	case TIMEOUT:         r = ACL_TIME_LIMIT; break;
+	case MEMORY_LIMIT:    r = ACL_MEMORY_LIMIT; break;
+	case INTERRUPT:       r = ACL_INTERRUPTED; break;
+	default:              r = ACL_NORMAL_FORM; break;
+	}
+
+	use_acl_context(caller);
+
+	return r;
+}
+
+/* Writes term as text into buf, the way the interpreter prints it,
+ * truncated to size - 1 bytes and always NUL terminated.  Returns
+ * the length of the whole text, as snprintf() does, so a return
+ * value of size or more means buf was too small. */
+int
+acl_print(struct node *term, char *buf, size_t size)
+{
+	struct buffer *b = new_buffer(256);
+	int length;
+
+	graph_text(term, b);
+	length = b->offset;
+
+	if (size > 0)
+	{
+		size_t n = (size_t)length < size? (size_t)length: size - 1;
+		memcpy(buf, b->buffer, n);
+		buf[n] = '\0';
+	}
+
+	delete_buffer(b);
+
+	return length;
+}
+
+/* The caller is done with term, from acl_parse() or acl_reduce() */
+void
+acl_release(struct acl_context *ctx, struct node *term)
+{
+	struct acl_context *caller = use_acl_context(ctx);
+
+	free_node(term);
+
+	if (0 == --ctx->held_terms)
+	{
+		keep_live_nodes(0);
+		reset_node_allocation();
+	}
+
+	use_acl_context(caller);
+}
+
+/* expression_hook, while parse_stream() runs */
+static void
+keep_expression(struct node *expr)
+{
+	if (parsed_expression)
+		free_node(parsed_expression);
+	else
+		++current_context->held_terms;
+
+	++expr->refcnt;
+	parsed_expression = expr;
+
+	/* top_level_cleanup() would reset the arena out from under it */
+	keep_live_nodes(1);
+}
+
+/* Parses fin, and closes it.  *expr gets the last top-level
+ * expression, if any.  Returns 0, or -1 on syntax errors. */
+static int
+parse_stream(FILE *fin, const char *name, struct node **expr)
+{
+	int old_prompting, r;
+
+	pthread_mutex_lock(&parser_lock);
+
+	old_prompting = prompting;
+	prompting = 0;
+	current_context->syntax_error_count = 0;
+	current_context->expression_hook = keep_expression;
+	parsed_expression = NULL;
+
+	set_yyin_stream(fin, name);
+	r = yyparse();
+	reset_yyin();
+
+	if (current_context->syntax_error_count)
+		r = -1;
+	*expr = parsed_expression;
+
+	parsed_expression = NULL;
+	current_context->expression_hook = NULL;
+	prompting = old_prompting;
+
+	pthread_mutex_unlock(&parser_lock);
+
+	return r? -1: 0;
+}
+
+/* Parses text, with a newline on the end if it doesn't have one */
+static int
+parse_text(const char *text, struct node **expr)
+{
+	size_t length = strlen(text);
+	char *copy = malloc(length + 2);
+	FILE *fin;
+	int r = -1;
+
+	memcpy(copy, text, length);
+	if (0 == length || '\n' != copy[length - 1])
+		copy[length++] = '\n';
+	copy[length] = '\0';
+
+	*expr = NULL;
+	if (NULL != (fin = fmemopen(copy, length, "r")))
+		r = parse_stream(fin, "acl_parse", expr);
+
+	free(copy);
+
+	return r;
+}
@@ -0,0 +1,63 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * libacl: the interpreter as a library.  A program makes a context
+ * with acl_open(), gives it rules, abstractions and definitions with
+ * acl_define() or acl_load(), then parses terms, reduces them and
+ * turns them back into text.  Terms belong to the context that parsed
+ * them.  Any number of threads can each work on a context of their
+ * own; parsing takes a lock, since the parser isn't reentrant.
+ * Interpreter commands in definitions print to standard output, same
+ * as they would in the interpreter.  Link with -lpthread.
+ * Only the acl_ functions below are visible outside the library.
+ */
+
+#include <stddef.h>  /* size_t */
+
+struct acl_context;
+struct node;
+
+enum acl_result {
+	ACL_NORMAL_FORM,
+	ACL_CYCLE,          /* "cycles on" found one */
+	ACL_INTERRUPTED,
+	ACL_STEP_LIMIT,     /* term is as far as it got */
+	ACL_TIME_LIMIT,     /* ditto */
+	ACL_MEMORY_LIMIT    /* ditto */
+};
+
+/* Limits on one acl_reduce() call, zero for none */
+struct acl_budget {
+	int contractions;
+	double seconds;
+	int live_nodes;
+};
+
+struct acl_context *acl_open(void);
+void acl_close(struct acl_context *ctx);
+int  acl_define(struct acl_context *ctx, const char *text);
+int  acl_load(struct acl_context *ctx, const char *filename);
+struct node *acl_parse(struct acl_context *ctx, const char *text);
+enum acl_result acl_reduce(struct acl_context *ctx, struct node **term,
+	const struct acl_budget *budget);
+int  acl_print(struct node *term, char *buf, size_t size);
+void acl_release(struct acl_context *ctx, struct node *term);
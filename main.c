@@ -0,0 +1,253 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * The interpreter's command line: flags, -L files, then a read-eval-print
+ * loop on standard input, or an evaluation server.  Everything else in
+ * the interpreter, the parser included, goes in libacl.a as well.
+ */
+
+#include <stdio.h>
+#include <errno.h>    /* errno */
+#include <string.h>   /* strerror() */
+#include <stdlib.h>   /* malloc(), free(), strtol() */
+#include <unistd.h>   /* getopt() */
+#include <setjmp.h>
+
+extern char *optarg;
+
+#include <node.h>
+#include <hashtable.h>
+#include <atom.h>
+#include <reduction_rule.h>
+#include <spine_stack.h>
+#include <cycle_detector.h>
+#include <parser.h>
+#include <image.h>
+#include <server.h>
+#include <context.h>
+
+/* from grammar.y */
+extern int yydebug;
+extern int yyparse(void);
+extern int memory_info;
+extern const char *current_prompt;
+extern int prompting;
+extern void finish_batch(void);
+extern void forget_stopped_tree(void);
+extern void print_memory_statistics(void);
+
+/* from lex.l */
+extern void set_yyin_stdin(void);
+extern void set_yyin(const char *filename);
+extern void reset_yyin(void);
+
+void usage(char *progname);
+
+struct filename_node {
+	const char *filename;
+	struct filename_node *next;
+};
+
+int
+main(int ac, char **av)
+{
+	int c, r;
+	struct filename_node *p, *load_files = NULL, *load_tail = NULL;
+	const char *image_file = NULL;
+	const char *serve_socket = NULL, *client_socket = NULL;
+	int server_workers = 4;
+
+	/* Options set things in the context */
+	use_acl_context(new_acl_context());
+
+	while (-1 != (c = getopt(ac, av, "bC:cDdeI:j:L:mM:N:pS:sT:tW:x")))
+	{
+		switch (c)
+		{
+		case 'b':
+			current_context->cycle_detection = BRENT_CYCLES;
+			break;
+		case 'C':
+			client_socket = optarg;
+			break;
+		case 'c':
+			current_context->cycle_detection = 1;
+			break;
+		case 'd':
+			current_context->debug_reduction = 1;
+			break;
+		case 'D':
+			yydebug = 1;
+			break;
+		case 'e':
+			current_context->elaborate_output = 1;
+			break;
+		case 'I':
+			image_file = optarg;
+			break;
+		case 'j':
+			current_context->parallel_jobs = strtol(optarg, NULL, 10);
+			if (current_context->parallel_jobs < 0) current_context->parallel_jobs = 0;
+			break;
+		case 'L':
+			p = malloc(sizeof(*p));
+			p->filename = Atom_string(optarg);
+			p->next = NULL;
+			if (load_tail)
+				load_tail->next = p;
+			load_tail = p;
+			if (!load_files)
+				load_files = p;
+			break;
+		case 'm':
+			memory_info = 1;
+			break;
+		case 'M':
+			current_context->memory_limit = strtol(optarg, NULL, 10);
+			if (current_context->memory_limit < 0) current_context->memory_limit = 0;
+			break;
+		case 'N':
+			current_context->max_reduction_count = strtol(optarg, NULL, 10);
+			if (current_context->max_reduction_count < 0) current_context->max_reduction_count = 0;
+			break;
+		case 'p':
+			prompting = 0;
+			break;
+		case 'S':
+			serve_socket = optarg;
+			break;
+		case 's':
+			current_context->single_step = 1;
+			break;
+		case 'T':
+			current_context->reduction_timeout = strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			current_context->trace_reduction = 1;
+			break;
+		case 'W':
+			server_workers = strtol(optarg, NULL, 10);
+			break;
+		case 'x':
+			usage(av[0]);
+			exit(0);
+			break;
+		}
+	}
+
+	/* A client doesn't need an interpreter of its own */
+	if (client_socket)
+	{
+		free_acl_context(current_context);
+		return run_client(client_socket);
+	}
+
+	/* An image comes before any files, which can add to it. */
+	if (image_file && !load_image(image_file))
+		printf("Problem with image \"%s\"\n", image_file);
+
+	if (load_files)
+	{
+		struct filename_node *t, *z;
+		int old_prompt = prompting;
+		prompting = 0;
+		for (z = load_files; z; z = t)
+		{
+			FILE *fin;
+
+			t = z->next;
+
+			printf("load file named \"%s\"\n",
+				z->filename);
+
+			if (!(fin = fopen(z->filename, "r")))
+			{
+				fprintf(stderr, "Problem reading \"%s\": %s\n",
+					z->filename, strerror(errno));
+				continue;
+			}
+
+			set_yyin(z->filename);
+
+			r = yyparse();
+			finish_batch();
+
+			reset_yyin();
+
+			if (r)
+				printf("Problem with file \"%s\"\n", z->filename);
+
+			free(z);
+			fin = NULL;
+		}
+		prompting = old_prompt;
+	}
+
+	if (serve_socket)
+		r = serve(serve_socket, server_workers);
+	else {
+		set_yyin_stdin();
+
+		do {
+			if (prompting) printf(current_prompt);
+			r =  yyparse();
+		} while (r);
+		if (prompting) printf("\n");
+	}
+
+	if (memory_info)
+		print_memory_statistics();
+
+	finish_batch();
+	forget_stopped_tree();
+	free_acl_context(current_context);
+	reset_yyin();
+
+	return r;
+}
+
+void
+usage(char *progname)
+{
+	fprintf(stderr, "%s: Combinatory Logic like language interpreter\n",
+		progname);
+	fprintf(stderr, "Flags:\n"
+		"-b             Enable constant memory reduction cycle detection\n"
+		"-C  socket     Send standard input, line by line, to a server on socket\n"
+		"-c             Enable reduction cycle detection\n"
+		"-d             Debug reductions\n"
+		"-e             Elaborate output\n"
+		"-I  filename   Start with an image written by save-image\n"
+		"-j number      Reduce arguments, and expressions from files, on number threads\n"
+		"-L  filename   Load and interpret a file named filename\n"
+		"-m             on exit, print memory usage summary\n"
+		"-M number      Use up to number live nodes in a reduction\n"
+		"-N number      Perform up to number reductions\n"
+		"-p             Don't print prompts\n"
+		"-S  socket     Serve requests on Unix domain socket, after loading files\n"
+		"-s             Single-step reductions\n"
+		"-T number      Evaluate an expression for up to number seconds\n"
+		"-t             trace reductions\n"
+		"-W number      Keep number server workers waiting for connections\n"
+		""
+	);
+}
@@ -41,6 +41,58 @@
  * to fill out the updateable, left_addr and right_addr fields of struct
  * node on every allocation.
  *
+ * With "share on", new_application() and new_term() hash-cons: they hand
+ * back an existing struct node with the same children (or name) if one
+ * exists in the unique table.  The table holds a reference to every node
+ * in it, so parser values that don't hold a reference can't get freed out
+ * from under each other.  Graph reduction overwrites nodes in place, so
+ * perform_reduction() calls unshare_node() on any node it rewrites.  The
+ * unique table gets emptied at the end of each read-eval-print loop.
+ *
+ * The "gc N" interpreter command turns on a copying collector.  Once more
+ * than N structs node have come out of the arena during a reduction,
+ * collect_garbage() copies everything reachable from the dummy root and
+ * the spine stack into a fresh arena, depth first, left to right, then
+ * throws away the old arena and the free list.  The collector only runs
+ * if every node not on the free list turns out to be reachable: nodes the
+ * parser holds on to (the rest of an expression containing "reduce") would
+ * otherwise get left behind.
+ *
+ * free_node() doesn't recurse: dropping a long spine would overflow the
+ * C stack.  With "lazy on", it doesn't even walk the garbage: the dead
+ * node goes on a pending list, and each new_node() call takes apart a
+ * couple of pending nodes, so the cost of freeing a big expression gets
+ * spread over later allocations.
+ *
+ * Atoms don't change during reduction: perform_reduction() only rewrites
+ * application nodes.  (A shared redex can turn into a copy of an atom,
+ * but it's a non-permanent node all the same.)  So new_term() hands back one permanent, "flyweight"
+ * node per (name, rule) pair, allocated with malloc(), since the arena
+ * gets reset.  Flyweight atoms have the permanent field set, don't get
+ * reference counted, and don't count as nodes in use.  With "debug" or
+ * "trace" on, new_term() allocates a private atom for every occurrence,
+ * since that output marks individual atoms by serial number.
+ *
+ * Abbreviation bodies consist of permanent, malloc()ed application nodes
+ * and flyweight atoms.  abbreviation_lookup() hands back the body itself,
+ * and perform_reduction() copies permanent nodes on the spine before it
+ * writes into one of them.
+ *
+ * "memory N" caps the number of structs node in use (allocated from the
+ * arena, and not on the free list) at N.  new_node() only raises a flag,
+ * reduce_graph() checks it after each contraction.
+ *
+ * The arena usually gets reset at the end of each read-eval-print loop.
+ * A reduction that stopped on a limit or a signal keeps its graph for
+ * "continue", and keep_live_nodes() holds off the reset until then.
+ *
+ * While "-j N" has threads reducing arguments in parallel (parallel.c),
+ * each thread allocates from, and frees to, its own struct node_cache.
+ * A cache refills from the free list and the arena, and drains back
+ * to the free list, under allocation_lock.  Nothing else in here is
+ * thread safe: parallel reduction doesn't run with "lazy on", debugging
+ * output, garbage collection or a memory limit.
+ *
  * Includes similar data struct, struct abs_node, created in parsing of
  * user-input bracket abstractin rules.
  */
@@ -50,63 +102,391 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <signal.h>   /* sigprocmask() */
+#include <setjmp.h>
+#include <sys/time.h> /* gettimeofday(), struct timeval */
+#include <pthread.h>
 
 #include <node.h>
 #include <arena.h>
 #include <hashtable.h>
 #include <atom.h>
+#include <spine_stack.h>
+#include <context.h>
+
+/* How many pending nodes each new_node() call takes apart.
+ * More than 1, so that the pending list shrinks. */
+#define RECLAIM_PER_ALLOCATION 2
+
+/* Explicit stack for free_dead_nodes() */
+struct free_frame {
+	struct node *node;
+	int next_child;   /* 0: left, 1: right, 2: done */
+};
+
+/* Per-thread allocation during parallel reduction */
+struct node_cache {
+	struct node *free_list;
+	int count;
+	struct free_frame *free_stack;
+	int free_stack_size;
+};
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+/* How many nodes a cache takes at a time */
+#define NODE_CACHE_REFILL 256
+
+/* One interpreter context's nodes, see context.h */
+struct node_state {
+	struct memory_arena *arena;
 
-extern int elaborate_output;
-extern int debug_reduction;
+	/* sn_counter - give a serial number (sn field) to
+	 * all nodes, so as to distinguish them in elaborate output.
+	 * Note that 0 constitutes a special value. */
+	int sn_counter;
+	int reused_node_count;
+	int allocated_node_count;  /* Not total. In a particular arena. */
+	int arena_node_count;      /* Total, from all arenas. */
+	int new_node_cnt;
+	int peak_live_nodes;
 
-static struct memory_arena *arena = NULL;
+	struct node *node_free_list;
+	int free_list_count;
 
-/* sn_counter - give a serial number (sn field) to
- * all nodes, so as to distinguish them in elaborate output.
- * Note that 0 constitutes a special value. */
-static int sn_counter = 0;
-static int reused_node_count = 0;
-static int allocated_node_count = 0;  /* Not total. In a particular arena. */
-static int new_node_cnt;
+	/* Set by new_node() when more than memory_limit
+	 * nodes are off the free list at once. */
+	int memory_limit_hit;
 
-extern int interpreter_interrupted;
-extern int reduction_interrupted;
+	/* Garbage nodes whose children haven't had their reference
+	 * counts decremented yet, linked through next_shared. Only
+	 * used with "lazy on". */
+	struct node *pending_list;
+	int pending_count;
 
-static struct node *node_free_list = NULL;
+	struct free_frame *free_stack;
+	int free_stack_size;
+
+	int caches_active;
+	pthread_mutex_t allocation_lock;
+
+	/* Copying collector statistics, and the arena
+	 * size (in nodes) that triggers the next collection. */
+	int gc_count;
+	unsigned long gc_bytes_copied;
+	double gc_total_pause;
+	double gc_max_pause;
+	int gc_trigger;
+	int gc_abandoned;
+	/* Read-eval-print loops that wanted a collection but couldn't
+	 * have one, see collect_garbage(); each gets counted once. */
+	int gc_skipped_shared;
+	int gc_skipped_roots;
+	int gc_skip_counted;
+
+	/* Set while "continue" has a graph to go back to. */
+	int live_nodes_kept;
+
+	/* Old nodes that private_copy_graph() left forwarding pointers in */
+	struct node **copied_nodes;
+	int copied_size;
+	int copied_count;
+
+	/* Flyweight atoms, hashed on (name, rule), chained through
+	 * next_shared.  They last as long as the context does. */
+	struct node **atom_table;
+	unsigned int atom_table_size;
+	unsigned int atom_table_count;
+
+	/* Unique table for "share on" mode. A power-of-2 sized array
+	 * of hash chains, linked through the next_shared field. */
+	struct node **share_table;
+	unsigned int share_table_size;
+	unsigned int share_table_count;
+	int avoided_allocation_count;
+};
 
 /* actual centralized allocation, used by new_term(),
  * new_application(). */
 struct node *new_node(void);
 
+static unsigned int share_hash(const char *name, struct node *left, struct node *right);
+static struct node *find_shared(enum nodeType typ, const char *name, struct node *left, struct node *right);
+static void add_shared(struct node *node);
+static void release_shared_nodes(void);
+static void print_gc_skips(void);
+static void reclaim_pending_nodes(int count);
+static unsigned int atom_hash(const char *name, struct reduction_rule *rule);
+static struct node *init_node(struct node *r);
+static struct node *cached_node(struct node_cache *c);
+static struct node *copy_private(struct node *p);
+static void refill_node_cache(struct node_cache *c);
+
 struct node *
 new_application(struct node *left_child, struct node *right_child)
 {
-	struct node *r = new_node();
+	struct node_state *ns = current_context->nodes;
+	struct node *r = NULL;
+
+	if (current_context->maximal_sharing
+		&& (r = find_shared(APPLICATION, NULL, left_child, right_child)))
+	{
+		++ns->avoided_allocation_count;
+		return r;
+	}
+
+	r = new_node();
 
 	r->typ = APPLICATION;
 	r->name = "@";  /* algorithm_d() uses this value, but only by checking byte value. */
 	r->right = right_child;
 	r->left  = left_child;
 
-	if (r->right)
+	if (r->right && !r->right->permanent)
 		++r->right->refcnt;
-	if (r->left)
+	if (r->left && !r->left->permanent)
 		++r->left->refcnt;
 
+	if (current_context->maximal_sharing)
+		add_shared(r);
+
 	return r;
 }
 
 struct node *
-new_term(const char *name)
+new_term(const char *name, struct reduction_rule *rule)
 {
-	struct node *r = new_node();
+	struct node_state *ns = current_context->nodes;
+	struct node *r = NULL;
+
+	if (!(current_context->debug_reduction || current_context->trace_reduction))
+		return flyweight_atom(name, rule);
+
+	if (current_context->maximal_sharing && (r = find_shared(ATOM, name, NULL, NULL)))
+	{
+		++ns->avoided_allocation_count;
+		return r;
+	}
+
+	r = new_node();
 
 	r->typ = ATOM;
 	r->name = name;
+	r->rule = rule;
+
+	if (current_context->maximal_sharing)
+		add_shared(r);
 
 	return r;
 }
 
+static unsigned int
+atom_hash(const char *name, struct reduction_rule *rule)
+{
+	struct node_state *ns = current_context->nodes;
+	unsigned long h = (unsigned long)name;
+
+	h = h*31 + ((unsigned long)rule >> 3);
+	h ^= h >> 16;
+
+	return (unsigned int)h & (ns->atom_table_size - 1);
+}
+
+struct node *
+flyweight_atom(const char *name, struct reduction_rule *rule)
+{
+	struct node_state *ns = current_context->nodes;
+	struct node *r;
+	unsigned int idx;
+
+	if (2*(ns->atom_table_count + 1) > ns->atom_table_size)
+	{
+		struct node **old_table = ns->atom_table;
+		unsigned int i, old_size = ns->atom_table_size;
+
+		ns->atom_table_size = old_size? 2*old_size: 64;
+		ns->atom_table = calloc(ns->atom_table_size, sizeof(ns->atom_table[0]));
+
+		for (i = 0; i < old_size; ++i)
+		{
+			struct node *next;
+			for (r = old_table[i]; r; r = next)
+			{
+				next = r->next_shared;
+				idx = atom_hash(r->name, r->rule);
+				r->next_shared = ns->atom_table[idx];
+				ns->atom_table[idx] = r;
+			}
+		}
+
+		free(old_table);
+	}
+
+	idx = atom_hash(name, rule);
+
+	for (r = ns->atom_table[idx]; r; r = r->next_shared)
+		if (r->name == name && r->rule == rule)
+			return r;
+
+	r = malloc(sizeof(*r));
+	r->sn = ++ns->sn_counter;
+	r->typ = ATOM;
+	r->name = name;
+	r->rule = rule;
+	r->left = r->right = NULL;
+	r->left_addr = &(r->left);
+	r->right_addr = &(r->right);
+	r->updateable = NULL;
+	r->refcnt = 1;
+	r->tree_size = 1;
+	r->shared = 0;
+	r->permanent = 1;
+	r->digest = 0;
+	r->redexes = -1;
+	r->exclusive = 0;
+
+	r->next_shared = ns->atom_table[idx];
+	ns->atom_table[idx] = r;
+	++ns->atom_table_count;
+
+	return r;
+}
+
+static unsigned int
+share_hash(const char *name, struct node *left, struct node *right)
+{
+	struct node_state *ns = current_context->nodes;
+	unsigned long h = (unsigned long)name;
+
+	h = h*31 + ((unsigned long)left >> 3);
+	h = h*31 + ((unsigned long)right >> 3);
+	h ^= h >> 16;
+
+	return (unsigned int)h & (ns->share_table_size - 1);
+}
+
+static struct node *
+find_shared(enum nodeType typ, const char *name, struct node *left, struct node *right)
+{
+	struct node_state *ns = current_context->nodes;
+	struct node *p = NULL;
+
+	if (!ns->share_table)
+		return NULL;
+
+	for (p = ns->share_table[share_hash(name, left, right)]; p; p = p->next_shared)
+	{
+		if (p->typ == typ && p->left == left && p->right == right
+			&& (APPLICATION == typ || p->name == name))
+			break;
+	}
+
+	return p;
+}
+
+static void
+add_shared(struct node *node)
+{
+	struct node_state *ns = current_context->nodes;
+	const char *key = ATOM == node->typ? node->name: NULL;
+	unsigned int idx;
+
+	if (ns->share_table_count >= 2*ns->share_table_size)
+	{
+		/* grow and rehash */
+		unsigned int i, old_size = ns->share_table_size;
+		struct node **old_table = ns->share_table;
+
+		ns->share_table_size = old_size? 2*old_size: 1024;
+		ns->share_table = calloc(ns->share_table_size, sizeof(ns->share_table[0]));
+
+		for (i = 0; i < old_size; ++i)
+		{
+			struct node *p = old_table[i], *next;
+			for (; p; p = next)
+			{
+				next = p->next_shared;
+				idx = share_hash(ATOM == p->typ? p->name: NULL, p->left, p->right);
+				p->next_shared = ns->share_table[idx];
+				ns->share_table[idx] = p;
+			}
+		}
+		free(old_table);
+	}
+
+	idx = share_hash(key, node->left, node->right);
+	node->next_shared = ns->share_table[idx];
+	ns->share_table[idx] = node;
+	node->shared = 1;
+	++node->refcnt;   /* the unique table's reference */
+	++ns->share_table_count;
+}
+
+/* Take a node out of the unique table, typically because
+ * it's about to get destructively updated. */
+void
+unshare_node(struct node *node)
+{
+	struct node_state *ns = current_context->nodes;
+	struct node **pp;
+
+	if (!node->shared)
+		return;
+
+	pp = &ns->share_table[share_hash(ATOM == node->typ? node->name: NULL, node->left, node->right)];
+
+	for (; *pp; pp = &(*pp)->next_shared)
+	{
+		if (*pp == node)
+		{
+			*pp = node->next_shared;
+			break;
+		}
+	}
+
+	node->next_shared = NULL;
+	node->shared = 0;
+	--ns->share_table_count;
+
+	free_node(node);  /* the unique table's reference */
+}
+
+/* Drop the unique table's references. After an interrupted
+ * reduction, reference counts can't be trusted, so just
+ * forget about the nodes: the arena gets reset anyway. */
+static void
+release_shared_nodes(void)
+{
+	struct node_state *ns = current_context->nodes;
+	unsigned int i;
+
+	for (i = 0; i < ns->share_table_size; ++i)
+	{
+		struct node *p = ns->share_table[i], *next;
+
+		ns->share_table[i] = NULL;
+
+		for (; p; p = next)
+		{
+			next = p->next_shared;
+			p->next_shared = NULL;
+			p->shared = 0;
+			if (!current_context->reduction_interrupted)
+				free_node(p);
+		}
+	}
+
+	ns->share_table_count = 0;
+}
+
+int
+allocations_avoided(void)
+{
+	struct node_state *ns = current_context->nodes;
+
+	return ns->avoided_allocation_count;
+}
+
 void
 print_tree(struct node *node, int reduction_node_sn, int current_node_sn)
 {
@@ -118,7 +498,7 @@ print_tree(struct node *node, int reduction_node_sn, int current_node_sn)
 
 		print_tree(node->left, reduction_node_sn, current_node_sn);
 		
-		if (elaborate_output)
+		if (current_context->elaborate_output)
 		{
 			printf(" {%d}", node->sn);
 			if (node->sn == current_node_sn)
@@ -143,12 +523,12 @@ print_tree(struct node *node, int reduction_node_sn, int current_node_sn)
 			print_tree(node->right, reduction_node_sn, current_node_sn);
 			if (print_right_paren)
 				putc(')', stdout);
-		} else if (elaborate_output)
+		} else if (current_context->elaborate_output)
 			printf(" {%d}", node->sn);
 
 		break;
 	case ATOM:
-		if (elaborate_output)
+		if (current_context->elaborate_output)
 			printf("%s{%d}", node->name, node->sn);
 		else
 			printf(
@@ -164,75 +544,402 @@ print_tree(struct node *node, int reduction_node_sn, int current_node_sn)
 struct node *
 new_node(void)
 {
+	struct node_state *ns = current_context->nodes;
 	struct node *r = NULL;
+	int live;
 
-	++new_node_cnt;
+	if (ns->caches_active)
+		return init_node(cached_node(pthread_getspecific(cache_key)));
 
-	if (node_free_list)
+	++ns->new_node_cnt;
+
+	if (ns->pending_list)
+		reclaim_pending_nodes(RECLAIM_PER_ALLOCATION);
+
+	if (ns->node_free_list)
 	{
-		r = node_free_list;
-		node_free_list = node_free_list->right;
-		++reused_node_count;
+		r = ns->node_free_list;
+		ns->node_free_list = ns->node_free_list->right;
+		--ns->free_list_count;
+		++ns->reused_node_count;
 	} else {
-		r = arena_alloc(arena, sizeof(*r));
-		++sn_counter;
-		++allocated_node_count;
-		r->sn = sn_counter;
+		r = arena_alloc(ns->arena, sizeof(*r));
+		++ns->sn_counter;
+		++ns->allocated_node_count;
+		++ns->arena_node_count;
+		r->sn = ns->sn_counter;
 		r->right_addr = &(r->right);
 		r->left_addr = &(r->left);
 	}
 
+	live = ns->allocated_node_count - ns->free_list_count;
+	if (live > ns->peak_live_nodes)
+		ns->peak_live_nodes = live;
+	if (current_context->memory_limit && live > current_context->memory_limit)
+		ns->memory_limit_hit = 1;
+
+	return init_node(r);
+}
+
+static struct node *
+init_node(struct node *r)
+{
 	/* r->sn stays unchanged throughout */
 	r->right = r->left = NULL;
 	r->name = NULL;
 	r->updateable = NULL;
 	r->refcnt = 0;
 	r->tree_size = 0;
+	r->next_shared = NULL;
+	r->shared = 0;
+	r->permanent = 0;
+	r->digest = 0;
+	r->redexes = -1;
+	r->exclusive = 0;
+
+	return r;
+}
+
+static struct node *
+cached_node(struct node_cache *c)
+{
+	struct node *r;
+
+	if (!c->free_list)
+		refill_node_cache(c);
+
+	r = c->free_list;
+	c->free_list = r->right;
+	--c->count;
 
 	return r;
 }
 
+static void
+refill_node_cache(struct node_cache *c)
+{
+	struct node_state *ns = current_context->nodes;
+	struct node *r;
+	int i, live;
+
+	pthread_mutex_lock(&ns->allocation_lock);
+
+	ns->new_node_cnt += NODE_CACHE_REFILL;
+
+	for (i = 0; i < NODE_CACHE_REFILL && ns->node_free_list; ++i)
+	{
+		r = ns->node_free_list;
+		ns->node_free_list = r->right;
+		r->right = c->free_list;
+		c->free_list = r;
+	}
+	ns->free_list_count -= i;
+	ns->reused_node_count += i;
+
+	if (i < NODE_CACHE_REFILL)
+	{
+		r = arena_alloc(ns->arena, (NODE_CACHE_REFILL - i)*sizeof(*r));
+		ns->allocated_node_count += NODE_CACHE_REFILL - i;
+		ns->arena_node_count += NODE_CACHE_REFILL - i;
+		for (; i < NODE_CACHE_REFILL; ++i, ++r)
+		{
+			r->sn = ++ns->sn_counter;
+			r->right_addr = &(r->right);
+			r->left_addr = &(r->left);
+			r->right = c->free_list;
+			c->free_list = r;
+		}
+	}
+	c->count += NODE_CACHE_REFILL;
+
+	/* cached nodes count as live */
+	live = ns->allocated_node_count - ns->free_list_count;
+	if (live > ns->peak_live_nodes)
+		ns->peak_live_nodes = live;
+
+	pthread_mutex_unlock(&ns->allocation_lock);
+}
+
+struct node_cache *
+new_node_cache(void)
+{
+	return calloc(1, sizeof(struct node_cache));
+}
+
+/* The calling thread allocates from c while caches are active */
 void
-free_all_nodes(void)
+use_node_cache(struct node_cache *c)
+{
+	pthread_setspecific(cache_key, c);
+}
+
+/* Turns per-thread allocation on or off.  Only call this
+ * when no other thread allocates or frees nodes. */
+void
+activate_node_caches(int on)
+{
+	struct node_state *ns = current_context->nodes;
+
+	ns->caches_active = on;
+}
+
+/* Put c's nodes back on the free list */
+void
+drain_node_cache(struct node_cache *c)
+{
+	struct node_state *ns = current_context->nodes;
+
+	pthread_mutex_lock(&ns->allocation_lock);
+	while (c->free_list)
+	{
+		struct node *r = c->free_list;
+		c->free_list = r->right;
+		r->right = ns->node_free_list;
+		ns->node_free_list = r;
+	}
+	ns->free_list_count += c->count;
+	c->count = 0;
+	pthread_mutex_unlock(&ns->allocation_lock);
+}
+
+void
+free_node_cache(struct node_cache *c)
 {
-	deallocate_arena(arena);
+	drain_node_cache(c);
+	free(c->free_stack);
+	free(c);
 }
 
+/* Fill in nodes[0] through nodes[count - 1] with new application
+ * nodes, children not yet set, same as count calls to new_node().
+ * Free list nodes get used first, the rest come from the arena in
+ * one piece.  Compiled reduction rules allocate a contraction's
+ * result this way.  Doesn't consult the unique table. */
 void
-init_node_allocation(void)
+new_application_batch(struct node **nodes, int count)
 {
-	arena = new_arena();
+	struct node_state *ns = current_context->nodes;
+	struct node *r;
+	int i, live;
+
+	if (ns->caches_active)
+	{
+		for (i = 0; i < count; ++i)
+		{
+			nodes[i] = new_node();
+			nodes[i]->typ = APPLICATION;
+			nodes[i]->name = "@";
+		}
+		return;
+	}
+
+	ns->new_node_cnt += count;
+
+	if (ns->pending_list)
+		reclaim_pending_nodes(RECLAIM_PER_ALLOCATION*count);
+
+	for (i = 0; i < count && ns->node_free_list; ++i)
+	{
+		nodes[i] = ns->node_free_list;
+		ns->node_free_list = ns->node_free_list->right;
+	}
+	ns->free_list_count -= i;
+	ns->reused_node_count += i;
+
+	if (i < count)
+	{
+		r = arena_alloc(ns->arena, (count - i)*sizeof(*r));
+		ns->allocated_node_count += count - i;
+		ns->arena_node_count += count - i;
+		for (; i < count; ++i, ++r)
+		{
+			r->sn = ++ns->sn_counter;
+			r->right_addr = &(r->right);
+			r->left_addr = &(r->left);
+			nodes[i] = r;
+		}
+	}
+
+	for (i = 0; i < count; ++i)
+	{
+		r = nodes[i];
+		r->typ = APPLICATION;
+		r->name = "@";
+		r->right = r->left = NULL;
+		r->updateable = NULL;
+		r->refcnt = 0;
+		r->tree_size = 0;
+		r->next_shared = NULL;
+		r->shared = 0;
+		r->permanent = 0;
+		r->digest = 0;
+		r->redexes = -1;
+		r->exclusive = 0;
+	}
+
+	live = ns->allocated_node_count - ns->free_list_count;
+	if (live > ns->peak_live_nodes)
+		ns->peak_live_nodes = live;
+	if (current_context->memory_limit && live > current_context->memory_limit)
+		ns->memory_limit_hit = 1;
+}
+
+/* With keep on, reset_node_allocation() leaves the arena, the
+ * free list and the counts alone, so nodes in use stay in use. */
+void
+keep_live_nodes(int keep)
+{
+	struct node_state *ns = current_context->nodes;
+	int live;
+
+	ns->live_nodes_kept = keep;
+
+	/* The kept graph might be what went over the limit. */
+	flush_pending_nodes();
+	live = ns->allocated_node_count - ns->free_list_count;
+	ns->memory_limit_hit = current_context->memory_limit && live > current_context->memory_limit;
+}
+
+int
+memory_limit_reached(void)
+{
+	struct node_state *ns = current_context->nodes;
+
+	return ns->memory_limit_hit;
+}
+
+/* Nodes in use, as "memory N" counts them */
+int
+live_node_count(void)
+{
+	struct node_state *ns = current_context->nodes;
+
+	return ns->allocated_node_count - ns->free_list_count;
+}
+
+/* Turn a malloc()ed application node into one that reduction
+ * won't free or write into: see copy_graph() in abbreviations.c */
+void
+make_permanent(struct node *r)
+{
+	struct node_state *ns = current_context->nodes;
+
+	r->sn = ++ns->sn_counter;
+	r->left_addr = &(r->left);
+	r->right_addr = &(r->right);
+	r->updateable = NULL;
+	r->refcnt = 1;
+	r->next_shared = NULL;
+	r->shared = 0;
+	r->permanent = 1;
+	r->digest = 0;
+	r->redexes = -1;
+	r->exclusive = 0;
+}
+
+void
+free_all_nodes(void)
+{
+	struct node_state *ns = current_context->nodes;
+	unsigned int i;
+
+	deallocate_arena(ns->arena);
+	ns->arena = NULL;
+	pthread_mutex_destroy(&ns->allocation_lock);
+	free(ns->free_stack);
+	ns->free_stack = NULL;
+	free(ns->copied_nodes);
+	ns->copied_nodes = NULL;
+	ns->copied_size = 0;
+	free(ns->share_table);
+	ns->share_table = NULL;
+	ns->share_table_size = ns->share_table_count = 0;
+	for (i = 0; i < ns->atom_table_size; ++i)
+	{
+		struct node *p, *next;
+		for (p = ns->atom_table[i]; p; p = next)
+		{
+			next = p->next_shared;
+			free(p);
+		}
+	}
+	free(ns->atom_table);
+	ns->atom_table = NULL;
+	ns->atom_table_size = ns->atom_table_count = 0;
+}
+
+static void
+create_cache_key(void)
+{
+	pthread_key_create(&cache_key, NULL);
+}
+
+struct node_state *
+new_node_state(void)
+{
+	struct node_state *ns = calloc(1, sizeof(*ns));
+
+	ns->arena = new_arena();
+	pthread_mutex_init(&ns->allocation_lock, NULL);
+	pthread_once(&cache_key_once, create_cache_key);
+
+	return ns;
 }
 
 void
 reset_node_allocation(void)
 {
-	if (!reduction_interrupted)
+	struct node_state *ns = current_context->nodes;
+
+	release_shared_nodes();
+
+	if (current_context->reduction_interrupted)
+	{
+		ns->pending_list = NULL;
+		ns->pending_count = 0;
+	} else
+		flush_pending_nodes();
+
+	/* A stopped reduction's graph lives in the arena. */
+	if (ns->live_nodes_kept)
+	{
+		ns->gc_abandoned = 0;
+		ns->gc_skip_counted = 0;
+		ns->memory_limit_hit = 0;
+		return;
+	}
+
+	if (!current_context->reduction_interrupted)
 	{
 		int free_list_cnt = 0;
-		struct node *p = node_free_list;
+		struct node *p = ns->node_free_list;
 
 		while (p)
 		{
 			++free_list_cnt;
-			if (debug_reduction)
+			if (current_context->debug_reduction)
 				fprintf(stderr, "Node %d, ref cnt %d on free list\n",
 					p->sn, p->refcnt);
 			p = p->right;
-			if (free_list_cnt > allocated_node_count) break;
+			if (free_list_cnt > ns->allocated_node_count) break;
 		}
 
-		if (free_list_cnt != allocated_node_count)
+		if (free_list_cnt != ns->allocated_node_count)
 			fprintf(stderr, "Allocated %d nodes, but found %s %d on free list\n",
-				allocated_node_count,
-				free_list_cnt >allocated_node_count? "at least": "only",
+				ns->allocated_node_count,
+				free_list_cnt >ns->allocated_node_count? "at least": "only",
 				free_list_cnt);
 	}
 
-	node_free_list = 0;
-	allocated_node_count = 0;
+	ns->node_free_list = 0;
+	ns->free_list_count = 0;
+	ns->allocated_node_count = 0;
+	ns->gc_trigger = 0;
+	ns->gc_abandoned = 0;
+	ns->gc_skip_counted = 0;
+	ns->memory_limit_hit = 0;
 
-	free_arena_contents(arena);
+	free_arena_contents(ns->arena);
 }
 
 struct node *
@@ -243,45 +950,237 @@ arena_copy_graph(struct node *p)
 	if (!p)
 		return r;
 
+	if (ATOM == p->typ)
+		return new_term(p->name, p->rule);
+
+	if (current_context->maximal_sharing)
+		/* rebuild bottom-up, so as to find any identical sub-trees */
+		return new_application(arena_copy_graph(p->left), arena_copy_graph(p->right));
+
 	r = new_node();
 
 	r->typ = p->typ;
 	r->name = p->name;
 	r->rule = p->rule;
 
-	if (p->typ == APPLICATION)
-	{
-		r->left = arena_copy_graph(p->left);
+	r->left = arena_copy_graph(p->left);
+	if (!r->left->permanent)
 		++r->left->refcnt;
-		r->right = arena_copy_graph(p->right);
+	r->right = arena_copy_graph(p->right);
+	if (!r->right->permanent)
 		++r->right->refcnt;
+
+	return r;
+}
+
+/* A copy of the graph below p that no other graph has any part of,
+ * so another thread can reduce it: abbreviation bodies get copied
+ * out of their permanent nodes, which reduction writes
+ * "updateable" into.  Nodes shared inside the graph stay shared.
+ * Flyweight atoms don't get written into, so they stay as they are.
+ * Like the garbage collector, it leaves forwarding pointers in the
+ * old nodes' next_shared fields, then clears them.  Don't call it
+ * with "share on", which uses next_shared for the unique table. */
+struct node *
+private_copy_graph(struct node *p)
+{
+	struct node_state *ns = current_context->nodes;
+	struct node *r = copy_private(p);
+
+	while (ns->copied_count > 0)
+		ns->copied_nodes[--ns->copied_count]->next_shared = NULL;
+
+	return r;
+}
+
+static struct node *
+copy_private(struct node *p)
+{
+	struct node_state *ns = current_context->nodes;
+	struct node *r;
+
+	if (ATOM == p->typ)
+		return p->permanent? p: new_term(p->name, p->rule);
+
+	if (p->next_shared)
+		return p->next_shared;
+
+	r = new_application(copy_private(p->left), copy_private(p->right));
+
+	if (ns->copied_count >= ns->copied_size)
+	{
+		ns->copied_size = ns->copied_size? 2*ns->copied_size: 256;
+		ns->copied_nodes = realloc(ns->copied_nodes, ns->copied_size*sizeof(ns->copied_nodes[0]));
 	}
+	ns->copied_nodes[ns->copied_count++] = p;
+	p->next_shared = r;
+
 	return r;
 }
 
-void
-free_node(struct node *node)
+/* Drop one reference to node. Returns 1 if that was
+ * the last reference, and node is now garbage. */
+static int
+release_node(struct node *node)
 {
-	if (NULL == node) return;  /* dummy root nodes have NULL right field */
+	if (NULL == node) return 0;  /* dummy root nodes have NULL right field */
+	if (node->permanent) return 0;
 
-	if (debug_reduction)
+	if (current_context->debug_reduction)
 		fprintf(stderr, "Freeing node %d, ref cnt %d\n",
 			node->sn, node->refcnt);
 
 	--node->refcnt;
 
 	if (node->refcnt == 0)
+		return 1;
+
+	if (0 > node->refcnt)
+		fprintf(stderr, "Freeing node %d, negative ref cnt %d\n",
+			node->sn, node->refcnt);
+
+	return 0;
+}
+
+static void
+push_free_node(struct node *node)
+{
+	struct node_state *ns = current_context->nodes;
+
+	if (ns->caches_active)
+	{
+		struct node_cache *c = pthread_getspecific(cache_key);
+		node->right = c->free_list;
+		c->free_list = node;
+		++c->count;
+		return;
+	}
+
+	node->right = ns->node_free_list;
+	ns->node_free_list = node;
+	++ns->free_list_count;
+}
+
+/* Put a garbage node and all of its newly garbage descendants
+ * on the free list, in the same order a recursive left-then-right
+ * walk would, but without using the C stack: a long spine of
+ * garbage would overflow it. */
+static void
+free_dead_nodes(struct node *node)
+{
+	struct node_state *ns = current_context->nodes;
+	struct free_frame **stackp = &ns->free_stack;
+	int *sizep = &ns->free_stack_size;
+	int top = 0;
+
+	if (ns->caches_active)
+	{
+		struct node_cache *c = pthread_getspecific(cache_key);
+		stackp = &c->free_stack;
+		sizep = &c->free_stack_size;
+	}
+
+	if (!*stackp)
+	{
+		*sizep = 256;
+		*stackp = malloc(*sizep*sizeof((*stackp)[0]));
+	}
+
+	(*stackp)[top].node = node;
+	(*stackp)[top++].next_child = 0;
+
+	while (top > 0)
+	{
+		struct free_frame *f = &(*stackp)[top - 1];
+		struct node *child = NULL;
+
+		if (APPLICATION == f->node->typ && f->next_child < 2)
+			child = f->next_child++? f->node->right: f->node->left;
+		else {
+			push_free_node(f->node);
+			--top;
+			continue;
+		}
+
+		if (release_node(child))
+		{
+			if (top >= *sizep)
+			{
+				*sizep *= 2;
+				*stackp = realloc(*stackp, *sizep*sizeof((*stackp)[0]));
+			}
+			(*stackp)[top].node = child;
+			(*stackp)[top++].next_child = 0;
+		}
+	}
+}
+
+/* Lazy reclamation: take apart a bounded number of nodes
+ * from the pending list, dropping their references to
+ * their children, and putting them on the free list. */
+static void
+reclaim_pending_nodes(int count)
+{
+	struct node_state *ns = current_context->nodes;
+
+	while (ns->pending_list && count--)
 	{
+		struct node *node = ns->pending_list;
+
+		ns->pending_list = node->next_shared;
+		node->next_shared = NULL;
+		--ns->pending_count;
+
 		if (APPLICATION == node->typ)
 		{
-			free_node(node->left);
-			free_node(node->right);
+			struct node *children[2];
+			int i;
+
+			children[0] = node->left;
+			children[1] = node->right;
+
+			for (i = 0; i < 2; ++i)
+			{
+				if (release_node(children[i]))
+				{
+					children[i]->next_shared = ns->pending_list;
+					ns->pending_list = children[i];
+					++ns->pending_count;
+				}
+			}
 		}
-		node->right = node_free_list;
-		node_free_list = node;
-	} else if (0 > node->refcnt)
-		fprintf(stderr, "Freeing node %d, negative ref cnt %d\n",
-			node->sn, node->refcnt);
+
+		push_free_node(node);
+	}
+}
+
+/* Finish off all lazy reclamation. Until this happens, a pending
+ * node's children have reference counts one too high. */
+void
+flush_pending_nodes(void)
+{
+	struct node_state *ns = current_context->nodes;
+
+	while (ns->pending_list)
+		reclaim_pending_nodes(ns->pending_count);
+}
+
+void
+free_node(struct node *node)
+{
+	struct node_state *ns = current_context->nodes;
+
+	if (!release_node(node))
+		return;
+
+	if (current_context->lazy_reclamation && !ns->caches_active)
+	{
+		/* new_node() takes it apart later */
+		node->next_shared = ns->pending_list;
+		ns->pending_list = node;
+		++ns->pending_count;
+	} else
+		free_dead_nodes(node);
 }
 
 void
@@ -326,6 +1225,7 @@ new_abs_node(const char *label)
 	r->left = r->right = NULL;
 	r->typ = abs_LEAF;
 	r->label = label;
+	r->rule = NULL;
 	r->abstracted = 0;
 	return r;
 }
@@ -399,21 +1299,244 @@ free_abs_node(struct abs_node *tree)
 void
 preallocate_nodes(int pre_node_count)
 {
+	struct node_state *ns = current_context->nodes;
 	size_t sz = pre_node_count * sizeof(struct node);
-	struct node *node_ary = arena_alloc(arena, sz);
+	struct node *node_ary = arena_alloc(ns->arena, sz);
 	int i;
 
-	allocated_node_count += pre_node_count;
+	ns->allocated_node_count += pre_node_count;
+	ns->arena_node_count += pre_node_count;
 
 	for (i = 0; i < pre_node_count; ++i)
 	{
 		struct node *n = &node_ary[i];
-		n->sn = ++sn_counter;
+		n->sn = ++ns->sn_counter;
 		n->right_addr = &(n->right);
 		n->left_addr = &(n->left);
 		n->right = &node_ary[i+1];
 		n->tree_size = 0;
 	}
-	node_ary[pre_node_count - 1].right = node_free_list;
-	node_free_list = &node_ary[0];
+	node_ary[pre_node_count - 1].right = ns->node_free_list;
+	ns->node_free_list = &node_ary[0];
+	ns->free_list_count += pre_node_count;
+}
+
+/* Copy one struct node into the to-space arena, leaving a
+ * forwarding pointer in the old node's next_shared field.
+ * Nothing can be in the unique table while collecting, so
+ * next_shared is otherwise NULL. */
+static struct node *
+forward_node(struct memory_arena *to_space, struct node *old)
+{
+	struct node *n = arena_alloc(to_space, sizeof(*n));
+
+	*n = *old;
+	n->left_addr = &(n->left);
+	n->right_addr = &(n->right);
+	if (old->updateable == old->left_addr)
+		n->updateable = n->left_addr;
+	else if (old->updateable == old->right_addr)
+		n->updateable = n->right_addr;
+	else
+		n->updateable = NULL;
+	n->next_shared = NULL;
+
+	old->next_shared = n;
+
+	return n;
+}
+
+struct gc_work {
+	struct node *from;
+	struct node **to;
+};
+
+/* Returns 1 and updates *root and the spine stack if it moved
+ * all the live nodes into a new arena, 0 if it didn't collect. */
+int
+collect_garbage(struct node **root, struct spine_stack *stack)
+{
+	struct node_state *ns = current_context->nodes;
+	struct memory_arena *to_space;
+	struct gc_work *work;
+	struct node **forwarded;
+	struct node *new_root = NULL;
+	int work_size, work_top = 0, copied = 0, live, i;
+	struct timeval before, after;
+	sigset_t block, old_mask;
+	double pause;
+
+	if (0 == ns->gc_trigger)
+		ns->gc_trigger = current_context->gc_threshold;
+
+	if (ns->allocated_node_count < ns->gc_trigger)
+		return 0;
+
+	/* Copying would leave the "share on" table, or whatever refers
+	 * to nodes from outside the graph, pointing into the old arena. */
+	if (ns->gc_abandoned || ns->share_table_count)
+	{
+		if (!ns->gc_skip_counted)
+		{
+			ns->gc_skip_counted = 1;
+			if (ns->share_table_count)
+				++ns->gc_skipped_shared;
+			else
+				++ns->gc_skipped_roots;
+		}
+		return 0;
+	}
+
+	/* Pending nodes are neither live nor on the free list. */
+	flush_pending_nodes();
+
+	/* Control-C or a timeout in the middle of copying would
+	 * leave the graph half in one arena, half in the other. */
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGALRM);
+	sigprocmask(SIG_BLOCK, &block, &old_mask);
+
+	gettimeofday(&before, NULL);
+
+	live = ns->allocated_node_count - ns->free_list_count;
+	to_space = new_arena();
+	forwarded = malloc((live + 1)*sizeof(forwarded[0]));
+	work_size = 64;
+	work = malloc(work_size*sizeof(work[0]));
+
+	work[work_top].from = *root;
+	work[work_top++].to = &new_root;
+
+	while (work_top > 0)
+	{
+		struct node *from = work[--work_top].from;
+		struct node **to = work[work_top].to;
+		struct node *n;
+
+		if (NULL == from || from->permanent)
+		{
+			*to = from;  /* flyweight atoms don't move */
+			continue;
+		}
+
+		if (from->next_shared)
+		{
+			*to = from->next_shared;
+			continue;
+		}
+
+		if (copied >= live)
+		{
+			++copied;  /* more reachable than allocated: give up */
+			break;
+		}
+
+		*to = n = forward_node(to_space, from);
+		forwarded[copied++] = from;
+
+		if (APPLICATION == n->typ)
+		{
+			if (work_top + 2 > work_size)
+			{
+				work_size *= 2;
+				work = realloc(work, work_size*sizeof(work[0]));
+			}
+			/* push right first, so that the left branch gets copied first */
+			work[work_top].from = from->right;
+			work[work_top++].to = &(n->right);
+			work[work_top].from = from->left;
+			work[work_top++].to = &(n->left);
+		}
+	}
+
+	free(work);
+
+	if (copied != live)
+	{
+		/* Something outside the graph still refers to nodes in
+		 * the arena. Undo the forwarding, and quit trying until
+		 * the next read-eval-print loop. */
+		for (i = 0; i < copied && i < live; ++i)
+			forwarded[i]->next_shared = NULL;
+		free(forwarded);
+		deallocate_arena(to_space);
+		ns->gc_abandoned = 1;
+		if (!ns->gc_skip_counted)
+		{
+			ns->gc_skip_counted = 1;
+			++ns->gc_skipped_roots;
+		}
+		sigprocmask(SIG_SETMASK, &old_mask, NULL);
+		return 0;
+	}
+
+	for (i = 0; i < stack->top; ++i)
+		if (!stack->stack[i].node->permanent)
+			stack->stack[i].node = stack->stack[i].node->next_shared;
+	*root = new_root;
+
+	free(forwarded);
+	deallocate_arena(ns->arena);
+	ns->arena = to_space;
+	ns->node_free_list = NULL;
+	ns->free_list_count = 0;
+	ns->allocated_node_count = copied;
+
+	ns->gc_trigger = 2*copied > current_context->gc_threshold? 2*copied: current_context->gc_threshold;
+
+	gettimeofday(&after, NULL);
+	pause = (double)(after.tv_sec - before.tv_sec)
+		+ 1.0E-6*(double)(after.tv_usec - before.tv_usec);
+
+	++ns->gc_count;
+	ns->gc_bytes_copied += copied*sizeof(struct node);
+	ns->gc_total_pause += pause;
+	if (pause > ns->gc_max_pause)
+		ns->gc_max_pause = pause;
+
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+	return 1;
+}
+
+/* Called by the "gc" interpreter command. */
+void
+print_gc_statistics(void)
+{
+	struct node_state *ns = current_context->nodes;
+
+	printf("collect after %d nodes allocated\n", current_context->gc_threshold);
+	printf("%d collections, %lu bytes copied\n", ns->gc_count, ns->gc_bytes_copied);
+	printf("pause time %.3f seconds total, %.3f seconds longest\n",
+		ns->gc_total_pause, ns->gc_max_pause);
+	print_gc_skips();
+}
+
+/* For "gc" and "memstats", once any collection got skipped */
+static void
+print_gc_skips(void)
+{
+	struct node_state *ns = current_context->nodes;
+
+	if (ns->gc_skipped_shared || ns->gc_skipped_roots)
+		printf("gc skipped (shared table / external roots): %d / %d reductions\n",
+			ns->gc_skipped_shared, ns->gc_skipped_roots);
+}
+
+void
+print_node_statistics(void)
+{
+	struct node_state *ns = current_context->nodes;
+	size_t reserved, resident, used, peak;
+
+	printf("nodes: %d requested, %d allocated from arena, %d reused from free list\n",
+		ns->new_node_cnt, ns->arena_node_count, ns->reused_node_count);
+	printf("nodes: %d allocated in current arena, %d on free list, %d in use at peak\n",
+		ns->allocated_node_count, ns->free_list_count, ns->peak_live_nodes);
+	arena_statistics(ns->arena, &reserved, &resident, &used, &peak);
+	printf("arena: %lu bytes reserved, %lu bytes resident, %lu bytes used, %lu bytes reserved at peak\n",
+		(unsigned long)reserved, (unsigned long)resident,
+		(unsigned long)used, (unsigned long)peak);
+	print_gc_skips();
 }
@@ -32,8 +32,15 @@ struct node {
 	struct node **left_addr;
 	struct node **right_addr;
 	int refcnt;
-	struct reduction_rule *rule;
 	int tree_size;
+	struct reduction_rule *rule;
+	struct node *next_shared;  /* hash chain when maximal sharing is on */
+	int shared;                /* non-zero while in the unique table */
+	int permanent;             /* flyweight atom, never freed */
+	unsigned long digest;      /* structural hash, see cycle_detector.c */
+	int redexes;               /* redexes in the subtree, see census() in graph.c */
+	int args_wanted;           /* arguments its head needs to make a redex */
+	int exclusive;             /* subtree checked for -j, see exclusive_argument() */
 };
 
 /* struct abs_node: similar data structure created
@@ -53,16 +60,40 @@ struct abs_node {
 };
 
 struct node *new_application(struct node *left_child, struct node *right_child);
-struct node *new_term(const char *name);
+struct node *new_term(const char *name, struct reduction_rule *rule);
+void new_application_batch(struct node **nodes, int count);
+
+struct node_cache;
+struct node_cache *new_node_cache(void);
+void use_node_cache(struct node_cache *c);
+void activate_node_caches(int on);
+void drain_node_cache(struct node_cache *c);
+void free_node_cache(struct node_cache *c);
+struct node *flyweight_atom(const char *name, struct reduction_rule *rule);
+void make_permanent(struct node *node);
 void preallocate_nodes(int preallocated_count);
 
-void init_node_allocation(void);
+struct node_state;
+struct node_state *new_node_state(void);
 void reset_node_allocation(void);
+void keep_live_nodes(int keep);
 void print_tree(struct node *root, int reduction_node_sn, int current_node_sn);
 void free_all_nodes(void);
 void free_node(struct node *root);
+void flush_pending_nodes(void);
+int  memory_limit_reached(void);
+int  live_node_count(void);
 
 struct node *arena_copy_graph(struct node *root);
+struct node *private_copy_graph(struct node *root);
+
+void unshare_node(struct node *node);
+int  allocations_avoided(void);
+
+struct spine_stack;
+int  collect_garbage(struct node **root, struct spine_stack *stack);
+void print_gc_statistics(void);
+void print_node_statistics(void);
 
 int var_in_tree(struct node *tree, const char *var_name);
 int any_var_in_tree(struct node *tree);
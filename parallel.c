@@ -0,0 +1,602 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Parallel normal form completion, for "-j N".
+ *
+ * When reduction finds the head of a spine in normal form, the spine's
+ * arguments constitute independent problems: nothing that happens
+ * to one of them can change the others.  reduce_arguments() hands the
+ * arguments to a pool of threads, waits for all of them to reach
+ * normal form, then marks the spine's application nodes so that
+ * the reduction loop doesn't go right into them again.  Since
+ * combinatory logic is confluent, the normal form comes out the
+ * same as sequential normal order reduction would find it.
+ *
+ * An argument only gets handed out if its thread can have it to itself:
+ * every application node in it has a reference count of 1, and
+ * isn't permanent (part of an abbreviation) or in the unique table.
+ * Atoms have to be flyweights, which nothing writes into.  Arguments
+ * that share nodes get reduced by the usual loop afterwards.  Once
+ * a subtree passes that check, its nodes get marked "exclusive",
+ * and later checks don't go below a marked node.  The reduction
+ * loop takes the mark off any node it goes down from, since only
+ * contractions below a node can give the nodes under it more
+ * references.  So nested head normal forms don't walk the same
+ * unchanged arguments over and over again.
+ *
+ * Each thread, including the one that started the reduction, has a
+ * deque of tasks, with a lock of its own.  A thread takes tasks
+ * from the bottom of its own deque, and steals them from the top of
+ * other threads' deques.  A thread waiting for its tasks to finish
+ * runs other tasks meanwhile, so arguments of arguments get reduced
+ * in parallel too.  The pool's lock only covers going to sleep and
+ * waking up, task group counts and shutting down.  Threads allocate
+ * from per-thread node caches while any of this happens.
+ *
+ * Signals go to the thread that started the reduction.  The signal
+ * handler calls stop_reduction(), and every thread's reduction loop
+ * quits at the top of its next iteration.  Arguments that didn't get
+ * finished lose their "done" marks, so the reduction loop, or a later
+ * resume_graph(), goes back into them.
+ *
+ * reduce_expressions() hands out whole top-level expressions the same
+ * way, for batches of expressions read from a file.  grammar.y makes
+ * sure those have no nodes in common.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include <setjmp.h>
+
+#include <node.h>
+#include <spine_stack.h>
+#include <reduction_rule.h>
+#include <buffer.h>
+#include <graph.h>
+#include <parallel.h>
+#include <context.h>
+
+enum graphReductionResult reduce_argument(struct node *parent,
+	unsigned long *contractions, unsigned long *shared_contractions);
+enum graphReductionResult reduce_expression(struct node *root,
+	unsigned long *contractions, unsigned long *shared_contractions);
+
+struct task_group {
+	int pending;     /* tasks not finished yet */
+};
+
+struct reduction_task {
+	struct node *parent;   /* reduce parent->right */
+	struct task_group *group;
+	/* Non-NULL for a top-level expression: reduce parent->left,
+	 * parent being its dummy root, and put the outcome here. */
+	enum graphReductionResult *result;
+};
+
+struct worker {
+	pthread_t thread;
+	struct acl_context *context;   /* the pool's */
+	pthread_mutex_t deque_lock;    /* covers tasks, top, bottom and size */
+	struct reduction_task *tasks;  /* deque: tasks[top] through tasks[bottom - 1] */
+	int top, bottom, size;
+	struct node_cache *cache;
+	struct node **registers;       /* for perform_reduction() */
+	int register_count;
+	unsigned long contractions;
+	unsigned long shared_contractions;
+	struct node **scratch;         /* for exclusive_argument() */
+	int scratch_size;
+	struct node **checked;         /* for exclusive_argument() */
+	int checked_size;
+	struct node **candidates;      /* for reduce_arguments() */
+	int candidates_size;
+};
+
+/* One interpreter context's thread pool, see context.h */
+struct pool_state {
+	/* workers[0] belongs to the thread that calls reduce_graph() */
+	struct worker *workers;
+	int worker_count;
+
+	/* pool_lock covers idle, task groups and pool_shutdown.
+	 * Nothing takes it while holding a deque_lock. */
+	pthread_mutex_t pool_lock;
+	pthread_cond_t pool_wakeup;
+	int idle;      /* threads waiting on pool_wakeup */
+	int pool_shutdown;
+
+	int running;   /* reduce_arguments() in progress */
+};
+
+/* Each thread's struct worker, in whichever pool it works for */
+static pthread_key_t worker_key;
+static pthread_once_t worker_key_once = PTHREAD_ONCE_INIT;
+static void  create_worker_key(void);
+
+static void  start_workers(void);
+static void  enter_parallel(void);
+static void  leave_parallel(void);
+static void  push_task(struct worker *w, struct node *parent,
+	struct task_group *group, enum graphReductionResult *result);
+static void  wake_workers(void);
+static void  finish_group(struct worker *w, struct task_group *group);
+static void *worker_main(void *arg);
+static int   take_task(struct worker *w, struct reduction_task *t);
+static int   tasks_waiting(void);
+static void  run_task(struct worker *w, struct reduction_task *t);
+static int   exclusive_argument(struct worker *w, struct node *n);
+
+struct pool_state *
+new_pool_state(void)
+{
+	struct pool_state *ps = calloc(1, sizeof(*ps));
+
+	pthread_mutex_init(&ps->pool_lock, NULL);
+	pthread_cond_init(&ps->pool_wakeup, NULL);
+	pthread_once(&worker_key_once, create_worker_key);
+
+	return ps;
+}
+
+static void
+create_worker_key(void)
+{
+	pthread_key_create(&worker_key, NULL);
+}
+
+int
+reduce_arguments(struct spine_stack *stack)
+{
+	struct pool_state *ps = current_context->pool;
+	struct worker *w;
+	struct task_group group;
+	int outermost = !ps->running;
+	int depth = DEPTH(stack);
+	int i, n = 0;
+
+	/* Spine application nodes have depths 2 through depth - 1 */
+	if (depth < 4)
+		return 0;
+
+	if (!ps->workers)
+		start_workers();
+	/* This thread might have worked for another context's pool */
+	w = outermost? &ps->workers[0]: pthread_getspecific(worker_key);
+
+	if (w->candidates_size < depth)
+	{
+		w->candidates_size = 2*depth;
+		w->candidates = realloc(w->candidates, w->candidates_size*sizeof(w->candidates[0]));
+	}
+	for (i = 1; i < depth - 1; ++i)
+		if (exclusive_argument(w, PARENTNODE(stack, i)))
+			w->candidates[n++] = PARENTNODE(stack, i);
+	if (n < 2)
+		return 0;
+
+	if (outermost)
+		enter_parallel();
+
+	group.pending = n;
+
+	pthread_mutex_lock(&w->deque_lock);
+	for (i = 0; i < n; ++i)
+	{
+		struct node *parent = w->candidates[i];
+
+		/* the reduction loop goes up from here, not right */
+		parent->updateable = parent->right_addr;
+
+		push_task(w, parent, &group, NULL);
+	}
+	pthread_mutex_unlock(&w->deque_lock);
+	finish_group(w, &group);
+
+	if (outermost)
+		leave_parallel();
+
+	/* Some arguments might not have reached normal form */
+	if (reduction_stopped())
+		for (i = 0; i < n; ++i)
+			w->candidates[i]->updateable = w->candidates[i]->left_addr;
+
+	return 1;
+}
+
+/* Reduce roots[i]->left, for i from 0 to n - 1, each a top-level
+ * expression under its dummy root, on all the threads at once.
+ * No two expressions can share a node, other than flyweight atoms.
+ * results[i] stays as it was if a signal stops the batch before
+ * roots[i] gets started. */
+void
+reduce_expressions(struct node **roots, enum graphReductionResult *results, int n)
+{
+	struct pool_state *ps = current_context->pool;
+	struct worker *w;
+	struct task_group group;
+	int i;
+
+	if (!ps->workers)
+		start_workers();
+	w = &ps->workers[0];
+
+	enter_parallel();
+
+	group.pending = n;
+
+	/* This thread works from the bottom of its deque, so
+	 * the first expressions go in last: they start first. */
+	pthread_mutex_lock(&w->deque_lock);
+	for (i = n - 1; i >= 0; --i)
+		push_task(w, roots[i], &group, &results[i]);
+	pthread_mutex_unlock(&w->deque_lock);
+	finish_group(w, &group);
+
+	leave_parallel();
+}
+
+/* Every thread allocates from its own node cache, and
+ * compiled rules use per-thread registers, from here until
+ * leave_parallel(). */
+static void
+enter_parallel(void)
+{
+	struct pool_state *ps = current_context->pool;
+	int i;
+
+	/* rules may have come along since the last time */
+	for (i = 0; i < ps->worker_count; ++i)
+		if (ps->workers[i].register_count < rule_register_count())
+		{
+			ps->workers[i].register_count = rule_register_count();
+			ps->workers[i].registers = realloc(ps->workers[i].registers,
+				ps->workers[i].register_count*sizeof(ps->workers[i].registers[0]));
+		}
+	ps->running = 1;
+	pthread_setspecific(worker_key, &ps->workers[0]);
+	use_node_cache(ps->workers[0].cache);
+	activate_node_caches(1);
+	private_rule_registers(1);
+}
+
+static void
+leave_parallel(void)
+{
+	struct pool_state *ps = current_context->pool;
+	int i;
+
+	activate_node_caches(0);
+	private_rule_registers(0);
+	for (i = 0; i < ps->worker_count; ++i)
+	{
+		drain_node_cache(ps->workers[i].cache);
+		current_context->contraction_count += ps->workers[i].contractions;
+		ps->workers[i].contractions = 0;
+		current_context->shared_contraction_count += ps->workers[i].shared_contractions;
+		ps->workers[i].shared_contractions = 0;
+	}
+	ps->running = 0;
+}
+
+/* Called with w's deque_lock held: a task goes on the bottom of w's deque. */
+static void
+push_task(
+	struct worker *w,
+	struct node *parent,
+	struct task_group *group,
+	enum graphReductionResult *result
+)
+{
+	if (w->bottom >= w->size)
+	{
+		w->size = w->size? 2*w->size: 16;
+		w->tasks = realloc(w->tasks, w->size*sizeof(w->tasks[0]));
+	}
+	w->tasks[w->bottom].parent = parent;
+	w->tasks[w->bottom].group = group;
+	w->tasks[w->bottom].result = result;
+	++w->bottom;
+}
+
+/* New tasks went on a deque: idle threads should go look. */
+static void
+wake_workers(void)
+{
+	struct pool_state *ps = current_context->pool;
+
+	pthread_mutex_lock(&ps->pool_lock);
+	if (ps->idle > 0)
+		pthread_cond_broadcast(&ps->pool_wakeup);
+	pthread_mutex_unlock(&ps->pool_lock);
+}
+
+/* Wakes the other threads, then runs tasks until all
+ * of group's are done. */
+static void
+finish_group(struct worker *w, struct task_group *group)
+{
+	struct pool_state *ps = current_context->pool;
+	struct reduction_task t;
+	int done;
+
+	wake_workers();
+
+	for (;;)
+	{
+		pthread_mutex_lock(&ps->pool_lock);
+		done = 0 == group->pending;
+		pthread_mutex_unlock(&ps->pool_lock);
+		if (done)
+			break;
+
+		if (take_task(w, &t))
+		{
+			run_task(w, &t);
+			continue;
+		}
+
+		/* A task pushed after tasks_waiting() looks can't
+		 * get lost: wake_workers() has to wait for pool_lock. */
+		pthread_mutex_lock(&ps->pool_lock);
+		if (group->pending > 0 && !tasks_waiting())
+		{
+			++ps->idle;
+			pthread_cond_wait(&ps->pool_wakeup, &ps->pool_lock);
+			--ps->idle;
+		}
+		pthread_mutex_unlock(&ps->pool_lock);
+	}
+}
+
+/* Can parent->right get reduced by another thread?  Doesn't
+ * look at anything another thread might be changing: the
+ * arguments of a spine all get checked before any get
+ * handed out, and a thread only looks inside its own task.
+ * A node marked exclusive has had nothing change below it
+ * since its subtree passed, so only the node itself needs
+ * another look: a contraction elsewhere could have given
+ * it another reference. */
+static int
+exclusive_argument(struct worker *w, struct node *parent)
+{
+	int top = 0, checked = 0;
+
+	if (parent->permanent || parent->shared || APPLICATION != parent->right->typ)
+		return 0;
+
+	w->scratch[top++] = parent->right;
+
+	while (top > 0)
+	{
+		struct node *n = w->scratch[--top];
+
+		if (ATOM == n->typ)
+		{
+			if (!n->permanent)
+				return 0;
+			continue;
+		}
+
+		if (n->refcnt != 1 || n->permanent || n->shared)
+			return 0;
+
+		if (n->exclusive)
+			continue;
+
+		if (checked >= w->checked_size)
+		{
+			w->checked_size *= 2;
+			w->checked = realloc(w->checked, w->checked_size*sizeof(w->checked[0]));
+		}
+		w->checked[checked++] = n;
+
+		if (top + 2 > w->scratch_size)
+		{
+			w->scratch_size *= 2;
+			w->scratch = realloc(w->scratch, w->scratch_size*sizeof(w->scratch[0]));
+		}
+		w->scratch[top++] = n->right;
+		w->scratch[top++] = n->left;
+	}
+
+	while (checked > 0)
+		w->checked[--checked]->exclusive = 1;
+
+	return 1;
+}
+
+/* Own tasks come off the bottom of the deque,
+ * stolen tasks off the top of another's. */
+static int
+take_task(struct worker *w, struct reduction_task *t)
+{
+	struct pool_state *ps = current_context->pool;
+	int i, found = 0;
+
+	pthread_mutex_lock(&w->deque_lock);
+	if (w->bottom > w->top)
+	{
+		*t = w->tasks[--w->bottom];
+		if (w->bottom == w->top)
+			w->bottom = w->top = 0;
+		found = 1;
+	}
+	pthread_mutex_unlock(&w->deque_lock);
+
+	for (i = 1; !found && i < ps->worker_count; ++i)
+	{
+		struct worker *victim = &ps->workers[(w - ps->workers + i) % ps->worker_count];
+
+		pthread_mutex_lock(&victim->deque_lock);
+		if (victim->bottom > victim->top)
+		{
+			*t = victim->tasks[victim->top++];
+			if (victim->bottom == victim->top)
+				victim->bottom = victim->top = 0;
+			found = 1;
+		}
+		pthread_mutex_unlock(&victim->deque_lock);
+	}
+
+	return found;
+}
+
+/* Called with pool_lock held: does any deque have a task in it? */
+static int
+tasks_waiting(void)
+{
+	struct pool_state *ps = current_context->pool;
+	int i, r = 0;
+
+	for (i = 0; !r && i < ps->worker_count; ++i)
+	{
+		pthread_mutex_lock(&ps->workers[i].deque_lock);
+		r = ps->workers[i].bottom > ps->workers[i].top;
+		pthread_mutex_unlock(&ps->workers[i].deque_lock);
+	}
+
+	return r;
+}
+
+static void
+run_task(struct worker *w, struct reduction_task *t)
+{
+	struct pool_state *ps = current_context->pool;
+
+	if (!reduction_stopped())
+	{
+		use_rule_registers(w->registers);
+		if (t->result)
+			*t->result = reduce_expression(t->parent,
+				&w->contractions, &w->shared_contractions);
+		else
+			reduce_argument(t->parent, &w->contractions, &w->shared_contractions);
+	}
+
+	pthread_mutex_lock(&ps->pool_lock);
+	if (0 == --t->group->pending && ps->idle > 0)
+		pthread_cond_broadcast(&ps->pool_wakeup);
+	pthread_mutex_unlock(&ps->pool_lock);
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct pool_state *ps = w->context->pool;
+	struct reduction_task t;
+
+	use_acl_context(w->context);
+	pthread_setspecific(worker_key, w);
+	use_node_cache(w->cache);
+
+	for (;;)
+	{
+		int shutdown;
+
+		if (take_task(w, &t))
+		{
+			run_task(w, &t);
+			continue;
+		}
+
+		pthread_mutex_lock(&ps->pool_lock);
+		shutdown = ps->pool_shutdown;
+		if (!shutdown && !tasks_waiting())
+		{
+			++ps->idle;
+			pthread_cond_wait(&ps->pool_wakeup, &ps->pool_lock);
+			--ps->idle;
+		}
+		pthread_mutex_unlock(&ps->pool_lock);
+
+		if (shutdown)
+			break;
+	}
+
+	return NULL;
+}
+
+/* The calling thread becomes workers[0].  The others
+ * start with signals blocked, so signals go to it. */
+static void
+start_workers(void)
+{
+	struct pool_state *ps = current_context->pool;
+	sigset_t all, old;
+	int i;
+
+	ps->worker_count = current_context->parallel_jobs;
+	ps->workers = calloc(ps->worker_count, sizeof(ps->workers[0]));
+
+	for (i = 0; i < ps->worker_count; ++i)
+	{
+		ps->workers[i].context = current_context;
+		ps->workers[i].cache = new_node_cache();
+		ps->workers[i].scratch_size = 256;
+		ps->workers[i].scratch = malloc(ps->workers[i].scratch_size*sizeof(ps->workers[i].scratch[0]));
+		ps->workers[i].checked_size = 256;
+		ps->workers[i].checked = malloc(ps->workers[i].checked_size*sizeof(ps->workers[i].checked[0]));
+		pthread_mutex_init(&ps->workers[i].deque_lock, NULL);
+	}
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	for (i = 1; i < ps->worker_count; ++i)
+		pthread_create(&ps->workers[i].thread, NULL, worker_main, &ps->workers[i]);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+void
+stop_workers(void)
+{
+	struct pool_state *ps = current_context->pool;
+	int i;
+
+	if (!ps->workers)
+		return;
+
+	pthread_mutex_lock(&ps->pool_lock);
+	ps->pool_shutdown = 1;
+	pthread_cond_broadcast(&ps->pool_wakeup);
+	pthread_mutex_unlock(&ps->pool_lock);
+
+	for (i = 1; i < ps->worker_count; ++i)
+		pthread_join(ps->workers[i].thread, NULL);
+
+	for (i = 0; i < ps->worker_count; ++i)
+	{
+		free_node_cache(ps->workers[i].cache);
+		free(ps->workers[i].tasks);
+		free(ps->workers[i].scratch);
+		free(ps->workers[i].checked);
+		pthread_mutex_destroy(&ps->workers[i].deque_lock);
+		free(ps->workers[i].registers);
+		free(ps->workers[i].candidates);
+	}
+	free(ps->workers);
+	ps->workers = NULL;
+	ps->worker_count = 0;
+	ps->pool_shutdown = 0;
+}
@@ -26,4 +26,20 @@
  * Enum names have a value assigned so as to use them as array indexes, too.
  */
 
-enum OutputModifierCommands {DEBUG_O = 0, ELABORATE_O = 1, TRACE_O = 2, TIME_O = 3, STEP_O = 4, CYCLES_O = 5, DETECT_O = 6};
+/*
+ * The makefile runs "yacc -p acl_yy" and "lex -Pacl_yy", so that libacl
+ * doesn't collide with a program's own parser.  Code outside the
+ * generated files uses these names for the parser's and scanner's
+ * globals through the macros below.
+ */
+#define yyparse acl_yyparse
+#define yydebug acl_yydebug
+#define yylval  acl_yylval
+#define yyin    acl_yyin
+
+enum OutputModifierCommands {DEBUG_O = 0, ELABORATE_O = 1, TRACE_O = 2, TIME_O = 3, STEP_O = 4, CYCLES_O = 5, DETECT_O = 6, SHARE_O = 7, LAZY_O = 8};
+
+/* The parser's part of an interpreter context, see context.h */
+struct interpreter_state;
+struct interpreter_state *new_interpreter_state(void);
+void free_interpreter_state(void);
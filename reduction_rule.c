@@ -20,40 +20,72 @@
 */
 #include <stdio.h>
 #include <stdlib.h>
-
+#include <pthread.h>
+#include <setjmp.h>
 
 #include <node.h>
+#include <hashtable.h>
+#include <atom.h>
 #include <spine_stack.h>
 #include <reduction_rule.h>
+#include <image.h>
+#include <context.h>
 
 void print_reduction_rule(struct reduction_rule *rule);
 void print_reduction_tree(struct reduction_rule_node *tree);
 
 void free_reduction_rule(struct reduction_rule *rule);
 
-struct node *reduce_rule(
-	struct reduction_rule_node *rnode,
-	struct spine_stack *stack
-);
+static void compile_rule(struct reduction_rule *rule);
+static int compile_rule_node(struct reduction_rule *rule, struct reduction_rule_node *rnode);
+static struct node *copy_permanent_spine(struct spine_stack *stack, int idx);
+static void overwrite_redex(struct node *redex, struct node *n);
+static void save_reduction_tree(FILE *out, struct reduction_rule_node *node);
+static struct reduction_rule_node *load_reduction_tree(struct image *im, int required_depth);
+
+/* Under "-j N", each thread has a register file of its own. */
+static pthread_key_t registers_key;
+static pthread_once_t registers_once = PTHREAD_ONCE_INIT;
+static void create_registers_key(void);
+
+/* One interpreter context's rules, see context.h */
+struct rule_state {
+	/* **rules constitutes a dynamically resized array
+	 * of structs reduction_rule.
+	 */
+	struct reduction_rule **rules;
+	int number_of_rules;     /* How many elements of **rules in use. */
+	int max_number_of_rules; /* How many elements **rules has total. */
+
+	/* Register file for running compiled rules, big enough
+	 * for the rule with the most registers. Register 0 unused. */
+	struct node **registers;
+	int register_count;
 
-/* **rules constitutes a dynamically resized array
- * of structs reduction_rule.
- */
-struct reduction_rule **rules = NULL;
-int number_of_rules = 0;     /* How many elements of **rules in use. */
-int max_number_of_rules = 0; /* How many elements **rules has total. */
+	int registers_private;   /* threads use registers_key's */
+};
+
+struct rule_state *
+new_rule_state(void)
+{
+	return calloc(1, sizeof(struct rule_state));
+}
 
 void
 free_rules(void)
 {
+	struct rule_state *rs = current_context->rules;
 	int i;
-	for (i = 0; i < number_of_rules; ++i)
+	for (i = 0; i < rs->number_of_rules; ++i)
 	{
-		free_reduction_rule(rules[i]);
-		rules[i] = NULL;
+		free_reduction_rule(rs->rules[i]);
+		rs->rules[i] = NULL;
 	}
-	free(rules);
-	rules = NULL;
+	free(rs->rules);
+	rs->rules = NULL;
+	free(rs->registers);
+	rs->registers = NULL;
+	rs->register_count = 0;
 }
 
 void
@@ -63,6 +95,8 @@ free_reduction_rule(struct reduction_rule *rule)
 	rule->required_depth = 0;
 	free_reduction_tree(rule->result_tree);
 	rule->result_tree = NULL;
+	free(rule->code);
+	rule->code = NULL;
 	free(rule);
 	rule = NULL;
 }
@@ -115,102 +149,363 @@ print_reduction_tree(struct reduction_rule_node *node)
 	if (print_match_paren) printf(")");
 }
 
+/* The atom naming a primitive holds its struct reduction_rule.
+ * Redefining a primitive changes that struct in place: ATOM nodes,
+ * abbreviations and the index heap all point to it, so they pick
+ * up the new definition, and never point to freed memory.  Giving
+ * a name its first rule bumps rule_generation, so that abbreviations
+ * holding the name as an inert atom get updated. */
 void
 add_reduction_rule(struct reduction_rule *rule)
 {
-	if (number_of_rules >= max_number_of_rules)
+	struct rule_state *rs = current_context->rules;
+	int id = Atom_id(rule->name);
+	struct reduction_rule *prev = Atom_rule(id);
+
+	compile_rule(rule);
+
+	if (prev)
 	{
-		rules = realloc(rules, (max_number_of_rules + 4)*sizeof(*rules));
-		max_number_of_rules += 4;
+		struct reduction_rule old = *prev;
+		*prev = *rule;
+		*rule = old;
+		free_reduction_rule(rule);
+		return;
 	}
 
-	if (number_of_rules < max_number_of_rules)
+	if (rs->number_of_rules >= rs->max_number_of_rules)
 	{
-		struct reduction_rule *prev = get_reduction_rule(rule->name);
-		if (prev)
-		{
-			int i;
-			/* Hey, this looks through rules[] twice, once in get_reduction_rule(),
-			 * once right here.  Could trigger a bug if concurrent. */
-			for (i = 0; i < number_of_rules; ++i)
-			{
-				if (rules[i]->name == rule->name)
-				{
-					rules[i] = rule;
-					break;
-				}
-			}
-			free_reduction_rule(prev);
-			prev = NULL;
-		} else
-			rules[number_of_rules++] = rule;
+		rs->rules = realloc(rs->rules, (rs->max_number_of_rules + 4)*sizeof(*rs->rules));
+		rs->max_number_of_rules += 4;
 	}
+
+	rs->rules[rs->number_of_rules++] = rule;
+	Atom_bind_rule(id, rule);
+	++current_context->rule_generation;
 }
 
 struct reduction_rule *
 get_reduction_rule(const char *identifier)
 {
-	struct reduction_rule *r = NULL;
-	int idx;
-	for (idx = 0; idx < number_of_rules; ++idx)
+	return Atom_rule(Atom_id(identifier));
+}
+
+/* Turn rule->result_tree into a flat array of instructions,
+ * in post-order, so that perform_reduction() doesn't have to
+ * walk the tree for every contraction. */
+static void
+compile_rule(struct reduction_rule *rule)
+{
+	struct rule_state *rs = current_context->rules;
+	int needed;
+
+	rule->code = NULL;
+	rule->code_length = 0;
+	rule->result_register = compile_rule_node(rule, rule->result_tree);
+
+	needed = rule->required_depth + rule->code_length + 1;
+	if (needed > rs->register_count)
 	{
-		if (identifier == rules[idx]->name)
-		{
-			r = rules[idx];
-			break;
-		}
+		rs->registers = realloc(rs->registers, needed*sizeof(*rs->registers));
+		rs->register_count = needed;
 	}
-	return r;
 }
 
-struct node *
-reduce_rule(
-	struct reduction_rule_node *rnode,
-	struct spine_stack *stack
-)
+/* Returns the register that will hold the node for rnode. */
+static int
+compile_rule_node(struct reduction_rule *rule, struct reduction_rule_node *rnode)
+{
+	int func, arg, i;
+
+	if (rnode->combinator_argument_number)
+		return rnode->combinator_argument_number;
+
+	func = compile_rule_node(rule, rnode->func);
+	arg  = compile_rule_node(rule, rnode->arg);
+
+	/* A subtree seen already has the same registers as children. */
+	for (i = 0; i < rule->code_length; ++i)
+		if (rule->code[i].func == func && rule->code[i].arg == arg)
+			return rule->required_depth + 1 + i;
+
+	rule->code = realloc(rule->code, (rule->code_length + 1)*sizeof(*rule->code));
+	rule->code[rule->code_length].func = func;
+	rule->code[rule->code_length].arg  = arg;
+
+	return rule->required_depth + 1 + rule->code_length++;
+}
+
+int
+rule_register_count(void)
+{
+	struct rule_state *rs = current_context->rules;
+
+	return rs->register_count;
+}
+
+static void
+create_registers_key(void)
+{
+	pthread_key_create(&registers_key, NULL);
+}
+
+/* The calling thread's register file, while private ones are in use.
+ * It has to have rule_register_count() elements. */
+void
+use_rule_registers(struct node **r)
 {
-	struct node *n = NULL;
-	struct node *tmp = NULL;
+	pthread_once(&registers_once, create_registers_key);
+	pthread_setspecific(registers_key, r);
+}
 
-	if (0 == rnode->combinator_argument_number)
+void
+private_rule_registers(int on)
+{
+	struct rule_state *rs = current_context->rules;
+
+	rs->registers_private = on;
+}
+
+/* Stack element idx holds a permanent node (part of an abbreviation's
+ * body) that's about to get a new child.  Copy it, and the permanent
+ * nodes above it on the stack, linking each copy into its parent
+ * where the original was, so that the write doesn't change the
+ * abbreviation.  The dummy root node is never permanent. */
+static struct node *
+copy_permanent_spine(struct spine_stack *stack, int idx)
+{
+	int j = idx;
+
+	while (stack->stack[j - 1].node->permanent)
+		--j;
+
+	for (; j <= idx; ++j)
 	{
-		/* Application node in reduced tree */
-		n = new_application(
-			reduce_rule(rnode->func, stack),
-			reduce_rule(rnode->arg, stack)
-		);
-	} else {
-		/* Atom node in reduced tree */
-		tmp = PARENTNODE(stack, rnode->combinator_argument_number);
-		/* Reference counting takes care of common subexpressions. */
-		n = tmp->right;
+		struct node *old = stack->stack[j].node;
+		struct node *parent = stack->stack[j - 1].node;
+		struct node *copy = new_application(old->left, old->right);
+
+		copy->updateable = (old->updateable == old->left_addr)?
+			copy->left_addr: copy->right_addr;
+
+		/* parent's slot held old, which has no reference count */
+		*(parent->updateable) = copy;
+		++copy->refcnt;
+
+		stack->stack[j].node = copy;
 	}
 
-	return n;
+	return stack->stack[idx].node;
 }
 
 /* Assumes that the top-of-stack struct node is
- * the atomic primitive to be reduced. */
-void
+ * the atomic primitive to be reduced.  Returns 1 if the redex
+ * had other references, and got overwritten with its result. */
+int
 perform_reduction(struct spine_stack *stack)
 {
-	struct node *topnode = TOPNODE(stack);
+	struct rule_state *rs = current_context->rules;
+	struct reduction_rule *rule = TOPNODE(stack)->rule;
 	struct node *m = NULL, *n = NULL, *tmp = NULL;
+	struct node **regs = rs->registers;
+	int shared_redex;
+	int i;
+
+	tmp = PARENTNODE(stack, rule->required_depth);
+	m = PARENTNODE(stack, rule->required_depth - 1);
+
+	/* Other parents of a shared redex have to see the result too,
+	 * so it gets written over the redex instead of into m. */
+	shared_redex = !tmp->permanent && tmp->refcnt > 1;
+	if (!shared_redex)
+	{
+		if (m->permanent)
+			m = copy_permanent_spine(stack,
+				stack->top - rule->required_depth - 2);
+		unshare_node(m);  /* about to overwrite one of its children */
+	}
+
+	if (rs->registers_private)
+		regs = pthread_getspecific(registers_key);
+
+	/* Arguments go in registers once, then the result gets built
+	 * bottom up. Reference counting takes care of common subexpressions. */
+	for (i = 1; i <= rule->required_depth; ++i)
+		regs[i] = PARENTNODE(stack, i)->right;
+	if (rule->code_length > 0)
+	{
+		struct node **built = &regs[rule->required_depth + 1];
+		new_application_batch(built, rule->code_length);
+		for (i = 0; i < rule->code_length; ++i)
+		{
+			built[i]->left = regs[rule->code[i].func];
+			built[i]->right = regs[rule->code[i].arg];
+			if (!built[i]->left->permanent)
+				++built[i]->left->refcnt;
+			if (!built[i]->right->permanent)
+				++built[i]->right->refcnt;
+		}
+	}
+	n = regs[rule->result_register];
+
+	if (shared_redex)
+	{
+		overwrite_redex(tmp, n);
+		return 1;
+	}
 
-	tmp = PARENTNODE(stack, topnode->rule->required_depth);
-	m = PARENTNODE(stack, topnode->rule->required_depth - 1);
-	n = reduce_rule(topnode->rule->result_tree, stack);
 	*(m->updateable) = n;
-	++n->refcnt;
+	if (!n->permanent)
+		++n->refcnt;
 	free_node(tmp);
+
+	return 0;
+}
+
+/* Turn redex into a copy of the root of its result, n.
+ * Everything that pointed to redex now points to the result,
+ * and nobody contracts redex a second time. */
+static void
+overwrite_redex(struct node *redex, struct node *n)
+{
+	struct node *old_left = redex->left, *old_right = redex->right;
+
+	unshare_node(redex);
+
+	if (APPLICATION == n->typ)
+	{
+		redex->left = n->left;
+		redex->right = n->right;
+		if (!n->left->permanent)
+			++n->left->refcnt;
+		if (!n->right->permanent)
+			++n->right->refcnt;
+	} else {
+		redex->typ = ATOM;
+		redex->name = n->name;
+		redex->rule = n->rule;
+		redex->left = redex->right = NULL;
+	}
+
+	/* n, a fresh node or one of the arguments, may hang
+	 * off the old children, so they get released last. */
+	if (!n->permanent)
+	{
+		++n->refcnt;
+		free_node(n);
+	}
+	free_node(old_left);
+	free_node(old_right);
 }
 
 /* Called by "rules" interpreter command. */
 void
 print_rules(void)
 {
+	struct rule_state *rs = current_context->rules;
 	int i;
 
-	for (i = 0; i < number_of_rules; ++i)
-		print_reduction_rule(rules[i]);
+	for (i = 0; i < rs->number_of_rules; ++i)
+		print_reduction_rule(rs->rules[i]);
+}
+
+/* A checkpoint only makes sense with the rules it got written
+ * with.  FNV-1a hash of each rule's name and compiled code, summed,
+ * so the order the rules got defined in doesn't matter. */
+unsigned long
+rules_fingerprint(void)
+{
+	struct rule_state *rs = current_context->rules;
+	unsigned long fingerprint = 0;
+	int i, j;
+
+	for (i = 0; i < rs->number_of_rules; ++i)
+	{
+		unsigned long h = 2166136261UL;
+		const char *p;
+
+#define FNV(x) h = ((h ^ (unsigned long)(x)) * 16777619UL) & 0xffffffffUL
+		for (p = rs->rules[i]->name; *p; ++p)
+			FNV((unsigned char)*p);
+		FNV(rs->rules[i]->required_depth);
+		FNV(rs->rules[i]->result_register);
+		for (j = 0; j < rs->rules[i]->code_length; ++j)
+		{
+			FNV(rs->rules[i]->code[j].func);
+			FNV(rs->rules[i]->code[j].arg);
+		}
+#undef FNV
+
+		fingerprint += h;
+	}
+
+	return fingerprint & 0xffffffffUL;
+}
+
+/* Interpreter images: for each primitive, its name, required
+ * depth, and result tree in pre-order, with 0 for an application,
+ * followed by its function and argument. */
+void
+save_rules(FILE *out)
+{
+	struct rule_state *rs = current_context->rules;
+	int i;
+
+	image_put(out, rs->number_of_rules);
+	for (i = 0; i < rs->number_of_rules; ++i)
+	{
+		image_put_atom(out, rs->rules[i]->name);
+		image_put(out, rs->rules[i]->required_depth);
+		save_reduction_tree(out, rs->rules[i]->result_tree);
+	}
+}
+
+static void
+save_reduction_tree(FILE *out, struct reduction_rule_node *node)
+{
+	image_put(out, node->combinator_argument_number);
+	if (!node->combinator_argument_number)
+	{
+		save_reduction_tree(out, node->func);
+		save_reduction_tree(out, node->arg);
+	}
+}
+
+void
+load_rules(struct image *im)
+{
+	int i, count = image_get(im, 0, im->end - im->p);
+
+	for (i = 0; i < count && !im->bad; ++i)
+	{
+		struct reduction_rule *rule = calloc(1, sizeof *rule);
+
+		rule->name = image_get_atom(im);
+		rule->required_depth = image_get(im, 1, 1000000);
+		rule->result_tree = load_reduction_tree(im, rule->required_depth);
+
+		if (im->bad || !rule->name)
+			im->bad = 1;
+		if (im->bad || im->check_only)
+			free_reduction_rule(rule);
+		else
+			add_reduction_rule(rule);
+	}
+}
+
+static struct reduction_rule_node *
+load_reduction_tree(struct image *im, int required_depth)
+{
+	struct reduction_rule_node *node = calloc(1, sizeof *node);
+
+	node->combinator_argument_number = image_get(im, 0, required_depth);
+	if (!node->combinator_argument_number && !im->bad)
+	{
+		node->func = load_reduction_tree(im, required_depth);
+		node->func->parent = node;
+		node->arg = load_reduction_tree(im, required_depth);
+		node->arg->parent = node;
+	}
+
+	return node;
 }
@@ -26,19 +26,43 @@ struct reduction_rule_node {
 	int depth;
 };
 
+/* One step of a compiled rule: build an application node
+ * out of two registers. */
+struct rule_instruction {
+	int func;
+	int arg;
+};
+
 struct reduction_rule {
 	const char *name;    /* name of the atomic combinator: S, K, B, C, etc */
 	int required_depth;
 
 	/* what the re-arraneged arguments to the combinator look like: */
 	struct reduction_rule_node *result_tree;
+
+	/* result_tree, compiled by add_reduction_rule(). Registers 1
+	 * through required_depth hold the arguments, instruction i puts
+	 * its new node in register required_depth + 1 + i.  Identical
+	 * subtrees of result_tree compile to a single instruction. */
+	struct rule_instruction *code;
+	int code_length;
+	int result_register;
 };
 
 void free_reduction_tree(struct reduction_rule_node *tree);
 void print_rules(void);
 void add_reduction_rule(struct reduction_rule *rule);
 struct reduction_rule *get_reduction_rule(const char *identifier);
-void perform_reduction(struct spine_stack *stack);
+int perform_reduction(struct spine_stack *stack);
+int rule_register_count(void);
+void use_rule_registers(struct node **r);
+void private_rule_registers(int on);
+unsigned long rules_fingerprint(void);
+struct image;
+void save_rules(FILE *out);
+void load_rules(struct image *im);
 void free_rules(void);
+struct rule_state;
+struct rule_state *new_rule_state(void);
 
 void traverse_rule(struct reduction_rule *rule);
@@ -0,0 +1,322 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Evaluation server.
+ *
+ * serve() listens on a Unix domain socket, then keeps worker_count
+ * fork()ed copies of the interpreter waiting in accept().  Each worker
+ * handles a single connection, then exits, and serve() forks another
+ * one in its place.  A connection always starts out with the bases,
+ * rules and settings the server loaded, no matter what connections
+ * before it did.  Forking happens while no connection waits on it,
+ * and the copies share the loaded bases copy-on-write.
+ *
+ * A connection sends requests one line at a time.  A request is any
+ * line the interpreter could read from a file: an expression, a "def",
+ * or a command like "count", "timeout" or "memory", which sets the
+ * limits for the rest of that connection.  Commands that read or write
+ * files, like "load", "save-image" or "trace binary", get refused, see
+ * allowed_in_request() in grammar.y.  The worker sends back what the
+ * interpreter prints for the line, standard error included, then a
+ * line holding only ".".  As in SMTP, a reply line that starts with
+ * a period gets another one in front, which run_client() takes off.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <server.h>
+
+/* from grammar.y */
+extern void interpret_request(char *line, size_t length);
+extern void prepare_for_fork(void);
+
+static pid_t start_worker(int listener);
+static void  run_worker(int listener);
+static void  send_reply(FILE *scratch, FILE *conn);
+static int   unix_socket_address(const char *socket_path, struct sockaddr_un *addr);
+static void  stop_server(int signo);
+
+static volatile sig_atomic_t server_stopping = 0;
+
+int
+serve(const char *socket_path, int worker_count)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	pid_t *workers;
+	int listener, i, live;
+
+	if (worker_count < 1)
+		worker_count = 1;
+
+	if (!unix_socket_address(socket_path, &addr))
+		return 1;
+
+	if (0 > (listener = socket(AF_UNIX, SOCK_STREAM, 0)))
+	{
+		fprintf(stderr, "Problem creating socket: %s\n", strerror(errno));
+		return 1;
+	}
+
+	/* A socket file left over from a server that died */
+	unlink(socket_path);
+
+	if (0 > bind(listener, (struct sockaddr *)&addr, sizeof(addr))
+		|| 0 > listen(listener, 64))
+	{
+		fprintf(stderr, "Problem listening on \"%s\": %s\n",
+			socket_path, strerror(errno));
+		close(listener);
+		return 1;
+	}
+
+	/* No SA_RESTART: waitpid() has to quit on a signal. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_server;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	prepare_for_fork();
+
+	workers = calloc(worker_count, sizeof(workers[0]));
+	for (i = 0; i < worker_count; ++i)
+		workers[i] = start_worker(listener);
+
+	while (!server_stopping)
+	{
+		pid_t pid = waitpid(-1, NULL, 0);
+
+		if (pid < 0)
+		{
+			if (ECHILD == errno)
+				break;
+			continue;
+		}
+
+		for (i = 0; i < worker_count; ++i)
+			if (workers[i] == pid)
+				workers[i] = server_stopping? 0: start_worker(listener);
+	}
+
+	for (i = 0, live = 0; i < worker_count; ++i)
+		if (workers[i] > 0)
+		{
+			kill(workers[i], SIGTERM);
+			++live;
+		}
+	while (live > 0 && waitpid(-1, NULL, 0) > 0)
+		--live;
+
+	free(workers);
+	close(listener);
+	unlink(socket_path);
+
+	return 0;
+}
+
+static void
+stop_server(int signo)
+{
+	server_stopping = signo;
+}
+
+static pid_t
+start_worker(int listener)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	switch (pid = fork())
+	{
+	case -1:
+		fprintf(stderr, "Problem starting a worker: %s\n", strerror(errno));
+		return 0;
+	case 0:
+		run_worker(listener);
+		_exit(0);
+	}
+
+	return pid;
+}
+
+/* A worker takes one connection, reads requests from it until it
+ * closes, and sends back everything the interpreter prints. */
+static void
+run_worker(int listener)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t length;
+	FILE *scratch, *reply;
+	int conn;
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	while (0 > (conn = accept(listener, NULL, NULL)))
+		if (EINTR != errno)
+			_exit(1);
+	close(listener);
+
+	/* The interpreter prints into a scratch file, and each reply
+	 * gets copied from there to the connection, periods escaped. */
+	if (!(scratch = tmpfile()) || !(reply = fdopen(conn, "w")))
+		_exit(1);
+	dup2(conn, STDIN_FILENO);
+	dup2(fileno(scratch), STDOUT_FILENO);
+	dup2(fileno(scratch), STDERR_FILENO);
+	setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+
+	while (0 < (length = getline(&line, &size, stdin)))
+	{
+		/* The parser needs every statement to end in a newline */
+		if ('\n' != line[length - 1])
+		{
+			if ((size_t)length + 2 > size)
+				line = realloc(line, size = length + 2);
+			line[length++] = '\n';
+			line[length] = '\0';
+		}
+
+		interpret_request(line, length);
+
+		fflush(stdout);
+		fflush(stderr);
+		send_reply(scratch, reply);
+	}
+
+	free(line);
+}
+
+/* Copies what the interpreter printed for one request to the
+ * connection, then empties the scratch file for the next one. */
+static void
+send_reply(FILE *scratch, FILE *conn)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t length;
+
+	rewind(scratch);
+	while (0 < (length = getline(&line, &size, scratch)))
+	{
+		if ('.' == line[0])
+			putc('.', conn);
+		fputs(line, conn);
+		if ('\n' != line[length - 1])
+			putc('\n', conn);
+	}
+	fputs(".\n", conn);
+	fflush(conn);
+	free(line);
+
+	/* stdout and stderr share scratch's file offset */
+	if (ftruncate(fileno(scratch), 0))
+		_exit(1);
+	rewind(scratch);
+}
+
+/* "acl -C socket": sends each line of standard input to the
+ * server as a request, and copies its replies to standard output. */
+int
+run_client(const char *socket_path)
+{
+	struct sockaddr_un addr;
+	char *line = NULL, *reply = NULL;
+	size_t size = 0, reply_size = 0;
+	ssize_t length;
+	FILE *from_server;
+	int sock, r = 0;
+
+	if (!unix_socket_address(socket_path, &addr))
+		return 1;
+
+	if (0 > (sock = socket(AF_UNIX, SOCK_STREAM, 0))
+		|| 0 > connect(sock, (struct sockaddr *)&addr, sizeof(addr)))
+	{
+		fprintf(stderr, "Problem connecting to \"%s\": %s\n",
+			socket_path, strerror(errno));
+		if (sock >= 0)
+			close(sock);
+		return 1;
+	}
+
+	from_server = fdopen(sock, "r");
+
+	while (!r && 0 < (length = getline(&line, &size, stdin)))
+	{
+		if (length != write(sock, line, length)
+			|| ('\n' != line[length - 1] && 1 != write(sock, "\n", 1)))
+		{
+			r = 1;
+			break;
+		}
+
+		for (;;)
+		{
+			if (0 >= getline(&reply, &reply_size, from_server))
+			{
+				fprintf(stderr, "Server at \"%s\" went away\n", socket_path);
+				r = 1;
+				break;
+			}
+			if (!strcmp(reply, ".\n"))
+				break;
+			fputs(reply + ('.' == reply[0]), stdout);
+		}
+	}
+
+	free(line);
+	free(reply);
+	fclose(from_server);
+
+	return r;
+}
+
+static int
+unix_socket_address(const char *socket_path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	if (strlen(socket_path) >= sizeof(addr->sun_path))
+	{
+		fprintf(stderr, "Socket name \"%s\" is too long\n", socket_path);
+		return 0;
+	}
+	strcpy(addr->sun_path, socket_path);
+
+	return 1;
+}
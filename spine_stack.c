@@ -23,27 +23,38 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
 
 #include <spine_stack.h>
 #include <node.h>
-
-/* Only a single spine stack instance gets created
- * during any run of the interpreter.  That single
- * instance gets reused to evaluate the second and
- * later expressions evaluated. */
-struct spine_stack *old_spine_stack = NULL;
-static int spine_stack_resizes = 0;
-
-extern int interpreter_interrupted;
+#include <context.h>
+
+/* One interpreter context's spine stack, see context.h */
+struct spine_state {
+	/* Only a single spine stack instance gets created
+	 * during any run of the interpreter.  That single
+	 * instance gets reused to evaluate the second and
+	 * later expressions evaluated. */
+	struct spine_stack *old_spine_stack;
+	int spine_stack_resizes;
+};
+
+struct spine_state *
+new_spine_state(void)
+{
+	return calloc(1, sizeof(struct spine_state));
+}
 
 struct spine_stack *
 new_spine_stack(int sz)
 {
+	struct spine_state *sps = current_context->spines;
 	struct spine_stack *r;
 
-	if (old_spine_stack)
+	if (sps->old_spine_stack)
 	{
-		r = old_spine_stack;
+		r = sps->old_spine_stack;
 		r->top   = 0;
 		/* Don't NULL out old_spine_stack: if someone control-c's
 		 * the interpreter during a reduction, it might miss putting
@@ -62,7 +73,45 @@ new_spine_stack(int sz)
 void
 delete_spine_stack(struct spine_stack *ss)
 {
-	old_spine_stack = ss;
+	struct spine_state *sps = current_context->spines;
+
+	sps->old_spine_stack = ss;
+}
+
+/* A spine stack that doesn't get reused, for the
+ * threads of a parallel reduction (see parallel.c) */
+struct spine_stack *
+private_spine_stack(int sz)
+{
+	struct spine_stack *r = malloc(sizeof(*r));
+
+	r->stack = malloc(sz * sizeof(struct spine_stack_element));
+	r->size = sz;
+	r->maxdepth = 0;
+	r->top   = 0;
+
+	return r;
+}
+
+/* A private copy of ss, for a reduction that
+ * stopped, and might get picked up again. */
+struct spine_stack *
+copy_spine_stack(struct spine_stack *ss)
+{
+	struct spine_stack *r = private_spine_stack(ss->size);
+
+	memcpy(r->stack, ss->stack, ss->top*sizeof(ss->stack[0]));
+	r->top = ss->top;
+	r->maxdepth = ss->maxdepth;
+
+	return r;
+}
+
+void
+free_spine_stack(struct spine_stack *ss)
+{
+	free(ss->stack);
+	free(ss);
 }
 
 
@@ -96,7 +145,10 @@ pushnode(struct spine_stack *ss, struct node *n, int mark)
 		/* resize the allocation pointed to by stack */
 		struct spine_stack_element *old_stack = ss->stack;
 		size_t new_size = ss->size * 2;  /* XXX !!! */
-		++spine_stack_resizes;
+		/* Statistics cover the one shared stack: "-j N" threads
+		 * push on private stacks at the same time. */
+		if (ss == current_context->spines->old_spine_stack)
+			++current_context->spines->spine_stack_resizes;
 		ss->stack = realloc(old_stack, sizeof(struct spine_stack_element)*new_size);
 		ss->size = new_size;
 	}
@@ -105,13 +157,28 @@ pushnode(struct spine_stack *ss, struct node *n, int mark)
 void
 free_all_spine_stacks(void)
 {
-	if (old_spine_stack)
+	struct spine_state *sps = current_context->spines;
+
+	if (sps->old_spine_stack)
 	{
-		free(old_spine_stack->stack);
-		old_spine_stack->stack = NULL;
-		old_spine_stack->top = 0;
-		old_spine_stack->size = 0;
-		free(old_spine_stack);
-		old_spine_stack = NULL;
+		free(sps->old_spine_stack->stack);
+		sps->old_spine_stack->stack = NULL;
+		sps->old_spine_stack->top = 0;
+		sps->old_spine_stack->size = 0;
+		free(sps->old_spine_stack);
+		sps->old_spine_stack = NULL;
 	}
 }
+
+void
+print_spine_stack_statistics(void)
+{
+	struct spine_state *sps = current_context->spines;
+
+	if (sps->old_spine_stack)
+		printf("spine stack: %d elements, maximum depth %d, %d resizes\n",
+			sps->old_spine_stack->size, sps->old_spine_stack->maxdepth,
+			sps->spine_stack_resizes);
+	else
+		printf("spine stack: not allocated\n");
+}
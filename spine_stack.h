@@ -36,7 +36,13 @@ struct spine_stack {
 struct spine_stack *new_spine_stack(int sz);
 void pushnode(struct spine_stack *ss, struct node *n, int mark);
 void delete_spine_stack(struct spine_stack *ss);
+struct spine_stack *private_spine_stack(int sz);
+struct spine_stack *copy_spine_stack(struct spine_stack *ss);
+void free_spine_stack(struct spine_stack *ss);
 void free_all_spine_stacks(void);
+struct spine_state;
+struct spine_state *new_spine_state(void);
+void print_spine_stack_statistics(void);
 
 #define TOPNODE(ss) ((ss)->stack[(ss)->top - 1].node)
 #define DEPTH(ss) ((ss)->stack[(ss)->top - 1].depth)
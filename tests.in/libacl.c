@@ -0,0 +1,87 @@
+/*
+ * libacl test driver: runtests compiles this against libacl.a, and
+ * compares what it prints, standard error included, with tests.out/libacl.
+ */
+
+#include <stdio.h>
+
+#include <libacl.h>
+
+/* Globals a program might well have, that the interpreter
+ * has too: the library mustn't clash with them. */
+int lineno = 0;
+int prompting = 0;
+FILE *yyin = NULL;
+int yyparse(void) { return 0; }
+
+static const char *result_names[] = {
+	"normal form", "cycle", "interrupted",
+	"step limit", "time limit", "memory limit"
+};
+
+static void
+reduce_and_print(struct acl_context *ctx, const char *text, int contractions)
+{
+	struct acl_budget budget = {0, 0.0, 0};
+	struct node *term = acl_parse(ctx, text);
+	char buf[128];
+	enum acl_result r;
+
+	if (!term)
+	{
+		printf("%s: no term\n", text);
+		return;
+	}
+
+	budget.contractions = contractions;
+	r = acl_reduce(ctx, &term, contractions? &budget: NULL);
+	acl_print(term, buf, sizeof(buf));
+	printf("%s: %s: %s\n", text, result_names[r], buf);
+
+	acl_release(ctx, term);
+}
+
+int
+main(void)
+{
+	struct acl_context *ctx = acl_open();
+	struct node *held, *bad;
+	char small[8];
+	int length;
+
+	/* syntax errors go to stderr: keep them in order */
+	setvbuf(stdout, NULL, _IONBF, 0);
+
+	printf("define: %d\n", acl_define(ctx,
+		"rule: I 1 -> 1\n"
+		"rule: K 1 2 -> 1\n"
+		"rule: S 1 2 3 -> 1 3 (2 3)\n"
+		"def W S S (K I)\n"));
+
+	reduce_and_print(ctx, "S K K x", 0);
+	reduce_and_print(ctx, "W f x", 0);
+	reduce_and_print(ctx, "S I I (S I I)", 5);
+
+	/* a term held across a syntax error and another reduction */
+	held = acl_parse(ctx, "K (I a) b");
+	bad = acl_parse(ctx, "S K (");
+	printf("syntax error: %s\n", bad? "parsed": "NULL");
+	printf("define with a syntax error: %d\n", acl_define(ctx, "def X (S K\n"));
+	reduce_and_print(ctx, "S K K y", 0);
+
+	length = acl_print(held, small, sizeof(small));
+	printf("held: %d \"%s\"\n", length, small);
+	printf("held: %s\n", result_names[acl_reduce(ctx, &held, NULL)]);
+	acl_print(held, small, sizeof(small));
+	printf("held: \"%s\"\n", small);
+	acl_release(ctx, held);
+
+	/* nothing held: the syntax error's nodes go back too */
+	bad = acl_parse(ctx, "S K (");
+	printf("syntax error: %s\n", bad? "parsed": "NULL");
+	reduce_and_print(ctx, "I z", 0);
+
+	acl_close(ctx);
+
+	return 0;
+}
@@ -0,0 +1,268 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Sampled and binary reduction traces, see trace.h for the file
+ * format and acltrace.c for the program that reads it.  graph.c
+ * decides when a contraction gets traced, this decides which ones
+ * and where the output goes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+
+#include <node.h>
+#include <atom.h>
+#include <spine_stack.h>
+#include <reduction_rule.h>
+#include <trace.h>
+#include <context.h>
+
+/* One interpreter context's trace file, see context.h */
+struct trace_state {
+	FILE *out;                 /* "trace binary" file, NULL for stdout */
+	const char *filename;
+	unsigned char *named;      /* named[id] set: TRACE_NAME written */
+	int named_size;
+};
+
+static int  name_number(struct trace_state *ts, struct node *atom);
+static void name_tree(struct trace_state *ts, struct node *node);
+static void write_tree(struct trace_state *ts, struct node *node);
+static void put_varint(FILE *out, unsigned long v);
+
+struct trace_state *
+new_trace_state(void)
+{
+	return calloc(1, sizeof(struct trace_state));
+}
+
+/* Returns 0 and leaves any earlier file open if filename won't open */
+int
+open_trace_file(const char *filename)
+{
+	struct trace_state *ts = current_context->traces;
+	FILE *out;
+
+	if (!(out = fopen(filename, "wb")))
+	{
+		fprintf(stderr, "Could not open \"%s\" for write: %s\n",
+			filename, strerror(errno));
+		return 0;
+	}
+
+	close_trace_file();
+
+	fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), out);
+	putc(TRACE_VERSION, out);
+
+	ts->out = out;
+	ts->filename = filename;
+
+	return 1;
+}
+
+void
+close_trace_file(void)
+{
+	struct trace_state *ts = current_context->traces;
+
+	if (ts->out && fclose(ts->out))
+		fprintf(stderr, "Could not write \"%s\": %s\n",
+			ts->filename, strerror(errno));
+	ts->out = NULL;
+	ts->filename = NULL;
+
+	free(ts->named);
+	ts->named = NULL;
+	ts->named_size = 0;
+}
+
+int
+tracing_binary(void)
+{
+	return NULL != current_context->traces->out;
+}
+
+/* Rules can change between reductions, and with them
+ * the required depths in TRACE_NAME records. */
+void
+trace_begin(void)
+{
+	struct trace_state *ts = current_context->traces;
+
+	if (ts->named)
+		memset(ts->named, 0, ts->named_size);
+}
+
+/* A reduction stopped: acltrace can read what it traced so far */
+void
+trace_end(void)
+{
+	struct trace_state *ts = current_context->traces;
+
+	if (ts->out)
+		fflush(ts->out);
+}
+
+/* Does the graph after contraction number step get traced? */
+int
+trace_sampled(unsigned long step)
+{
+	struct acl_context *ctx = current_context;
+
+	if (ctx->trace_every > 1 && step % ctx->trace_every)
+		return 0;
+
+	if (ctx->trace_size > 0 && live_node_count() <= ctx->trace_size)
+		return 0;
+
+	return 1;
+}
+
+/* atom, at the top of stack, is about to get contracted */
+void
+trace_step(unsigned long step, struct node *atom, struct spine_stack *stack)
+{
+	struct trace_state *ts = current_context->traces;
+	int name;
+
+	if (!ts->out)
+		return;
+
+	name = name_number(ts, atom);
+
+	putc(TRACE_STEP, ts->out);
+	put_varint(ts->out, step);
+	put_varint(ts->out, name);
+	put_varint(ts->out, PARENTNODE(stack, atom->rule->required_depth)->sn);
+	put_varint(ts->out, DEPTH(stack));
+	put_varint(ts->out, live_node_count());
+}
+
+/* The graph after contraction number step.  redex_count is -1
+ * unless "detect on" counted its redexes. */
+void
+trace_graph(unsigned long step, struct node *root, int redex_count)
+{
+	struct trace_state *ts = current_context->traces;
+
+	if (!ts->out)
+		return;
+
+	/* Names first, so that the graph goes out in one piece */
+	name_tree(ts, root);
+
+	putc(TRACE_GRAPH, ts->out);
+	put_varint(ts->out, step);
+	put_varint(ts->out, redex_count + 1);
+	write_tree(ts, root);
+}
+
+void
+print_trace_settings(void)
+{
+	struct acl_context *ctx = current_context;
+	struct trace_state *ts = ctx->traces;
+
+	if (ctx->trace_every > 1)
+		printf("tracing every %d contractions\n", ctx->trace_every);
+	if (ctx->trace_size > 0)
+		printf("tracing graphs of more than %d live nodes\n", ctx->trace_size);
+	if (ts->out)
+		printf("tracing to binary file \"%s\"\n", ts->filename);
+}
+
+/* Writes the TRACE_NAME record for atom's name, unless that
+ * has happened already.  Returns the name's number. */
+static int
+name_number(struct trace_state *ts, struct node *atom)
+{
+	int id, depth;
+
+	if (ATOM != atom->typ)
+		return 0;
+
+	if (!(id = Atom_id(atom->name)))
+		id = Atom_id(Atom_string(atom->name));
+
+	if (id >= ts->named_size)
+	{
+		int new_size = 2*id + 64;
+
+		ts->named = realloc(ts->named, new_size);
+		memset(ts->named + ts->named_size, 0, new_size - ts->named_size);
+		ts->named_size = new_size;
+	}
+
+	if (!ts->named[id])
+	{
+		depth = atom->rule? atom->rule->required_depth + 1: 0;
+
+		putc(TRACE_NAME, ts->out);
+		put_varint(ts->out, id);
+		put_varint(ts->out, depth);
+		put_varint(ts->out, strlen(atom->name));
+		fputs(atom->name, ts->out);
+		ts->named[id] = 1;
+	}
+
+	return id;
+}
+
+static void
+name_tree(struct trace_state *ts, struct node *node)
+{
+	while (APPLICATION == node->typ)
+	{
+		name_tree(ts, node->left);
+		node = node->right;
+	}
+
+	name_number(ts, node);
+}
+
+static void
+write_tree(struct trace_state *ts, struct node *node)
+{
+	while (APPLICATION == node->typ)
+	{
+		putc(0, ts->out);
+		write_tree(ts, node->left);
+		node = node->right;
+	}
+
+	put_varint(ts->out, name_number(ts, node));
+}
+
+static void
+put_varint(FILE *out, unsigned long v)
+{
+	while (v >= 0x80)
+	{
+		putc((v & 0x7f) | 0x80, out);
+		v >>= 7;
+	}
+	putc(v, out);
+}
@@ -0,0 +1,62 @@
+/*
+	Copyright (C) 2010-2011, Bruce Ediger
+
+    This file is part of acl.
+
+    acl is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    acl is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with acl; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Traces of long reductions: "trace every N" and "trace size N"
+ * print only some of the graphs "trace on" would, and "trace binary"
+ * writes records to a file instead, for acltrace to turn back into
+ * text.  The file starts with TRACE_MAGIC and a version byte, then
+ * has records, each a type byte and unsigned varints, as in
+ * checkpoint.c:
+ *
+ *   TRACE_NAME   name number, required depth + 1 (0: no rule),
+ *                length, characters
+ *   TRACE_STEP   contraction number, name number of the rule,
+ *                redex node's serial number, spine depth, live nodes
+ *   TRACE_GRAPH  contraction number, redex count + 1 (0: not
+ *                counted), then the graph in pre-order: 0 for an
+ *                application, the name number for an atom
+ *
+ * A name's record comes before anything that uses its number.  The
+ * graph gets written as a tree: it takes as long to read back in as
+ * printing it would have.
+ */
+
+#define TRACE_MAGIC   "ACLTRACE"
+#define TRACE_VERSION 1
+#define TRACE_NAME    'N'
+#define TRACE_STEP    'S'
+#define TRACE_GRAPH   'G'
+
+struct node;
+struct spine_stack;
+
+int  open_trace_file(const char *filename);
+void close_trace_file(void);
+int  tracing_binary(void);
+void trace_begin(void);
+void trace_end(void);
+int  trace_sampled(unsigned long step);
+void trace_step(unsigned long step, struct node *atom, struct spine_stack *stack);
+void trace_graph(unsigned long step, struct node *root, int redex_count);
+void print_trace_settings(void);
+struct trace_state;
+struct trace_state *new_trace_state(void);